@@ -0,0 +1,182 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "chained.h"
+
+struct chained_node {
+	struct chained_node *next;
+	void *entry;
+	uint64_t hash;
+};
+
+struct chained {
+	struct chained_node **buckets;
+	size_t size;
+	size_t count;
+	h64_hasher_f hasher;
+	h64_equals_f equals;
+	uint64_t seed;
+};
+
+enum {
+	DEFAULT_SIZE = 16,
+};
+
+static void *
+xcalloc(size_t n, size_t size)
+{
+	void *ptr = calloc(n, size);
+	assert(ptr && "Allocation failed");
+	return ptr;
+}
+
+struct chained *
+chained_create(h64_hasher_f hasher, h64_equals_f equals)
+{
+	struct chained *c = xcalloc(1, sizeof(*c));
+	c->buckets = xcalloc(DEFAULT_SIZE, sizeof(*c->buckets));
+	c->size = DEFAULT_SIZE;
+	c->hasher = hasher;
+	c->equals = equals;
+	c->seed = (uint64_t)c;
+	return c;
+}
+
+void
+chained_destroy(struct chained *c)
+{
+	for (size_t i = 0; i < c->size; ++i) {
+		struct chained_node *node = c->buckets[i];
+		while (node != NULL) {
+			struct chained_node *next = node->next;
+			free(node);
+			node = next;
+		}
+	}
+	free(c->buckets);
+	free(c);
+}
+
+static void
+chained_grow(struct chained *c)
+{
+	size_t size = c->size * 2;
+	struct chained_node **buckets = xcalloc(size, sizeof(*buckets));
+	for (size_t i = 0; i < c->size; ++i) {
+		struct chained_node *node = c->buckets[i];
+		while (node != NULL) {
+			struct chained_node *next = node->next;
+			struct chained_node **bucket =
+				&buckets[node->hash & (size - 1)];
+			node->next = *bucket;
+			*bucket = node;
+			node = next;
+		}
+	}
+	free(c->buckets);
+	c->buckets = buckets;
+	c->size = size;
+}
+
+/* Link to the node with the entry, or to the end of its chain. */
+static struct chained_node **
+chained_lookup(const struct chained *c, const void *entry, uint64_t hash)
+{
+	struct chained_node **link = &c->buckets[hash & (c->size - 1)];
+	while (*link != NULL) {
+		struct chained_node *node = *link;
+		if (node->hash == hash && c->equals(node->entry, entry))
+			break;
+		link = &node->next;
+	}
+	return link;
+}
+
+static void
+chained_link(struct chained *c, void *entry, uint64_t hash)
+{
+	if (c->count >= c->size)
+		chained_grow(c);
+	struct chained_node *node = xcalloc(1, sizeof(*node));
+	struct chained_node **bucket = &c->buckets[hash & (c->size - 1)];
+	node->entry = entry;
+	node->hash = hash;
+	node->next = *bucket;
+	*bucket = node;
+	c->count += 1;
+}
+
+void
+chained_insert(struct chained *c, void *entry)
+{
+	uint64_t hash = c->hasher(entry, c->seed);
+	struct chained_node **link = chained_lookup(c, entry, hash);
+	if (*link != NULL)
+		(*link)->entry = entry;
+	else
+		chained_link(c, entry, hash);
+}
+
+void
+chained_insert_new(struct chained *c, void *entry)
+{
+	chained_link(c, entry, c->hasher(entry, c->seed));
+}
+
+void *
+chained_find(const struct chained *c, const void *entry)
+{
+	uint64_t hash = c->hasher(entry, c->seed);
+	struct chained_node *node = *chained_lookup(c, entry, hash);
+	return node != NULL ? node->entry : NULL;
+}
+
+void *
+chained_erase(struct chained *c, const void *entry)
+{
+	uint64_t hash = c->hasher(entry, c->seed);
+	struct chained_node **link = chained_lookup(c, entry, hash);
+	struct chained_node *node = *link;
+	if (node == NULL)
+		return NULL;
+
+	void *ret = node->entry;
+	*link = node->next;
+	free(node);
+	c->count -= 1;
+	return ret;
+}
+
+uintptr_t
+chained_checksum(const struct chained *c)
+{
+	uintptr_t sum = 0;
+	for (size_t i = 0; i < c->size; ++i)
+		for (struct chained_node *n = c->buckets[i]; n; n = n->next)
+			sum += (uintptr_t)n->entry;
+	return sum;
+}
@@ -0,0 +1,60 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Separate chaining table, the baseline of h64_bench. Every entry gets
+ * a heap node, like std::unordered_map does, and the buckets array is
+ * grown at the load factor of 1.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "h64/h64.h"
+
+struct chained;
+
+struct chained *
+chained_create(h64_hasher_f hasher, h64_equals_f equals);
+
+void
+chained_destroy(struct chained *c);
+
+void
+chained_insert(struct chained *c, void *entry);
+
+void
+chained_insert_new(struct chained *c, void *entry);
+
+void *
+chained_find(const struct chained *c, const void *entry);
+
+void *
+chained_erase(struct chained *c, const void *entry);
+
+/* Sum of the entry pointers, to iterate over all of them. */
+uintptr_t
+chained_checksum(const struct chained *c);
@@ -0,0 +1,1106 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmarks of h64 against a separate chaining table.
+ *
+ * Every benchmark runs for every table, key type and table size, and
+ * reports the average time of one operation. Sizes are named after the
+ * cache level the table with its keys roughly fits in, from a half of L1
+ * to 10 times the last level cache, so results of different machines
+ * are comparable by name.
+ *
+ * Usage: h64_bench [--format=console|csv|json] [--filter=substring]
+ *                  [--min-time=seconds] [--max-entries=count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "h64/h64.h"
+#include "h64/h64_map.h"
+#include "chained.h"
+
+enum {
+	/* Approximate memory of a table per entry, besides the key. */
+	TABLE_BYTES_PER_ENTRY = 16,
+	MIN_ENTRIES = 16,
+	BATCH_SIZE = 64,
+	SHORT_STRING_SIZE = 12,
+	LONG_STRING_SIZE = 64,
+};
+
+static volatile uintptr_t sink;
+
+/* Calls of the key comparators, so false hint matches can be compared. */
+static size_t compares;
+
+/* ---- Keys ---- */
+
+struct key_type {
+	const char *name;
+	h64_hasher_f hasher;
+	h64_equals_f equals;
+	/* Bytes taken by a key in the pool. */
+	size_t size;
+	/* Write the i-th key to dst, keys are distinct for distinct i. */
+	void (*make)(void *dst, uint64_t i);
+};
+
+static uint64_t
+scramble(uint64_t i)
+{
+	/* Odd multiplier is a bijection, so the keys stay distinct. */
+	return i * 0x9E3779B97F4A7C15ull + 1;
+}
+
+static uint64_t
+u64_hash(const void *ptr, uint64_t seed)
+{
+	return h64_byte_hash(ptr, sizeof(uint64_t), seed);
+}
+
+static int
+u64_equals(const void *ptr1, const void *ptr2)
+{
+	compares += 1;
+	return *(const uint64_t *)ptr1 == *(const uint64_t *)ptr2;
+}
+
+static void
+u64_make(void *dst, uint64_t i)
+{
+	uint64_t key = scramble(i);
+	memcpy(dst, &key, sizeof(key));
+}
+
+static uint64_t
+str_hash(const void *ptr, uint64_t seed)
+{
+	const char *str = ptr;
+	return h64_byte_hash(str, (int)strlen(str), seed);
+}
+
+static int
+str_equals(const void *ptr1, const void *ptr2)
+{
+	compares += 1;
+	return strcmp(ptr1, ptr2) == 0;
+}
+
+static void
+short_string_make(void *dst, uint64_t i)
+{
+	snprintf(dst, SHORT_STRING_SIZE, "%011llu",
+		 (unsigned long long)(scramble(i) % 100000000000ull));
+}
+
+/* A long common prefix, so comparisons of hint matches are expensive. */
+static void
+long_string_make(void *dst, uint64_t i)
+{
+	snprintf(dst, LONG_STRING_SIZE,
+		 "tenant/region/service/object-storage/%016llx",
+		 (unsigned long long)scramble(i));
+}
+
+static const struct key_type key_types[] = {
+	{"u64", u64_hash, u64_equals, sizeof(uint64_t), u64_make},
+	{"short_str", str_hash, str_equals, SHORT_STRING_SIZE,
+	 short_string_make},
+	{"long_str", str_hash, str_equals, LONG_STRING_SIZE,
+	 long_string_make},
+};
+
+/*
+ * 2 * n keys: the first n are inserted in tables, the others are missing
+ * and used for misses and churn. order is a random permutation of [0, n).
+ */
+struct keys {
+	char *pool;
+	void **keys;
+	size_t *order;
+	size_t n;
+};
+
+/* The pool of the current keys, the arena of the arena sets. */
+static char *key_arena;
+
+static uint64_t
+xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static void
+keys_create(struct keys *k, const struct key_type *type, size_t n)
+{
+	/* Keys start at 8-byte boundaries, h64_byte_hash reads words. */
+	size_t stride = (type->size + 7) & ~(size_t)7;
+	k->n = n;
+	k->pool = malloc(2 * n * stride);
+	k->keys = malloc(2 * n * sizeof(*k->keys));
+	k->order = malloc(n * sizeof(*k->order));
+	assert(k->pool && k->keys && k->order && "Allocation failed");
+	key_arena = k->pool;
+	for (size_t i = 0; i < 2 * n; ++i) {
+		k->keys[i] = k->pool + i * stride;
+		type->make(k->keys[i], i);
+	}
+
+	uint64_t state = 0x2545F4914F6CDD1Dull;
+	for (size_t i = 0; i < n; ++i)
+		k->order[i] = i;
+	for (size_t i = n - 1; i > 0; --i) {
+		size_t j = xorshift(&state) % (i + 1);
+		size_t tmp = k->order[i];
+		k->order[i] = k->order[j];
+		k->order[j] = tmp;
+	}
+}
+
+static void
+keys_destroy(struct keys *k)
+{
+	free(k->pool);
+	free(k->keys);
+	free(k->order);
+}
+
+/* ---- Tables ---- */
+
+struct table_impl {
+	const char *name;
+	/* Name of the only key type the table works with, NULL for any. */
+	const char *key;
+	void *(*create)(const struct key_type *type);
+	void (*destroy)(void *t);
+	void (*insert)(void *t, void *entry);
+	void (*insert_new)(void *t, void *entry);
+	void *(*find)(void *t, const void *entry);
+	void *(*erase)(void *t, const void *entry);
+	uintptr_t (*checksum)(void *t);
+	/* NULL if the table has no batch lookups. */
+	void (*find_batch)(void *t, const void **entries, size_t n,
+			   void **out);
+};
+
+static void *
+h64_impl_create(const struct key_type *type)
+{
+	return h64_create(type->hasher, type->equals);
+}
+
+static void *
+h64_wide_impl_create(const struct key_type *type)
+{
+	struct h64_options options = {
+		.hasher = type->hasher,
+		.equals = type->equals,
+		.flags = H64_WIDE_PROBING,
+	};
+	return h64_create_ex(&options);
+}
+
+static void *
+h64_filter_impl_create(const struct key_type *type)
+{
+	struct h64_options options = {
+		.hasher = type->hasher,
+		.equals = type->equals,
+		.flags = H64_MISS_FILTER,
+	};
+	return h64_create_ex(&options);
+}
+
+static void
+h64_impl_destroy(void *t)
+{
+	h64_destroy(t);
+}
+
+static void
+h64_impl_insert(void *t, void *entry)
+{
+	h64_insert(t, entry);
+}
+
+static void
+h64_impl_insert_new(void *t, void *entry)
+{
+	h64_insert_new(t, entry);
+}
+
+static void *
+h64_impl_find(void *t, const void *entry)
+{
+	return h64_find(t, entry);
+}
+
+static void *
+h64_impl_erase(void *t, const void *entry)
+{
+	return h64_erase(t, entry);
+}
+
+static uintptr_t
+h64_impl_checksum(void *t)
+{
+	uintptr_t sum = 0;
+	h64_for_each((struct h64 *)t, entry)
+		sum += (uintptr_t)entry;
+	return sum;
+}
+
+static void
+h64_impl_find_batch(void *t, const void **entries, size_t n, void **out)
+{
+	h64_find_batch(t, entries, n, out);
+}
+
+/*
+ * Batch lookups as a scheduler of coroutines runs them with the lookup
+ * state machine: LOOKUP_FLIGHT lookups at a time, each prefetches its next
+ * group and yields to the others before the group is probed.
+ */
+enum { LOOKUP_FLIGHT = 16 };
+
+static void
+h64_lookup_impl_find_batch(void *t, const void **entries, size_t n,
+			   void **out)
+{
+	struct h64_lookup_state states[LOOKUP_FLIGHT];
+	size_t slots[LOOKUP_FLIGHT];
+	size_t flight = n < LOOKUP_FLIGHT ? n : LOOKUP_FLIGHT;
+	size_t next = 0;
+	for (size_t i = 0; i < flight; ++i) {
+		slots[i] = next++;
+		__builtin_prefetch(h64_lookup_start(&states[i], t,
+						    entries[slots[i]]));
+	}
+	for (size_t done = 0; done < n;) {
+		for (size_t i = 0; i < flight; ++i) {
+			struct h64_lookup_state *state = &states[i];
+			if (slots[i] == SIZE_MAX)
+				continue;
+			if (state->pending != NULL) {
+				__builtin_prefetch(h64_lookup_step(state));
+				continue;
+			}
+			out[slots[i]] = state->found;
+			done += 1;
+			slots[i] = SIZE_MAX;
+			if (next < n) {
+				slots[i] = next++;
+				__builtin_prefetch(
+					h64_lookup_start(state, t,
+							 entries[slots[i]]));
+			}
+		}
+	}
+}
+
+/* h64 layout with the hashers and comparators inlined. */
+static inline uint64_t
+typed_u64_hash(const uint64_t *key, uint64_t seed)
+{
+	return h64_byte_hash(key, sizeof(*key), seed);
+}
+
+#define typed_u64_equals(a, b)  (compares += 1, *(a) == *(b))
+
+static inline uint64_t
+typed_str_hash(const char *key, uint64_t seed)
+{
+	return h64_byte_hash(key, (int)strlen(key), seed);
+}
+
+#define typed_str_equals(a, b)  (compares += 1, strcmp((a), (b)) == 0)
+
+/* Table functions of a set of pointers to keys. */
+#define TYPED_IMPL(set, key_t)						       \
+	static void *							       \
+	set##_impl_create(const struct key_type *type)			       \
+	{								       \
+		(void)type;						       \
+		return set##_create();					       \
+	}								       \
+									       \
+	static void							       \
+	set##_impl_destroy(void *t)					       \
+	{								       \
+		set##_destroy(t);					       \
+	}								       \
+									       \
+	static void							       \
+	set##_impl_insert(void *t, void *entry)				       \
+	{								       \
+		set##_insert(t, entry);					       \
+	}								       \
+									       \
+	static void *							       \
+	set##_impl_find(void *t, const void *entry)			       \
+	{								       \
+		key_t *key = set##_find(t, entry);			       \
+		return key != NULL ? (void *)*key : NULL;		       \
+	}								       \
+									       \
+	static void *							       \
+	set##_impl_erase(void *t, const void *entry)			       \
+	{								       \
+		key_t erased = NULL;					       \
+		set##_erase(t, entry, &erased);				       \
+		return (void *)erased;					       \
+	}								       \
+									       \
+	static uintptr_t						       \
+	set##_impl_checksum(void *t)					       \
+	{								       \
+		struct set *typed = t;					       \
+		uintptr_t sum = 0;					       \
+		h64_map_for_each(typed, slot)				       \
+			sum += (uintptr_t)slot->key;			       \
+		return sum;						       \
+	}
+
+H64_DEFINE(typed_u64, const uint64_t *, typed_u64_hash, typed_u64_equals)
+H64_DEFINE_HINT16(typed16_u64, const uint64_t *, typed_u64_hash,
+		  typed_u64_equals)
+H64_DEFINE(typed_str, const char *, typed_str_hash, typed_str_equals)
+H64_DEFINE_HINT16(typed16_str, const char *, typed_str_hash,
+		  typed_str_equals)
+
+TYPED_IMPL(typed_u64, const uint64_t *)
+TYPED_IMPL(typed16_u64, const uint64_t *)
+TYPED_IMPL(typed_str, const char *)
+TYPED_IMPL(typed16_str, const char *)
+
+/* Table functions of a set of the keys of the pool. */
+#define ARENA_IMPL(set, entry_t)					       \
+	static void *							       \
+	set##_impl_create(const struct key_type *type)			       \
+	{								       \
+		(void)type;						       \
+		return set##_create();					       \
+	}								       \
+									       \
+	static void							       \
+	set##_impl_destroy(void *t)					       \
+	{								       \
+		set##_destroy(t);					       \
+	}								       \
+									       \
+	static void							       \
+	set##_impl_insert(void *t, void *entry)				       \
+	{								       \
+		set##_insert(t, entry);					       \
+	}								       \
+									       \
+	static void *							       \
+	set##_impl_find(void *t, const void *entry)			       \
+	{								       \
+		return set##_find(t, entry);				       \
+	}								       \
+									       \
+	static void *							       \
+	set##_impl_erase(void *t, const void *entry)			       \
+	{								       \
+		entry_t *erased = NULL;					       \
+		set##_erase(t, entry, &erased);				       \
+		return erased;						       \
+	}								       \
+									       \
+	static uintptr_t						       \
+	set##_impl_checksum(void *t)					       \
+	{								       \
+		struct set *typed = t;					       \
+		uintptr_t sum = 0;					       \
+		h64_map_for_each(typed, slot)				       \
+			sum += (uintptr_t)set##_entry(slot->key);	       \
+		return sum;						       \
+	}
+
+H64_DEFINE_ARENA(arena_u64, uint64_t, key_arena, 3, typed_u64_hash,
+		 typed_u64_equals)
+H64_DEFINE_ARENA(arena_str, char, key_arena, 3, typed_str_hash,
+		 typed_str_equals)
+
+ARENA_IMPL(arena_u64, uint64_t)
+ARENA_IMPL(arena_str, char)
+
+static void *
+chained_impl_create(const struct key_type *type)
+{
+	return chained_create(type->hasher, type->equals);
+}
+
+static void
+chained_impl_destroy(void *t)
+{
+	chained_destroy(t);
+}
+
+static void
+chained_impl_insert(void *t, void *entry)
+{
+	chained_insert(t, entry);
+}
+
+static void
+chained_impl_insert_new(void *t, void *entry)
+{
+	chained_insert_new(t, entry);
+}
+
+static void *
+chained_impl_find(void *t, const void *entry)
+{
+	return chained_find(t, entry);
+}
+
+static void *
+chained_impl_erase(void *t, const void *entry)
+{
+	return chained_erase(t, entry);
+}
+
+static uintptr_t
+chained_impl_checksum(void *t)
+{
+	return chained_checksum(t);
+}
+
+static const struct table_impl table_impls[] = {
+	{
+		.name = "h64",
+		.create = h64_impl_create,
+		.destroy = h64_impl_destroy,
+		.insert = h64_impl_insert,
+		.insert_new = h64_impl_insert_new,
+		.find = h64_impl_find,
+		.erase = h64_impl_erase,
+		.checksum = h64_impl_checksum,
+		.find_batch = h64_impl_find_batch,
+	},
+	{
+		.name = "h64_lookup",
+		.create = h64_impl_create,
+		.destroy = h64_impl_destroy,
+		.insert = h64_impl_insert,
+		.insert_new = h64_impl_insert_new,
+		.find = h64_impl_find,
+		.erase = h64_impl_erase,
+		.checksum = h64_impl_checksum,
+		.find_batch = h64_lookup_impl_find_batch,
+	},
+	{
+		.name = "h64_wide",
+		.create = h64_wide_impl_create,
+		.destroy = h64_impl_destroy,
+		.insert = h64_impl_insert,
+		.insert_new = h64_impl_insert_new,
+		.find = h64_impl_find,
+		.erase = h64_impl_erase,
+		.checksum = h64_impl_checksum,
+		.find_batch = h64_impl_find_batch,
+	},
+	{
+		.name = "h64_filter",
+		.create = h64_filter_impl_create,
+		.destroy = h64_impl_destroy,
+		.insert = h64_impl_insert,
+		.insert_new = h64_impl_insert_new,
+		.find = h64_impl_find,
+		.erase = h64_impl_erase,
+		.checksum = h64_impl_checksum,
+		.find_batch = h64_impl_find_batch,
+	},
+	{
+		.name = "h64_typed",
+		.key = "u64",
+		.create = typed_u64_impl_create,
+		.destroy = typed_u64_impl_destroy,
+		.insert = typed_u64_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = typed_u64_impl_insert,
+		.find = typed_u64_impl_find,
+		.erase = typed_u64_impl_erase,
+		.checksum = typed_u64_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "h64_typed16",
+		.key = "u64",
+		.create = typed16_u64_impl_create,
+		.destroy = typed16_u64_impl_destroy,
+		.insert = typed16_u64_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = typed16_u64_impl_insert,
+		.find = typed16_u64_impl_find,
+		.erase = typed16_u64_impl_erase,
+		.checksum = typed16_u64_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "h64_arena",
+		.key = "u64",
+		.create = arena_u64_impl_create,
+		.destroy = arena_u64_impl_destroy,
+		.insert = arena_u64_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = arena_u64_impl_insert,
+		.find = arena_u64_impl_find,
+		.erase = arena_u64_impl_erase,
+		.checksum = arena_u64_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "h64_typed",
+		.key = "long_str",
+		.create = typed_str_impl_create,
+		.destroy = typed_str_impl_destroy,
+		.insert = typed_str_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = typed_str_impl_insert,
+		.find = typed_str_impl_find,
+		.erase = typed_str_impl_erase,
+		.checksum = typed_str_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "h64_typed16",
+		.key = "long_str",
+		.create = typed16_str_impl_create,
+		.destroy = typed16_str_impl_destroy,
+		.insert = typed16_str_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = typed16_str_impl_insert,
+		.find = typed16_str_impl_find,
+		.erase = typed16_str_impl_erase,
+		.checksum = typed16_str_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "h64_arena",
+		.key = "long_str",
+		.create = arena_str_impl_create,
+		.destroy = arena_str_impl_destroy,
+		.insert = arena_str_impl_insert,
+		/* The template has no separate insert of new keys. */
+		.insert_new = arena_str_impl_insert,
+		.find = arena_str_impl_find,
+		.erase = arena_str_impl_erase,
+		.checksum = arena_str_impl_checksum,
+		.find_batch = NULL,
+	},
+	{
+		.name = "chained",
+		.create = chained_impl_create,
+		.destroy = chained_impl_destroy,
+		.insert = chained_impl_insert,
+		.insert_new = chained_impl_insert_new,
+		.find = chained_impl_find,
+		.erase = chained_impl_erase,
+		.checksum = chained_impl_checksum,
+		.find_batch = NULL,
+	},
+};
+
+/* ---- Benchmarks ---- */
+
+struct bench_env {
+	const struct table_impl *impl;
+	const struct key_type *type;
+	const struct keys *keys;
+	/* Table with the first n keys, for benchmarks which don't modify it. */
+	void *table;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *
+filled_table(const struct bench_env *env)
+{
+	void *t = env->impl->create(env->type);
+	for (size_t i = 0; i < env->keys->n; ++i)
+		env->impl->insert_new(t, env->keys->keys[i]);
+	return t;
+}
+
+/*
+ * A benchmark runs its operations once, adds the time they took to
+ * *seconds, setup excluded, and returns the number of operations.
+ */
+typedef size_t (*bench_f)(const struct bench_env *env, double *seconds);
+
+static size_t
+bench_find_hit(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	uintptr_t sum = 0;
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i)
+		sum += (uintptr_t)env->impl->find(env->table,
+						   k->keys[k->order[i]]);
+	*seconds += now() - start;
+	sink = sum;
+	return k->n;
+}
+
+static size_t
+bench_find_miss(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	uintptr_t sum = 0;
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i)
+		sum += (uintptr_t)env->impl->find(env->table,
+						   k->keys[k->n + k->order[i]]);
+	*seconds += now() - start;
+	sink = sum;
+	return k->n;
+}
+
+static size_t
+bench_find_hit_batch(const struct bench_env *env, double *seconds)
+{
+	if (env->impl->find_batch == NULL)
+		return 0;
+
+	const struct keys *k = env->keys;
+	const void *entries[BATCH_SIZE];
+	void *out[BATCH_SIZE];
+	uintptr_t sum = 0;
+	double start = now();
+	for (size_t i = 0; i < k->n; i += BATCH_SIZE) {
+		size_t n = k->n - i < BATCH_SIZE ? k->n - i : BATCH_SIZE;
+		for (size_t j = 0; j < n; ++j)
+			entries[j] = k->keys[k->order[i + j]];
+		env->impl->find_batch(env->table, entries, n, out);
+		sum += (uintptr_t)out[0];
+	}
+	*seconds += now() - start;
+	sink = sum;
+	return k->n;
+}
+
+static size_t
+bench_insert(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	void *t = env->impl->create(env->type);
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i)
+		env->impl->insert(t, k->keys[k->order[i]]);
+	*seconds += now() - start;
+	env->impl->destroy(t);
+	return k->n;
+}
+
+static size_t
+bench_insert_new(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	void *t = env->impl->create(env->type);
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i)
+		env->impl->insert_new(t, k->keys[k->order[i]]);
+	*seconds += now() - start;
+	env->impl->destroy(t);
+	return k->n;
+}
+
+static size_t
+bench_erase(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	void *t = filled_table(env);
+	uintptr_t sum = 0;
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i)
+		sum += (uintptr_t)env->impl->erase(t, k->keys[k->order[i]]);
+	*seconds += now() - start;
+	env->impl->destroy(t);
+	sink = sum;
+	return k->n;
+}
+
+/*
+ * Steady state of a cache: every step erases a key, inserts a new one
+ * and looks up a key, which is found in about a half of the steps.
+ */
+static size_t
+bench_churn(const struct bench_env *env, double *seconds)
+{
+	const struct keys *k = env->keys;
+	void *t = filled_table(env);
+	uintptr_t sum = 0;
+	double start = now();
+	for (size_t i = 0; i < k->n; ++i) {
+		size_t j = k->order[i];
+		sum += (uintptr_t)env->impl->erase(t, k->keys[j]);
+		env->impl->insert(t, k->keys[k->n + j]);
+		sum += (uintptr_t)env->impl->find(t, k->keys[k->order[k->n - 1 - i]]);
+	}
+	*seconds += now() - start;
+	env->impl->destroy(t);
+	sink = sum;
+	return 3 * k->n;
+}
+
+static size_t
+bench_iterate(const struct bench_env *env, double *seconds)
+{
+	double start = now();
+	sink = env->impl->checksum(env->table);
+	*seconds += now() - start;
+	return env->keys->n;
+}
+
+struct bench {
+	const char *name;
+	bench_f run;
+};
+
+static const struct bench benches[] = {
+	{"find_hit", bench_find_hit},
+	{"find_miss", bench_find_miss},
+	{"find_hit_batch", bench_find_hit_batch},
+	{"insert", bench_insert},
+	{"insert_new", bench_insert_new},
+	{"erase", bench_erase},
+	{"churn", bench_churn},
+	{"iterate", bench_iterate},
+};
+
+/* ---- Sizes ---- */
+
+struct size_class {
+	const char *name;
+	/* Memory of a table with its keys. */
+	size_t bytes;
+};
+
+static size_t
+cache_size(int name, size_t fallback)
+{
+	long size = -1;
+	(void)name;
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+	size = sysconf(name);
+#endif
+	return size > 0 ? (size_t)size : fallback;
+}
+
+struct caches {
+	size_t l1, l2, llc;
+};
+
+static struct caches
+detect_caches(void)
+{
+	struct caches c = {32 << 10, 1 << 20, 8 << 20};
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+	c.l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, c.l1);
+	c.l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, c.l2);
+	c.llc = cache_size(_SC_LEVEL3_CACHE_SIZE, c.l2);
+#endif
+	return c;
+}
+
+/* ---- Reporting ---- */
+
+enum format {
+	FORMAT_CONSOLE,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+struct result {
+	const char *bench;
+	const char *key;
+	const char *size;
+	const char *table;
+	size_t entries;
+	size_t iterations;
+	size_t ops;
+	double ns_per_op;
+	/* Key comparisons per operation, setup of the tables included. */
+	double compares_per_op;
+};
+
+struct reporter {
+	enum format format;
+	size_t reported;
+};
+
+static void
+report_begin(struct reporter *r, const struct caches *c)
+{
+	switch (r->format) {
+	case FORMAT_CONSOLE:
+		printf("L1 %zu KiB, L2 %zu KiB, LLC %zu KiB\n",
+		       c->l1 >> 10, c->l2 >> 10, c->llc >> 10);
+		printf("%-40s %12s %12s %12s %8s\n",
+		       "benchmark", "entries", "iterations", "ns/op", "cmp/op");
+		break;
+	case FORMAT_CSV:
+		printf("name,bench,key,size,table,entries,iterations,ops,"
+		       "ns_per_op,compares_per_op\n");
+		break;
+	case FORMAT_JSON:
+		printf("{\n  \"context\": {\n"
+		       "    \"num_cpus\": %ld,\n"
+		       "    \"caches\": {\"l1\": %zu, \"l2\": %zu, \"llc\": %zu}\n"
+		       "  },\n  \"benchmarks\": [",
+		       sysconf(_SC_NPROCESSORS_ONLN), c->l1, c->l2, c->llc);
+		break;
+	}
+}
+
+static void
+report(struct reporter *r, const struct result *res)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%s/%s/%s",
+		 res->bench, res->key, res->size, res->table);
+	switch (r->format) {
+	case FORMAT_CONSOLE:
+		printf("%-40s %12zu %12zu %12.2f %8.2f\n", name, res->entries,
+		       res->iterations, res->ns_per_op, res->compares_per_op);
+		break;
+	case FORMAT_CSV:
+		printf("%s,%s,%s,%s,%s,%zu,%zu,%zu,%.3f,%.3f\n", name,
+		       res->bench, res->key, res->size, res->table,
+		       res->entries, res->iterations, res->ops, res->ns_per_op,
+		       res->compares_per_op);
+		break;
+	case FORMAT_JSON:
+		printf("%s\n    {\"name\": \"%s\", \"bench\": \"%s\", "
+		       "\"key\": \"%s\", \"size\": \"%s\", \"table\": \"%s\", "
+		       "\"entries\": %zu, \"iterations\": %zu, \"ops\": %zu, "
+		       "\"real_time\": %.3f, \"time_unit\": \"ns\", "
+		       "\"compares_per_op\": %.3f}",
+		       r->reported > 0 ? "," : "", name, res->bench, res->key,
+		       res->size, res->table, res->entries, res->iterations,
+		       res->ops, res->ns_per_op, res->compares_per_op);
+		break;
+	}
+	r->reported += 1;
+	fflush(stdout);
+}
+
+static void
+report_end(struct reporter *r)
+{
+	if (r->format == FORMAT_JSON)
+		printf("\n  ]\n}\n");
+}
+
+/* ---- Driver ---- */
+
+struct config {
+	enum format format;
+	const char *filter;
+	double min_time;
+	size_t max_entries;
+};
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [--format=console|csv|json] [--filter=substring]\n"
+		"          [--min-time=seconds] [--max-entries=count]\n",
+		argv0);
+	exit(1);
+}
+
+static struct config
+parse_args(int argc, char **argv)
+{
+	struct config cfg = {FORMAT_CONSOLE, NULL, 0.2, SIZE_MAX};
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--format=console") == 0)
+			cfg.format = FORMAT_CONSOLE;
+		else if (strcmp(arg, "--format=csv") == 0)
+			cfg.format = FORMAT_CSV;
+		else if (strcmp(arg, "--format=json") == 0)
+			cfg.format = FORMAT_JSON;
+		else if (strncmp(arg, "--filter=", 9) == 0)
+			cfg.filter = arg + 9;
+		else if (strncmp(arg, "--min-time=", 11) == 0)
+			cfg.min_time = atof(arg + 11);
+		else if (strncmp(arg, "--max-entries=", 14) == 0)
+			cfg.max_entries = strtoull(arg + 14, NULL, 10);
+		else
+			usage(argv[0]);
+	}
+	return cfg;
+}
+
+/* Repeat the benchmark until it takes min_time, at least once. */
+static void
+run_bench(const struct config *cfg, struct reporter *r,
+	  const struct bench *bench, const struct bench_env *env,
+	  const char *size_name)
+{
+	double seconds = 0;
+	size_t ops = 0;
+	size_t iterations = 0;
+	size_t start_compares = compares;
+	do {
+		size_t n = bench->run(env, &seconds);
+		if (n == 0)
+			return;
+		ops += n;
+		iterations += 1;
+	} while (seconds < cfg->min_time);
+
+	struct result res = {
+		.bench = bench->name,
+		.key = env->type->name,
+		.size = size_name,
+		.table = env->impl->name,
+		.entries = env->keys->n,
+		.iterations = iterations,
+		.ops = ops,
+		.ns_per_op = seconds * 1e9 / ops,
+		.compares_per_op = (double)(compares - start_compares) / ops,
+	};
+	report(r, &res);
+}
+
+static bool
+matches(const struct config *cfg, const char *bench, const char *key,
+	const char *size, const char *table)
+{
+	if (cfg->filter == NULL)
+		return true;
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%s/%s/%s", bench, key, size, table);
+	return strstr(name, cfg->filter) != NULL;
+}
+
+static bool
+impl_supports(const struct table_impl *impl, const struct key_type *type)
+{
+	return impl->key == NULL || strcmp(impl->key, type->name) == 0;
+}
+
+/* Whether any benchmark of the table, key type and size is to be run. */
+static bool
+any_matches(const struct config *cfg, const char *key, const char *size,
+	    const char *table)
+{
+	size_t benches_count = sizeof(benches) / sizeof(benches[0]);
+	for (size_t b = 0; b < benches_count; ++b)
+		if (matches(cfg, benches[b].name, key, size, table))
+			return true;
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct config cfg = parse_args(argc, argv);
+	struct caches caches = detect_caches();
+	const struct size_class sizes[] = {
+		{"L1", caches.l1 / 2},
+		{"L2", caches.l2 / 2},
+		{"LLC", caches.llc / 2},
+		{"2xLLC", caches.llc * 2},
+		{"10xLLC", caches.llc * 10},
+	};
+	size_t sizes_count = sizeof(sizes) / sizeof(sizes[0]);
+	size_t types_count = sizeof(key_types) / sizeof(key_types[0]);
+	size_t impls_count = sizeof(table_impls) / sizeof(table_impls[0]);
+	size_t benches_count = sizeof(benches) / sizeof(benches[0]);
+
+	struct reporter r = {cfg.format, 0};
+	report_begin(&r, &caches);
+	for (size_t t = 0; t < types_count; ++t) {
+		const struct key_type *type = &key_types[t];
+		for (size_t s = 0; s < sizes_count; ++s) {
+			size_t n = sizes[s].bytes /
+				   (TABLE_BYTES_PER_ENTRY + type->size);
+			n = n < MIN_ENTRIES ? MIN_ENTRIES : n;
+			n = n > cfg.max_entries ? cfg.max_entries : n;
+
+			bool needed = false;
+			for (size_t i = 0; i < impls_count; ++i)
+				needed |= impl_supports(&table_impls[i], type) &&
+					  any_matches(&cfg, type->name,
+						      sizes[s].name,
+						      table_impls[i].name);
+			if (!needed)
+				continue;
+
+			struct keys keys;
+			keys_create(&keys, type, n);
+			for (size_t i = 0; i < impls_count; ++i) {
+				if (!impl_supports(&table_impls[i], type) ||
+				    !any_matches(&cfg, type->name,
+						 sizes[s].name,
+						 table_impls[i].name))
+					continue;
+				struct bench_env env = {
+					.impl = &table_impls[i],
+					.type = type,
+					.keys = &keys,
+				};
+				env.table = filled_table(&env);
+				for (size_t b = 0; b < benches_count; ++b) {
+					if (!matches(&cfg, benches[b].name,
+						     type->name, sizes[s].name,
+						     env.impl->name))
+						continue;
+					run_bench(&cfg, &r, &benches[b], &env,
+						  sizes[s].name);
+				}
+				env.impl->destroy(env.table);
+			}
+			keys_destroy(&keys);
+		}
+	}
+	report_end(&r);
+	return 0;
+}
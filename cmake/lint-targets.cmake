@@ -3,6 +3,7 @@ set(
     source/*.c source/*.h
     include/*.h
     test/*.c test/*.h
+    benchmark/*.c benchmark/*.h
     CACHE STRING
     "; separated patterns relative to the project source dir to format"
 )
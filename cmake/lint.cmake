@@ -12,6 +12,7 @@ default(
     source/*.c source/*.h
     include/*.h
     test/*.c test/*.h
+    benchmark/*.c benchmark/*.h
 )
 default(FIX NO)
 
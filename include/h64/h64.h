@@ -28,16 +28,28 @@
 extern "C" {
 #endif
 
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
-/** Entries comparison function. Must return 0 if entries are equal, non-0 otherwise. */
+/** Entries comparison function. Must return non-0 if entries are equal, 0 otherwise. */
 typedef int (*h64_equals_f)(const void *lhs, const void *rhs);
 /** Entries hash function. Must have good distribution for all bits. */
 typedef uint64_t (*h64_hasher_f)(const void *entry, uint64_t seed);
+/**
+ * Hash function of keys of another type than entries, see h64_find_key.
+ * A key must have the hash of the entries equal to it.
+ */
+typedef uint64_t (*h64_key_hasher_f)(const void *key, uint64_t seed);
+/** Comparison of a key with an entry, non-0 if they are equal. */
+typedef int (*h64_key_equals_f)(const void *key, const void *entry);
 
 enum H64_INTERNAL_CONSTANTS {
 	H64_INTERNAL_GROUP_ENTRIES = 7,
+	/** Groups an iterator prefetches ahead of the current one. */
+	H64_INTERNAL_ITERATOR_PREFETCH = 4,
 };
 
 /**
@@ -71,6 +83,196 @@ struct h64_group {
 static_assert(sizeof(struct h64_group) == 64,
 	      "Group size must be equal to L1 cache line size");
 
+/** Optional features of a table, see h64_create_ex. */
+enum h64_flags {
+	/**
+	 * Keep the low 32 bits of every entry hash in a side array
+	 * (4 bytes per slot), so resizing relocates entries without
+	 * calling the hasher. Useful for expensive hashers, e.g. long strings.
+	 */
+	H64_STORE_HASHES = 1 << 0,
+	/**
+	 * Resize incrementally: keep the old array of groups next to the new
+	 * one and move a few old groups on every insert and erase, instead of
+	 * rehashing the whole table in one call. Lookups probe both arrays
+	 * while the old one isn't empty.
+	 */
+	H64_INCREMENTAL_RESIZE = 1 << 1,
+	/**
+	 * Never shrink the table on erase. Memory is given back only by
+	 * h64_shrink_to_fit.
+	 */
+	H64_NO_SHRINK = 1 << 2,
+	/**
+	 * Count probe lengths, hint matches and resizes for h64_stats.
+	 * Counters are relaxed atomics, so lookups stay safe to run from
+	 * several threads, and may be sampled, see stats_sample_shift.
+	 */
+	H64_STATISTICS = 1 << 3,
+	/**
+	 * Probe blocks of 4 adjacent groups: linearly through the first 8
+	 * groups, then quadratically from block to block. Long probe
+	 * sequences of misses at high load factors stay on adjacent cache
+	 * lines, which AVX2 and AVX-512 match 2 and 4 at a time.
+	 */
+	H64_WIDE_PROBING = 1 << 4,
+	/**
+	 * Keep a blocked Bloom filter of the entries, a 64-bit word per group
+	 * (1/8 of the groups memory). Lookups of most absent entries are
+	 * rejected by one word of the filter without probing the groups.
+	 * Erases leave their bits set, so the filter is rebuilt after enough
+	 * of them. Not supported by concurrent tables.
+	 */
+	H64_MISS_FILTER = 1 << 5,
+	/**
+	 * Clear "was full" bits no entry depends on anymore, a few groups per
+	 * insert and erase, once the table has seen as many erases as it
+	 * may hold entries before growing. Keeps misses short in churning
+	 * tables of a constant size, see also h64_clear_was_full.
+	 */
+	H64_CLEAR_WAS_FULL = 1 << 6,
+	/**
+	 * Bounded cache: the table is sized for min_capacity entries once and
+	 * never resized. An entry is placed in its first group only, and if
+	 * it's full, an entry of the group is evicted by CLOCK: lookups set a
+	 * reference bit of the slot found, and the hand of the group passes
+	 * referenced slots, clearing their bits, up to an unreferenced one.
+	 * Probes never go past the first group. Bits and hands take a side
+	 * array of 2 bytes per group. Not supported by concurrent tables.
+	 */
+	H64_EVICT = 1 << 7,
+};
+
+/**
+ * Allocator of the table arrays. alloc must return zero filled memory
+ * aligned at least to alignment, or NULL on failure. free receives the
+ * size passed to alloc. Both get ctx as the first argument.
+ */
+struct h64_allocator {
+	void *(*alloc)(void *ctx, size_t size, size_t alignment);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+/** Flags of h64_mmap_allocator. */
+enum h64_mmap_flags {
+	/** Ask for transparent huge pages with madvise(MADV_HUGEPAGE). */
+	H64_MMAP_THP = 1 << 0,
+	/**
+	 * Map explicit 2MB or 1GB huge pages (MAP_HUGETLB) if the system has
+	 * reserved them, and regular pages otherwise.
+	 */
+	H64_MMAP_HUGETLB_2MB = 1 << 1,
+	H64_MMAP_HUGETLB_1GB = 1 << 2,
+};
+
+/**
+ * Allocator mapping anonymous memory. The kernel provides zero pages on
+ * demand, so big arrays aren't touched by memset on allocation.
+ * flags is a bitwise or of enum h64_mmap_flags.
+ */
+struct h64_allocator
+h64_mmap_allocator(unsigned flags);
+
+/**
+ * Allocator of memory bound to the NUMA node with numa_alloc_onnode, so
+ * pages are placed on the node whatever thread touches them. It needs
+ * libnuma at build time and NUMA support of the system, without them the
+ * allocator is h64_mmap_allocator(0).
+ */
+struct h64_allocator
+h64_numa_allocator(int node);
+
+/**
+ * Executor of parallel work. run must call task(arg, i) for every i in
+ * [0, ntasks), possibly concurrently, and return when all the calls are
+ * done. threads is the number of tasks to split a resize into.
+ */
+struct h64_executor {
+	void (*run)(void *ctx, void (*task)(void *arg, size_t i), void *arg,
+		    size_t ntasks);
+	void *ctx;
+	size_t threads;
+};
+
+/** Executor spawning a thread per task for every run and joining them. */
+struct h64_executor
+h64_thread_executor(size_t threads);
+
+struct h64;
+
+/** Kinds of probe sequences reported to probe hooks. */
+enum h64_probe_kind {
+	/** Lookup of an entry, found or not. */
+	H64_PROBE_LOOKUP,
+	/** Search of an empty slot for a new entry. */
+	H64_PROBE_PLACE,
+};
+
+/**
+ * Probe hook, see struct h64_options: called with a probe sequence of the
+ * table for the hash, and the number of groups it took.
+ */
+typedef void (*h64_probe_hook_f)(const struct h64 *h,
+				 enum h64_probe_kind kind, uint64_t hash,
+				 size_t probes, void *ctx);
+
+/** Parameters of a table. Zeroed optional fields mean defaults. */
+struct h64_options {
+	/** Hashing and comparison functions for entries. Mandatory. */
+	h64_hasher_f hasher;
+	h64_equals_f equals;
+	/** Bitwise or of enum h64_flags. */
+	unsigned flags;
+	/** Load factor to grow the table at, in (0, 1). 0.67 by default. */
+	double max_load_factor;
+	/**
+	 * Load factor to shrink the table at, less than a half of
+	 * max_load_factor. A quarter of max_load_factor by default.
+	 */
+	double min_load_factor;
+	/** The table is never shrunk below the size for min_capacity entries. */
+	size_t min_capacity;
+	/** Allocator of the table arrays, aligned_alloc() by default. */
+	const struct h64_allocator *allocator;
+	/**
+	 * Hash seed. Tables with the same seed hash entries the same way,
+	 * so one hash serves several of them. By default it's derived from
+	 * the address of the table's groups, so it isn't random: tables that
+	 * reuse freed memory may get the same seed.
+	 */
+	uint64_t seed;
+	/**
+	 * Executor to resize big tables with, in parallel, so the hasher
+	 * must be thread-safe. Resizes run on the calling thread by default.
+	 */
+	const struct h64_executor *executor;
+	/**
+	 * With H64_STATISTICS, count only 1 of 2^stats_sample_shift
+	 * operations, up to 8. Every operation is counted by default.
+	 */
+	unsigned stats_sample_shift;
+	/**
+	 * With H64_EVICT, called with every evicted entry and evict_ctx,
+	 * before the entry taking its slot is placed. It must not modify the
+	 * table. Entries are evicted silently by default.
+	 */
+	void (*evict)(void *entry, void *ctx);
+	void *evict_ctx;
+	/**
+	 * Hook of 1 of 2^probe_hook_sample_shift lookups and searches of
+	 * empty slots, up to 8, called with probe_hook_ctx. It must not
+	 * modify the table. The hook is called by libraries built with
+	 * h64_TRACING only, others don't even check it on the way.
+	 */
+	h64_probe_hook_f probe_hook;
+	void *probe_hook_ctx;
+	unsigned probe_hook_sample_shift;
+};
+
+struct h64_counters;
+struct h64_cleanup;
+
 /**
  * Flat hash table.
  */
@@ -85,32 +287,179 @@ struct h64 {
 	size_t size_in_groups;
 	/** Number of entries presented in the table. */
 	size_t count;
+	/** Bitwise or of enum h64_flags. */
+	unsigned flags;
+	/**
+	 * Low halves of entry hashes, GROUP_ENTRIES per group.
+	 * Allocated only with H64_STORE_HASHES.
+	 */
+	uint32_t *hashes;
+	/**
+	 * Bloom filter of the entries, a word per group, and the number of
+	 * erases since it was built. Allocated only with H64_MISS_FILTER.
+	 */
+	uint64_t *filter;
+	size_t filter_erased;
+	/**
+	 * Arrays being drained by an incremental resize, NULL if the table
+	 * isn't resizing. Groups before migrated_groups are already moved.
+	 */
+	struct h64_group *old_groups;
+	uint32_t *old_hashes;
+	uint64_t *old_filter;
+	size_t old_size_in_groups;
+	size_t migrated_groups;
+	/** Resizing policy, see struct h64_options. */
+	double max_load_factor;
+	double min_load_factor;
+	size_t min_size_in_groups;
+	/** Counts of entries to grow and to shrink the current array at. */
+	size_t grow_count;
+	size_t shrink_count;
+	/** Groups of the current array with the "was full" bit set. */
+	size_t was_full_groups;
+	/**
+	 * Erases since the last H64_CLEAR_WAS_FULL cleanup, and the running
+	 * cleanup, NULL if there is none.
+	 */
+	size_t cleanup_erased;
+	struct h64_cleanup *cleanup;
+	/**
+	 * CLOCK state of every group with H64_EVICT, NULL without the flag,
+	 * and the callback of evicted entries.
+	 */
+	struct h64_clock *clock;
+	void (*evict)(void *entry, void *ctx);
+	void *evict_ctx;
+	/** Probe hook of H64_TRACING builds and the mask of sampled hints. */
+	h64_probe_hook_f probe_hook;
+	void *probe_hook_ctx;
+	uint8_t probe_hook_mask;
+	/** Allocator of groups and hashes. */
+	struct h64_allocator allocator;
+	/** Executor of parallel resizes, run is NULL if there is none. */
+	struct h64_executor executor;
+	/** Counters of H64_STATISTICS, NULL without the flag. */
+	struct h64_counters *counters;
+};
 
-#ifdef H64_STORE_STATISTICS
-	/** hint_sum / hint_count must be close to 255 / 2 */
-	uint64_t hint_sum;
-	uint64_t hint_count;
-	/** gives average and max probe length for finds */
-	uint64_t find_count;
-	uint64_t find_probe_count;
-	uint64_t find_max_probe_count;
-
-	/** gives average and max probe length for inserts  */
-	uint64_t insert_count;
-	uint64_t insert_probe_count;
-	uint64_t insert_max_probe_count;
-
-	/** gives average hitrate */
-	uint64_t compare_count;
-	uint64_t equal_count;
-#endif
+/** Number of groups to iterate over, both arrays during a resize. */
+static inline size_t
+h64_internal_groups_count(const struct h64 *h)
+{
+	return h->size_in_groups + h->old_size_in_groups;
+}
+
+static inline struct h64_group *
+h64_internal_group(const struct h64 *h, size_t i)
+{
+	return i < h->size_in_groups ? &h->groups[i]
+				     : &h->old_groups[i - h->size_in_groups];
+}
+
+/**
+ * Iterator over entries of a range of groups. Only present slots are
+ * visited: the status of a group is walked bit by bit, so empty groups
+ * cost a byte read. The table must not be modified while iterated.
+ */
+struct h64_iterator {
+	const struct h64 *h;
+	const struct h64_group *group;
+	/* The last group of the range in the array of group. */
+	const struct h64_group *last;
+	/* Range of groups left after the last one. */
+	size_t next;
+	size_t end;
+	/* Present slots of the current group not visited yet. */
+	unsigned status;
 };
 
+/**
+ * Iterator over the part-th of parts disjoint ranges of groups, both
+ * arrays during a resize. Iterators of all the parts visit every entry
+ * once together, so parts threads may iterate the table in parallel.
+ */
+static inline struct h64_iterator
+h64_iterate_part(const struct h64 *h, size_t part, size_t parts)
+{
+	assert(part < parts);
+	uint64_t count = h64_internal_groups_count(h);
+	struct h64_iterator it;
+	it.h = h;
+	it.group = NULL;
+	it.last = NULL;
+	it.next = (size_t)(count * part / parts);
+	it.end = (size_t)(count * (part + 1) / parts);
+	it.status = 0;
+	return it;
+}
+
+/** Iterator over the whole table. */
+static inline struct h64_iterator
+h64_iterate(const struct h64 *h)
+{
+	return h64_iterate_part(h, 0, 1);
+}
+
+/** Index of the lowest set bit of a non-zero status. */
+static inline unsigned
+h64_internal_lowest_bit(unsigned status)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctz(status);
+#else
+	unsigned index = 0;
+	for (; !(status & 0x1); status >>= 1)
+		++index;
+	return index;
+#endif
+}
+
+/** Move to the next group with entries, return 0 at the end. */
+static inline int
+h64_internal_next_group(struct h64_iterator *it)
+{
+	do {
+		if (it->group != it->last) {
+			++it->group;
+		} else if (it->next < it->end) {
+			/* The range continues in the other array. */
+			size_t size = it->h->size_in_groups;
+			size_t last = it->next < size && it->end > size
+				? size : it->end;
+			it->group = h64_internal_group(it->h, it->next);
+			it->last = it->group + (last - it->next - 1);
+			it->next = last;
+		} else {
+			return 0;
+		}
+#if defined(__GNUC__)
+		/* Ahead within the range, so the address is in the array. */
+		__builtin_prefetch(it->last - it->group >
+				   H64_INTERNAL_ITERATOR_PREFETCH
+				   ? it->group + H64_INTERNAL_ITERATOR_PREFETCH
+				   : it->last);
+#endif
+		it->status = it->group->status & 0x7F;
+	} while (it->status == 0);
+	return 1;
+}
+
+/** Next entry of the iterator, NULL at the end. */
+static inline void *
+h64_next(struct h64_iterator *it)
+{
+	if (it->status == 0 && !h64_internal_next_group(it))
+		return NULL;
+	unsigned index = h64_internal_lowest_bit(it->status);
+	it->status &= it->status - 1;
+	return it->group->entries[index];
+}
+
 #define h64_for_each(ht, name)						       \
 	void *(name) = NULL;						       \
-	for (size_t i_ = 0; i_ < (ht)->size_in_groups; ++i_)		       \
-		for (size_t j_ = 0; j_ < H64_INTERNAL_GROUP_ENTRIES; ++j_)     \
-			if (((name) = (ht)->groups[i_].entries[j_]) != NULL)   \
+	for (struct h64_iterator it_ = h64_iterate(ht);			       \
+	     ((name) = h64_next(&it_)) != NULL;)
 
 /**
  * Constructor for a table.
@@ -121,6 +470,10 @@ struct h64 {
 struct h64 *
 h64_create(h64_hasher_f hasher, h64_equals_f equals);
 
+/** Constructor for a table with optional features enabled. */
+struct h64 *
+h64_create_ex(const struct h64_options *options);
+
 /** Destructor for a table. */
 void
 h64_destroy(struct h64 *h);
@@ -149,6 +502,35 @@ h64_insert_new(struct h64 *h, void *entry);
 void
 h64_reserve(struct h64 *h, size_t size);
 
+/**
+ * Shrink the table to the smallest size that holds its entries without
+ * exceeding the max load factor. The only way to free memory of
+ * H64_NO_SHRINK tables.
+ */
+void
+h64_shrink_to_fit(struct h64 *h);
+
+/**
+ * Clear the "was full" bits of groups that no displaced entry probes
+ * past, so misses stop probing at them. Erases never clear the bits,
+ * and without this only a resize does. Cheaper than a rehash: nothing
+ * is moved or allocated but a bitmap, yet every entry is hashed.
+ * H64_CLEAR_WAS_FULL tables do the same a little per modification.
+ */
+void
+h64_clear_was_full(struct h64 *h);
+
+/**
+ * Find an equal entry in the table, or insert the entry if there is none,
+ * in one probe of the table. Return the slot of the entry found or
+ * inserted, *inserted tells which. The slot of an inserted entry may be
+ * overwritten with an equal entry, usually a copy of a key on the stack
+ * that the caller allocates only when it's inserted. The slot is valid
+ * until the next modification of the table.
+ */
+void **
+h64_find_or_insert(struct h64 *h, void *entry, bool *inserted);
+
 /**
  * Find an entry in the table.
  * You can use any entry which has the same hash and equals to
@@ -165,6 +547,272 @@ h64_find(const struct h64 *h, const void *entry);
 void *
 h64_erase(struct h64 *h, const void *entry);
 
+/**
+ * Variants of h64_find, h64_insert, h64_insert_new, h64_erase and
+ * h64_find_or_insert for callers which already know the hash of the
+ * entry. The hash must be equal to hasher(entry, h64_seed(h)), the table
+ * doesn't call the hasher.
+ */
+void *
+h64_find_hashed(const struct h64 *h, const void *entry, uint64_t hash);
+
+void
+h64_insert_hashed(struct h64 *h, void *entry, uint64_t hash);
+
+void
+h64_insert_new_hashed(struct h64 *h, void *entry, uint64_t hash);
+
+void *
+h64_erase_hashed(struct h64 *h, const void *entry, uint64_t hash);
+
+void **
+h64_find_or_insert_hashed(struct h64 *h, void *entry, uint64_t hash,
+			  bool *inserted);
+
+/**
+ * Find an entry by a key of another type, e.g. a record by a slice of its
+ * name, without building an entry to look for. key_hash(key, h64_seed(h))
+ * must be equal to the hash of the entries equal to the key by
+ * key_equals, which the table only calls as key_equals(key, entry).
+ */
+void *
+h64_find_key(const struct h64 *h, const void *key, h64_key_hasher_f key_hash,
+	     h64_key_equals_f key_equals);
+
+/** h64_find_key for callers which already know the hash of the key. */
+void *
+h64_find_key_hashed(const struct h64 *h, const void *key, uint64_t hash,
+		    h64_key_equals_f key_equals);
+
+/**
+ * Find n entries in the table: out[i] = h64_find(h, entries[i]).
+ * Hashes are computed ahead of the probing and the first group of every
+ * entry is prefetched, so cache misses of the batch overlap each other.
+ */
+void
+h64_find_batch(const struct h64 *h, const void **entries, size_t n,
+	       void **out);
+
+/**
+ * Lookup run a group at a time, so that a scheduler of coroutines can
+ * prefetch the next group of a lookup and switch to other lookups while
+ * the group is loaded. Lookups of irregular sizes interleave this way as
+ * h64_find_batch does for a fixed batch:
+ *
+ *	struct h64_lookup_state s;
+ *	const struct h64_group *g = h64_lookup_start(&s, h, entry);
+ *	while (g != NULL) {
+ *		__builtin_prefetch(g);
+ *		yield();
+ *		g = h64_lookup_step(&s);
+ *	}
+ *	found = s.found;
+ *
+ * The table must not be modified while lookups are in progress.
+ */
+struct h64_lookup_state {
+	/** The entry found, NULL if there is none. Set once it's done. */
+	void *found;
+	/* The group to probe on the next step, NULL when it's done. */
+	struct h64_group *pending;
+	const struct h64 *h;
+	const void *entry;
+	uint64_t hash;
+	/* Probe sequence of pending in the array probed. */
+	struct h64_group *groups;
+	size_t start;
+	size_t iteration;
+	size_t size_mask;
+	unsigned block_shift;
+};
+
+/**
+ * Start to find the entry. Returns the first group of the lookup to
+ * prefetch before the first step, NULL if the lookup is already done.
+ */
+const struct h64_group *
+h64_lookup_start(struct h64_lookup_state *state, const struct h64 *h,
+		 const void *entry);
+
+/** h64_lookup_start for callers which already know the hash. */
+const struct h64_group *
+h64_lookup_start_hashed(struct h64_lookup_state *state, const struct h64 *h,
+			const void *entry, uint64_t hash);
+
+/**
+ * Probe the pending group of the lookup. Returns the next group to
+ * prefetch before the next step, NULL if the lookup is done.
+ */
+const struct h64_group *
+h64_lookup_step(struct h64_lookup_state *state);
+
+/**
+ * Insert n entries in the table as h64_insert does. The table is grown
+ * once before inserting, so the batch itself never resizes the table.
+ */
+void
+h64_insert_batch(struct h64 *h, void **entries, size_t n);
+
+/**
+ * Erase n entries from the table: out[i] = h64_erase(h, entries[i]).
+ * The table is shrunk at most once, after the whole batch is erased.
+ * out may be NULL if erased entries are not needed.
+ */
+void
+h64_erase_batch(struct h64 *h, const void **entries, size_t n, void **out);
+
+/**
+ * Insert n new entries in the table as h64_insert_new does, using
+ * nthreads threads: the table executor if it has one, new threads
+ * otherwise. The table is grown once, in parallel too. Every thread fills
+ * its own range of groups, so it needs no locks, at the cost of
+ * 24 bytes of temporary memory per entry. The hasher is called from all
+ * the threads.
+ */
+void
+h64_build_parallel(struct h64 *h, void **entries, size_t n, size_t nthreads);
+
+/**
+ * Source of entries for h64_build_from. read writes up to max next
+ * entries to entries and returns how many it wrote, 0 at the end. If the
+ * source is hashed, read writes their hashes to hashes too, which must be
+ * ones of the table hasher and seed (see h64_seed). Otherwise hashes is
+ * NULL.
+ */
+struct h64_source {
+	size_t (*read)(void *ctx, void **entries, uint64_t *hashes, size_t max);
+	void *ctx;
+	int hashed;
+};
+
+/**
+ * Insert n new entries of the source in the table as h64_insert_new
+ * does. The table is grown once for all of them, then the entries are
+ * partitioned by ranges of their first groups, small enough to stay in
+ * cache, and placed range by range. So the groups are written in order
+ * rather than at random, at the cost of 32 bytes of temporary memory per
+ * entry. The source may end before n entries.
+ */
+void
+h64_build_from(struct h64 *h, const struct h64_source *source, size_t n);
+
+/**
+ * Visit entries of the table a few at a time, as Redis SCAN does. Start
+ * with cursor 0 and pass the returned cursor to the next call until it
+ * returns 0. Every call visits the entries of one first group, and of
+ * its images in the other array during a resize. The table may be
+ * modified and resized between the calls: entries present during the
+ * whole scan are visited at least once, others may or may not be, some
+ * may be visited twice. cb must not modify the table. Entries are hashed
+ * to know their first groups unless the table stores hashes.
+ */
+uint64_t
+h64_scan(const struct h64 *h, uint64_t cursor,
+	 void (*cb)(void *entry, void *ctx), void *ctx);
+
+/**
+ * Copy of the table: its arrays are copied as they are, so nothing is
+ * rehashed and the copy keeps the seed, the functions, the flags and the
+ * allocator. Entries are shared by both tables. Statistics of the copy
+ * start from zero.
+ */
+struct h64 *
+h64_clone(const struct h64 *h);
+
+/**
+ * Insert every entry of src in dst as h64_insert does, so entries of src
+ * replace equal ones of dst. Groups of src are read in order, and hashes
+ * are reused if both tables have the same hasher and seed, e.g. one is
+ * a clone of the other. Groups of src equal to the groups of dst at the
+ * same positions are skipped.
+ */
+void
+h64_merge(struct h64 *dst, const struct h64 *src);
+
+/**
+ * Differences of the table to from the table from: cb gets the entry of
+ * from and NULL for an entry only in from, NULL and the entry of to for
+ * an entry only in to, and both entries if they are equal but different
+ * pointers. Return the number of differences, cb may be NULL to count
+ * them only. A diff of a table and its modified clone skips groups left
+ * as they were, so it costs little more than a comparison of the arrays.
+ */
+size_t
+h64_diff(const struct h64 *from, const struct h64 *to,
+	 void (*cb)(void *from_entry, void *to_entry, void *ctx), void *ctx);
+
+enum {
+	/** Buckets of probe length histograms of struct h64_stats. */
+	H64_STATS_PROBE_BUCKETS = 16,
+};
+
+/** Statistics of a table, see h64_stats. */
+struct h64_stats {
+	/** Entries, slots and their ratio. */
+	size_t count;
+	size_t capacity;
+	double load_factor;
+	/**
+	 * Memory taken by the table with its side arrays, both arrays
+	 * during a resize.
+	 */
+	size_t memory_bytes;
+	/**
+	 * Groups with the "was full" bit set, and the number of groups a miss
+	 * is expected to probe if they were spread uniformly. Both grow with
+	 * churn until the bits are cleared, see h64_clear_was_full.
+	 */
+	size_t was_full_groups;
+	double expected_miss_probes;
+	/**
+	 * The rest is counted with H64_STATISTICS only, and zero otherwise.
+	 * Operations are sampled, so counts are 1 / 2^sample_shift of real.
+	 */
+	unsigned sample_shift;
+	/**
+	 * Number of groups probed by lookups (find, insert, erase) and by
+	 * placements of new entries. probes[i] counts ones of i + 1 groups,
+	 * the last bucket counts all the longer ones too.
+	 */
+	uint64_t lookup_probes[H64_STATS_PROBE_BUCKETS];
+	uint64_t place_probes[H64_STATS_PROBE_BUCKETS];
+	/**
+	 * Entries compared by lookups because of matching hints, and ones of
+	 * them that turned out to be different.
+	 */
+	uint64_t hint_matches;
+	uint64_t hint_false_positives;
+	/** Lookups rejected by the H64_MISS_FILTER filter without probing. */
+	uint64_t filter_rejects;
+	/**
+	 * Resizes of the table, not sampled, and the time spent in the ones
+	 * done at once. Incremental resizes are counted when they start.
+	 */
+	uint64_t resizes;
+	uint64_t resize_ns;
+};
+
+/**
+ * Fill out with statistics of the table. Safe to call along with lookups
+ * from other threads, and cheap enough to be polled by a metrics exporter.
+ */
+void
+h64_stats(const struct h64 *h, struct h64_stats *out);
+
+/** Zero counters of a H64_STATISTICS table. */
+void
+h64_stats_reset(struct h64 *h);
+
+/**
+ * Name of the SIMD kernel the library matches hints with on this CPU:
+ * "avx512", "avx2", "sse2", "neon" or "swar". The H64_KERNEL environment
+ * variable may ask for a narrower one, e.g. to compare them. "swar" is
+ * there on every CPU. Unknown and unsupported names are reported to stderr
+ * and the best kernel is used.
+ */
+const char *
+h64_kernel_name(void);
+
 /** Number of entries presented in the table. */
 static inline size_t
 h64_count(const struct h64 *h)
@@ -172,6 +820,16 @@ h64_count(const struct h64 *h)
 	return h->count;
 }
 
+/**
+ * Seed the table passes to the hasher.
+ * It remains the same for the whole lifetime of the table, resizing included.
+ */
+static inline uint64_t
+h64_seed(const struct h64 *h)
+{
+	return h->seed;
+}
+
 /** It's Murmurhash. Suitable for the table and yields good results. */
 static inline uint64_t
 h64_byte_hash(const void *key, int len, uint64_t seed)
@@ -181,11 +839,14 @@ h64_byte_hash(const void *key, int len, uint64_t seed)
 
 	uint64_t h = seed ^ (len * m);
 
-	const uint64_t *data = (const uint64_t *)key;
-	const uint64_t *end = data + (len / 8);
+	const unsigned char *data = (const unsigned char *)key;
+	const unsigned char *end = data + (len / 8) * 8;
 
 	while (data != end) {
-		uint64_t k = *data++;
+		/* Keys may be unaligned, e.g. strings. */
+		uint64_t k;
+		memcpy(&k, data, sizeof(k));
+		data += sizeof(k);
 
 		k *= m;
 		k ^= k >> r;
@@ -195,15 +856,21 @@ h64_byte_hash(const void *key, int len, uint64_t seed)
 		h *= m;
 	}
 
-	const unsigned char * data2 = (const unsigned char*)data;
+	const unsigned char *data2 = data;
 
 	switch (len & 7) {
 	case 7: h ^= (uint64_t)data2[6] << 48;
+		/* fallthrough */
 	case 6: h ^= (uint64_t)data2[5] << 40;
+		/* fallthrough */
 	case 5: h ^= (uint64_t)data2[4] << 32;
+		/* fallthrough */
 	case 4: h ^= (uint64_t)data2[3] << 24;
+		/* fallthrough */
 	case 3: h ^= (uint64_t)data2[2] << 16;
+		/* fallthrough */
 	case 2: h ^= (uint64_t)data2[1] << 8;
+		/* fallthrough */
 	case 1: h ^= (uint64_t)data2[0];
 		h *= m;
 	};
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "h64/h64.h"
+
+/**
+ * Table with wait-free readers and a single writer.
+ *
+ * The writer modifies groups in place in an order safe for concurrent
+ * readers, and readers probe them without locks or stores to shared
+ * memory, so a lookup still touches one cache line per probe. Resizing
+ * builds a new array of groups and publishes it atomically. The old array
+ * is freed once every reader, which could see it, leaves its read section
+ * (epoch based reclamation).
+ *
+ * Every reader thread registers once and wraps lookups in read sections:
+ *
+ *	struct h64_reader *r = h64_reader_register(hc);
+ *	...
+ *	h64_read_enter(r);
+ *	entry = h64_concurrent_find(hc, key);
+ *	... use entry ...
+ *	h64_read_exit(r);
+ *
+ * A section may contain any number of lookups, entering is the only
+ * operation of a reader with a memory fence.
+ *
+ * Entries erased by the writer may still be used by readers inside their
+ * sections. Call h64_concurrent_synchronize before freeing them.
+ */
+struct h64_concurrent;
+
+/** Per-thread state of a reader. */
+struct h64_reader;
+
+/**
+ * Constructor for a table. H64_INCREMENTAL_RESIZE and H64_MISS_FILTER
+ * are not supported, the rest of the options mean the same as for
+ * h64_create_ex.
+ */
+struct h64_concurrent *
+h64_concurrent_create(const struct h64_options *options);
+
+/** Destructor for a table. There must be no readers in sections. */
+void
+h64_concurrent_destroy(struct h64_concurrent *hc);
+
+/** Writer: same as h64_insert. */
+void
+h64_concurrent_insert(struct h64_concurrent *hc, void *entry);
+
+/** Writer: same as h64_insert_batch. */
+void
+h64_concurrent_insert_batch(struct h64_concurrent *hc, void **entries,
+			    size_t n);
+
+/** Writer: same as h64_erase. */
+void *
+h64_concurrent_erase(struct h64_concurrent *hc, const void *entry);
+
+/** Writer: same as h64_reserve. */
+void
+h64_concurrent_reserve(struct h64_concurrent *hc, size_t size);
+
+/**
+ * Writer: wait until all readers leave the sections they are in now.
+ * After that no reader holds an entry erased before the call.
+ */
+void
+h64_concurrent_synchronize(struct h64_concurrent *hc);
+
+/** Number of entries as of the last completed writer operation. */
+size_t
+h64_concurrent_count(const struct h64_concurrent *hc);
+
+/** Register the calling thread as a reader of the table. */
+struct h64_reader *
+h64_reader_register(struct h64_concurrent *hc);
+
+/** Reader must be outside of a section. */
+void
+h64_reader_unregister(struct h64_reader *reader);
+
+void
+h64_read_enter(struct h64_reader *reader);
+
+void
+h64_read_exit(struct h64_reader *reader);
+
+/**
+ * Reader: find an entry, must be called inside a read section. The
+ * returned entry can be used until the end of the section.
+ */
+void *
+h64_concurrent_find(const struct h64_concurrent *hc, const void *entry);
+
+/** Reader: h64_concurrent_find in the table the reader is registered in. */
+void *
+h64_reader_find(const struct h64_reader *reader, const void *entry);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Built-in hashers besides h64_byte_hash.
+ *
+ * Keys of 4, 8 and 16 bytes are hashed by a couple of multiplications of
+ * h64_mix64, without branches and loops, both inlined:
+ *
+ *	struct h64 *h = h64_create(h64_u64_hasher, u64_equals);
+ *
+ * where entries point to their keys, e.g. records with the key the first.
+ *
+ * h64_crc_hash hashes byte strings 8 bytes a step, in two independent
+ * chains of CRC32-C instructions where the CPU has them, SSE 4.2 on x86
+ * and the CRC extension of ARMv8. Elsewhere the same values are computed
+ * by tables, so hashes don't depend on the CPU, e.g. for snapshots.
+ * h64_str_hash hashes a NUL-terminated string the same way without
+ * calling strlen: h64_str_hash(s, seed) == h64_crc_hash(s, strlen(s),
+ * seed), so a table of strings may be searched by slices of others with
+ * h64_find_key_hashed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/** Bijective mixer of 64 bits, every bit of the result depends on all. */
+static inline uint64_t
+h64_mix64(uint64_t n)
+{
+	const uint64_t z = 0x9FB21C651E98DF25;
+
+	n ^= ((n << 49) | (n >> 15)) ^ ((n << 24) | (n >> 40));
+	n *= z;
+	n ^= n >> 35;
+	n *= z;
+	n ^= n >> 28;
+
+	return n;
+}
+
+static inline uint64_t
+h64_hash_u32(uint32_t key, uint64_t seed)
+{
+	return h64_mix64(key ^ seed);
+}
+
+static inline uint64_t
+h64_hash_u64(uint64_t key, uint64_t seed)
+{
+	return h64_mix64(key ^ seed);
+}
+
+static inline uint64_t
+h64_hash_u128(uint64_t low, uint64_t high, uint64_t seed)
+{
+	return h64_mix64(h64_mix64(low ^ seed) ^ high);
+}
+
+/** Hashers of entries which begin with a key of 4, 8 or 16 bytes. */
+static inline uint64_t
+h64_u32_hasher(const void *entry, uint64_t seed)
+{
+	uint32_t key;
+	memcpy(&key, entry, sizeof(key));
+	return h64_hash_u32(key, seed);
+}
+
+static inline uint64_t
+h64_u64_hasher(const void *entry, uint64_t seed)
+{
+	uint64_t key;
+	memcpy(&key, entry, sizeof(key));
+	return h64_hash_u64(key, seed);
+}
+
+static inline uint64_t
+h64_u128_hasher(const void *entry, uint64_t seed)
+{
+	uint64_t key[2];
+	memcpy(key, entry, sizeof(key));
+	return h64_hash_u128(key[0], key[1], seed);
+}
+
+/** Hash of len bytes of the key. */
+uint64_t
+h64_crc_hash(const void *key, size_t len, uint64_t seed);
+
+/**
+ * Hash of the NUL-terminated string, equal to the one of h64_crc_hash of
+ * its bytes. Words are read up to the page of the NUL, so bytes past the
+ * NUL are read but never past a page.
+ */
+uint64_t
+h64_str_hash(const char *str, uint64_t seed);
+
+/** Hasher of entries which are NUL-terminated strings. */
+uint64_t
+h64_str_hasher(const void *entry, uint64_t seed);
+
+/**
+ * Name of the implementation of h64_crc_hash on this CPU: "sse4.2",
+ * "armv8" or "soft". The H64_HASH environment variable may ask for "soft".
+ */
+const char *
+h64_hash_name(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,603 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Typed tables with keys and values stored in the groups.
+ *
+ * h64 keeps pointers to entries, so every comparison of a hint match
+ * reads the entry from elsewhere in memory. For small fixed-size keys,
+ * e.g. integers or 16 byte ids, the macros below define a table which
+ * keeps keys and values in the slots of its groups, and calls hash and
+ * equality functions known at compile time, so they are inlined:
+ *
+ *	static inline uint64_t id_hash(uint64_t key, uint64_t seed);
+ *	H64_MAP_DEFINE(id_map, uint64_t, uint32_t, id_hash, h64_map_int_equals)
+ *
+ * defines struct id_map and static inline functions id_map_create,
+ * id_map_destroy, id_map_find, id_map_insert, id_map_erase, id_map_reserve
+ * and id_map_count. hash_fn(key, seed) and eq_fn(key1, key2) take keys
+ * by value, and may be macros.
+ *
+ * H64_DEFINE(name, key_t, hash_fn, eq_fn) defines a set of keys the same
+ * way, with functions name_find, name_insert and name_erase. With pointers
+ * to entries as keys it's h64 with the hasher and the comparator inlined
+ * in the probing loop:
+ *
+ *	H64_DEFINE(user_set, struct user *, user_hash, user_equals)
+ *
+ * A group has the status byte and the hints of h64, then 7 slots of
+ * a key and a value, and it's aligned to the cache line, so it takes
+ * one line for 8 byte keys without values, two for 8 byte keys with
+ * 8 byte values and three for 16 byte keys with 8 byte values.
+ *
+ * H64_MAP_DEFINE_HINT16 and H64_DEFINE_HINT16 define the same tables
+ * with 16 bit hints in groups of 6 slots. A hint of a missing key matches
+ * 256 times less often, so eq_fn is rarely called but for the key looked
+ * for, which pays off when it's expensive, e.g. strcmp of long strings.
+ * A group of 8 byte keys still takes a line, but holds a key less.
+ *
+ * H64_DEFINE_ARENA(name, entry_t, base, shift, hash_fn, eq_fn) defines
+ * a set of pointers to entries of one arena, which keeps 32 bit offsets
+ * of the entries from base in units of 1 << shift, so with shift 3 it
+ * takes entries of an arena up to 32GB aligned to 8 bytes. A group has
+ * 12 slots in a line, against 7 of a set of pointers, so a probe covers
+ * more entries, and a table takes near half the memory. base is read on
+ * every access, e.g. it's a global, and mustn't change while the set keeps
+ * entries. Functions name_entry(offset) and name_offset(entry) convert
+ * them, and the slots give offsets to h64_map_for_each.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "h64/h64.h"
+
+static inline uint64_t
+h64_map_u64_hash(uint64_t key, uint64_t seed)
+{
+	key ^= seed;
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDull;
+	key ^= key >> 33;
+	key *= 0xC4CEB9FE1A85EC53ull;
+	key ^= key >> 33;
+	return key;
+}
+
+#define h64_map_int_equals(a, b)  ((a) == (b))
+
+/*
+ * Mask of the slots whose hint is equal to hint among present ones.
+ * Status and hints make the first 8 bytes of a group, so they are matched
+ * in a word: slot i is given by the top bit of the byte i + 1.
+ */
+static inline uint64_t
+h64_map_internal_match(const void *group, uint8_t hint)
+{
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7Full;
+	uint64_t word;
+	memcpy(&word, group, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	/* Top bits of the status bits moved to the bytes of their hints. */
+	uint64_t present = ((word & 0x7F) * 0x0204081020408000ull) &
+			   0x8080808080808000ull;
+	uint64_t diff = word ^ (0x0101010101010101ull * hint);
+	uint64_t zero = ~(((diff & low7) + low7) | diff | low7);
+	return zero & present;
+}
+
+static inline size_t
+h64_map_internal_match_index(uint64_t match)
+{
+	return (__builtin_ctzll(match) >> 3) - 1;
+}
+
+/*
+ * Mask of the slots whose hint is equal to hint among present ones, for
+ * 16 bit hints: 6 hints and the status byte make the first 13 bytes of
+ * a group, slot i is given by the bit i.
+ */
+static inline uint64_t
+h64_map_internal_match16(const void *group, uint16_t hint)
+{
+	uint64_t status = ((const uint8_t *)group)[12];
+#if defined(__SSE2__)
+	__m128i line = _mm_loadu_si128((const __m128i *)group);
+	__m128i equal = _mm_cmpeq_epi16(line, _mm_set1_epi16((short)hint));
+	uint64_t match = _mm_movemask_epi8(
+		_mm_packs_epi16(equal, _mm_setzero_si128()));
+#else
+	const uint16_t *hints = (const uint16_t *)group;
+	uint64_t match = 0;
+	for (size_t i = 0; i < 6; ++i)
+		match |= (uint64_t)(hints[i] == hint) << i;
+#endif
+	return match & status & 0x3F;
+}
+
+static inline size_t
+h64_map_internal_match16_index(uint64_t match)
+{
+	return __builtin_ctzll(match);
+}
+
+/*
+ * Mask of the slots whose hint is equal to hint among present ones, for
+ * groups of 12 slots: 12 hints and 16 status bits make the first 14 bytes
+ * of a group, slot i is given by the bit i.
+ */
+static inline uint64_t
+h64_map_internal_match12(const void *group, uint8_t hint)
+{
+	uint16_t status;
+	memcpy(&status, (const uint8_t *)group + 12, sizeof(status));
+#if defined(__SSE2__)
+	__m128i line = _mm_loadu_si128((const __m128i *)group);
+	uint64_t match = _mm_movemask_epi8(
+		_mm_cmpeq_epi8(line, _mm_set1_epi8((char)hint)));
+#else
+	const uint8_t *hints = (const uint8_t *)group;
+	uint64_t match = 0;
+	for (size_t i = 0; i < 12; ++i)
+		match |= (uint64_t)(hints[i] == hint) << i;
+#endif
+	return match & status & 0xFFF;
+}
+
+/*
+ * Group layouts: slots in a group, the status bit of a group which was
+ * full, the hint of a hash and the matching of hints of a group, for
+ * H64_MAP_INTERNAL_DEFINE.
+ */
+#define H64_MAP_INTERNAL_ENTRIES_hint8 H64_INTERNAL_GROUP_ENTRIES
+#define H64_MAP_INTERNAL_WAS_FULL_hint8 0x80
+#define H64_MAP_INTERNAL_HINT_hint8(hash)  ((uint8_t)((hash) >> 56))
+#define H64_MAP_INTERNAL_MATCH_hint8 h64_map_internal_match
+#define H64_MAP_INTERNAL_INDEX_hint8 h64_map_internal_match_index
+
+#define H64_MAP_INTERNAL_ENTRIES_hint16 6
+#define H64_MAP_INTERNAL_WAS_FULL_hint16 0x80
+#define H64_MAP_INTERNAL_HINT_hint16(hash)  ((uint16_t)((hash) >> 48))
+#define H64_MAP_INTERNAL_MATCH_hint16 h64_map_internal_match16
+#define H64_MAP_INTERNAL_INDEX_hint16 h64_map_internal_match16_index
+
+#define H64_MAP_INTERNAL_ENTRIES_narrow 12
+#define H64_MAP_INTERNAL_WAS_FULL_narrow 0x8000
+#define H64_MAP_INTERNAL_HINT_narrow(hash)  ((uint8_t)((hash) >> 56))
+#define H64_MAP_INTERNAL_MATCH_narrow h64_map_internal_match12
+#define H64_MAP_INTERNAL_INDEX_narrow h64_map_internal_match16_index
+
+/* Key of a slot and the slot field of a key, where they're the same. */
+#define H64_MAP_INTERNAL_SAME(key)  (key)
+
+/* Iterate over pointers to the occupied slots, with .key and .value. */
+#define h64_map_for_each(t, slot)					       \
+	__typeof__(&(t)->groups[0].slots[0]) (slot) = NULL;		       \
+	for (size_t i_ = 0; i_ < (t)->size_in_groups; ++i_)		       \
+		for (size_t j_ = 0; j_ < sizeof((t)->groups[0].slots) /	       \
+				   sizeof((t)->groups[0].slots[0]); ++j_)      \
+			if (((t)->groups[i_].status >> j_ & 0x1) &&	       \
+			    ((slot) = &(t)->groups[i_].slots[j_]))	       \
+
+#define H64_MAP_DEFINE(name, key_t, value_t, hash_fn, eq_fn)		       \
+	H64_MAP_INTERNAL_MAP(name, key_t, value_t, hash_fn, eq_fn, hint8)
+
+#define H64_MAP_DEFINE_HINT16(name, key_t, value_t, hash_fn, eq_fn)	       \
+	H64_MAP_INTERNAL_MAP(name, key_t, value_t, hash_fn, eq_fn, hint16)
+
+#define H64_DEFINE(name, key_t, hash_fn, eq_fn)				       \
+	H64_MAP_INTERNAL_SET(name, key_t, hash_fn, eq_fn, hint8)
+
+#define H64_DEFINE_HINT16(name, key_t, hash_fn, eq_fn)			       \
+	H64_MAP_INTERNAL_SET(name, key_t, hash_fn, eq_fn, hint16)
+
+#define H64_DEFINE_ARENA(name, entry_t, base, shift, hash_fn, eq_fn)	       \
+	H64_MAP_INTERNAL_ARENA(name, entry_t, base, shift, hash_fn, eq_fn)
+
+#define H64_MAP_INTERNAL_MAP(name, key_t, value_t, hash_fn, eq_fn, layout)     \
+	struct name##_slot {						       \
+		key_t key;						       \
+		value_t value;						       \
+	};								       \
+	H64_MAP_INTERNAL_DEFINE(name, key_t, struct name##_slot,	       \
+				hash_fn, eq_fn, layout,			       \
+				H64_MAP_INTERNAL_SAME, H64_MAP_INTERNAL_SAME)  \
+									       \
+	/* Pointer to the value of the key, NULL if there is no such key. */   \
+	static inline value_t *						       \
+	name##_find(const struct name *t, key_t key)			       \
+	{								       \
+		struct name##_slot *slot = name##_internal_find(t, key);       \
+		return slot != NULL ? &slot->value : NULL;		       \
+	}								       \
+									       \
+	/* Insert or update the value, return a pointer to the stored one. */  \
+	static inline value_t *						       \
+	name##_insert(struct name *t, key_t key, value_t value)		       \
+	{								       \
+		struct name##_slot *slot = name##_internal_insert(t, key);     \
+		slot->value = value;					       \
+		return &slot->value;					       \
+	}								       \
+									       \
+	/* Erase the key. Its value is copied to *value if it isn't NULL. */   \
+	static inline bool						       \
+	name##_erase(struct name *t, key_t key, value_t *value)		       \
+	{								       \
+		struct name##_slot slot;				       \
+		if (!name##_internal_erase(t, key, &slot))		       \
+			return false;					       \
+		if (value != NULL)					       \
+			*value = slot.value;				       \
+		return true;						       \
+	}
+
+#define H64_MAP_INTERNAL_SET(name, key_t, hash_fn, eq_fn, layout)	       \
+	struct name##_slot {						       \
+		key_t key;						       \
+	};								       \
+	H64_MAP_INTERNAL_DEFINE(name, key_t, struct name##_slot,	       \
+				hash_fn, eq_fn, layout,			       \
+				H64_MAP_INTERNAL_SAME, H64_MAP_INTERNAL_SAME)  \
+									       \
+	/* Pointer to the stored key equal to key, NULL if there is none. */   \
+	static inline key_t *						       \
+	name##_find(const struct name *t, key_t key)			       \
+	{								       \
+		struct name##_slot *slot = name##_internal_find(t, key);       \
+		return slot != NULL ? &slot->key : NULL;		       \
+	}								       \
+									       \
+	/*								       \
+	 * Insert the key, or replace the equal one with it, like h64_insert   \
+	 * does. Return a pointer to the stored key.			       \
+	 */								       \
+	static inline key_t *						       \
+	name##_insert(struct name *t, key_t key)			       \
+	{								       \
+		struct name##_slot *slot = name##_internal_insert(t, key);     \
+		slot->key = key;					       \
+		return &slot->key;					       \
+	}								       \
+									       \
+	/* Erase the key. The stored one is copied to *erased if not NULL. */  \
+	static inline bool						       \
+	name##_erase(struct name *t, key_t key, key_t *erased)		       \
+	{								       \
+		struct name##_slot slot;				       \
+		if (!name##_internal_erase(t, key, &slot))		       \
+			return false;					       \
+		if (erased != NULL)					       \
+			*erased = slot.key;				       \
+		return true;						       \
+	}
+
+#define H64_MAP_INTERNAL_ARENA(name, entry_t, base, shift, hash_fn, eq_fn)     \
+	static inline entry_t *						       \
+	name##_entry(uint32_t offset)					       \
+	{								       \
+		return (entry_t *)((char *)(base) +			       \
+				   ((size_t)offset << (shift)));	       \
+	}								       \
+									       \
+	static inline uint32_t						       \
+	name##_offset(const entry_t *entry)				       \
+	{								       \
+		size_t diff = (size_t)((const char *)entry -		       \
+				       (const char *)(base));		       \
+		assert(diff >> (shift) <= UINT32_MAX &&			       \
+		       (diff & (((size_t)1 << (shift)) - 1)) == 0 &&	       \
+		       "Entry is out of the arena");			       \
+		return (uint32_t)(diff >> (shift));			       \
+	}								       \
+									       \
+	struct name##_slot {						       \
+		uint32_t key;						       \
+	};								       \
+	H64_MAP_INTERNAL_DEFINE(name, const entry_t *, struct name##_slot,     \
+				hash_fn, eq_fn, narrow,			       \
+				name##_entry, name##_offset)		       \
+									       \
+	/* The stored entry equal to key, NULL if there is none. */	       \
+	static inline entry_t *						       \
+	name##_find(const struct name *t, const entry_t *key)		       \
+	{								       \
+		struct name##_slot *slot = name##_internal_find(t, key);       \
+		return slot != NULL ? name##_entry(slot->key) : NULL;	       \
+	}								       \
+									       \
+	/*								       \
+	 * Insert the entry of the arena, or replace the equal one with it,    \
+	 * like h64_insert does.					       \
+	 */								       \
+	static inline void						       \
+	name##_insert(struct name *t, entry_t *entry)			       \
+	{								       \
+		struct name##_slot *slot = name##_internal_insert(t, entry);   \
+		slot->key = name##_offset(entry);			       \
+	}								       \
+									       \
+	/* Erase the key. The stored entry is put to *erased if not NULL. */   \
+	static inline bool						       \
+	name##_erase(struct name *t, const entry_t *key, entry_t **erased)     \
+	{								       \
+		struct name##_slot slot;				       \
+		if (!name##_internal_erase(t, key, &slot))		       \
+			return false;					       \
+		if (erased != NULL)					       \
+			*erased = name##_entry(slot.key);		       \
+		return true;						       \
+	}
+
+/* Groups of the layouts, status is at the offset known to the match. */
+#define H64_MAP_INTERNAL_GROUP_hint8(name, slot_t)			       \
+	struct name##_group {						       \
+		uint8_t status;						       \
+		uint8_t hints[H64_MAP_INTERNAL_ENTRIES_hint8];		       \
+		slot_t slots[H64_MAP_INTERNAL_ENTRIES_hint8];		       \
+	} __attribute__((aligned(64)));
+
+#define H64_MAP_INTERNAL_GROUP_hint16(name, slot_t)			       \
+	struct name##_group {						       \
+		uint16_t hints[H64_MAP_INTERNAL_ENTRIES_hint16];	       \
+		uint8_t status;						       \
+		slot_t slots[H64_MAP_INTERNAL_ENTRIES_hint16];		       \
+	} __attribute__((aligned(64)));
+
+#define H64_MAP_INTERNAL_GROUP_narrow(name, slot_t)			       \
+	struct name##_group {						       \
+		uint8_t hints[H64_MAP_INTERNAL_ENTRIES_narrow];		       \
+		uint16_t status;					       \
+		uint16_t unused;					       \
+		slot_t slots[H64_MAP_INTERNAL_ENTRIES_narrow];		       \
+	} __attribute__((aligned(64)));
+
+/*
+ * The part shared by sets and maps, slot_t has the key field. layout is
+ * hint8, hint16 or narrow. key_of(field) is the key of the key field of
+ * a slot, and field_of(key) is the field of a key.
+ */
+#define H64_MAP_INTERNAL_DEFINE(name, key_t, slot_t, hash_fn, eq_fn, layout,   \
+				key_of, field_of)			       \
+	H64_MAP_INTERNAL_GROUP_##layout(name, slot_t)			       \
+	enum { name##_internal_entries = H64_MAP_INTERNAL_ENTRIES_##layout };  \
+									       \
+	struct name {							       \
+		struct name##_group *groups;				       \
+		size_t size_in_groups;					       \
+		size_t count;						       \
+		size_t grow_count;					       \
+		size_t shrink_count;					       \
+		/*							       \
+		 * Groups with the "was full" bit. Erases never clear it, so   \
+		 * the table is rebuilt before every group has it and misses   \
+		 * probe all the groups forever.			       \
+		 */							       \
+		size_t was_full_groups;					       \
+		uint64_t seed;						       \
+	};								       \
+									       \
+	static inline void						       \
+	name##_internal_alloc(struct name *t, size_t size)		       \
+	{								       \
+		size_t bytes = size * sizeof(struct name##_group);	       \
+		t->groups = aligned_alloc(64, bytes);			       \
+		assert(t->groups && "Allocation failed");		       \
+		memset(t->groups, 0, bytes);				       \
+		t->size_in_groups = size;				       \
+		t->was_full_groups = 0;					       \
+		/* Load factors of h64, 2/3 and a quarter of it. */	       \
+		t->grow_count = size * name##_internal_entries * 2 / 3;	       \
+		t->shrink_count = size > 4 ? t->grow_count / 4 : 0;	       \
+	}								       \
+									       \
+	static inline struct name *					       \
+	name##_create(void)						       \
+	{								       \
+		struct name *t = calloc(1, sizeof(*t));			       \
+		assert(t && "Allocation failed");			       \
+		name##_internal_alloc(t, 4);				       \
+		t->seed = h64_map_u64_hash((uintptr_t)t,		       \
+					   (uintptr_t)t->groups);	       \
+		return t;						       \
+	}								       \
+									       \
+	static inline void						       \
+	name##_destroy(struct name *t)					       \
+	{								       \
+		free(t->groups);					       \
+		free(t);						       \
+	}								       \
+									       \
+	static inline size_t						       \
+	name##_count(const struct name *t)				       \
+	{								       \
+		return t->count;					       \
+	}								       \
+									       \
+	static inline uint64_t						       \
+	name##_internal_hash(const struct name *t, key_t key)		       \
+	{								       \
+		return hash_fn(key, t->seed);				       \
+	}								       \
+									       \
+	static inline slot_t *						       \
+	name##_internal_lookup(const struct name *t, key_t key, uint64_t hash, \
+			       struct name##_group **group, size_t *index)     \
+	{								       \
+		__typeof__(t->groups[0].hints[0]) hint =		       \
+			H64_MAP_INTERNAL_HINT_##layout(hash);		       \
+		size_t mask = t->size_in_groups - 1;			       \
+		size_t position = hash & mask;				       \
+		for (size_t i = 1; ; ++i) {				       \
+			struct name##_group *g = &t->groups[position];	       \
+			uint64_t match =				       \
+				H64_MAP_INTERNAL_MATCH_##layout(g, hint);      \
+			while (match != 0) {				       \
+				size_t idx =				       \
+				    H64_MAP_INTERNAL_INDEX_##layout(match);    \
+				if (eq_fn(key_of(g->slots[idx].key), key)) {   \
+					*group = g;			       \
+					*index = idx;			       \
+					return &g->slots[idx];		       \
+				}					       \
+				match &= match - 1;			       \
+			}						       \
+			if (!(g->status & H64_MAP_INTERNAL_WAS_FULL_##layout)) \
+				return NULL;				       \
+			position = (position + i) & mask;		       \
+		}							       \
+	}								       \
+									       \
+	/* Put the slot to the first group of its sequence with room. */       \
+	static inline slot_t *						       \
+	name##_internal_place(struct name *t, const slot_t *slot,	       \
+			      uint64_t hash)				       \
+	{								       \
+		const unsigned full = (1u << name##_internal_entries) - 1;     \
+		size_t mask = t->size_in_groups - 1;			       \
+		size_t position = hash & mask;				       \
+		for (size_t i = 1; (t->groups[position].status & full) ==      \
+				   full; ++i)				       \
+			position = (position + i) & mask;		       \
+									       \
+		struct name##_group *g = &t->groups[position];		       \
+		size_t idx = __builtin_ctz(~g->status);			       \
+		g->slots[idx] = *slot;					       \
+		g->hints[idx] = H64_MAP_INTERNAL_HINT_##layout(hash);	       \
+		g->status |= 1u << idx;					       \
+		if ((g->status & full) == full &&			       \
+		    !(g->status & H64_MAP_INTERNAL_WAS_FULL_##layout)) {       \
+			g->status |= H64_MAP_INTERNAL_WAS_FULL_##layout;       \
+			t->was_full_groups += 1;			       \
+		}							       \
+		return &g->slots[idx];					       \
+	}								       \
+									       \
+	static inline void						       \
+	name##_internal_resize(struct name *t, size_t size)		       \
+	{								       \
+		const unsigned full = (1u << name##_internal_entries) - 1;     \
+		struct name##_group *groups = t->groups;		       \
+		size_t old_size = t->size_in_groups;			       \
+		name##_internal_alloc(t, size);				       \
+		for (size_t i = 0; i < old_size; ++i) {			       \
+			struct name##_group *g = &groups[i];		       \
+			unsigned status = g->status & full;		       \
+			while (status != 0) {				       \
+				size_t j = __builtin_ctz(status);	       \
+				slot_t *slot = &g->slots[j];		       \
+				name##_internal_place(t, slot,		       \
+				    name##_internal_hash(t, key_of(slot->key))); \
+				status &= status - 1;			       \
+			}						       \
+		}							       \
+		free(groups);						       \
+	}								       \
+									       \
+	/*								       \
+	 * Rebuild the table in place once most groups have the "was full"     \
+	 * bit, mostly left by erased keys under churn. Grow it if they are    \
+	 * still most groups, so a rebuild is never repeated right away.       \
+	 */								       \
+	static inline void						       \
+	name##_internal_rehash(struct name *t)				       \
+	{								       \
+		name##_internal_resize(t, t->size_in_groups);		       \
+		if (t->was_full_groups > t->size_in_groups / 2)		       \
+			name##_internal_resize(t, t->size_in_groups * 2);      \
+	}								       \
+									       \
+	/* Make room for count keys, so inserting them doesn't resize. */      \
+	static inline void						       \
+	name##_reserve(struct name *t, size_t count)			       \
+	{								       \
+		size_t size = t->size_in_groups;			       \
+		while (size * name##_internal_entries * 2 / 3 < count)	       \
+			size *= 2;					       \
+		if (size > t->size_in_groups)				       \
+			name##_internal_resize(t, size);		       \
+	}								       \
+									       \
+	static inline slot_t *						       \
+	name##_internal_find(const struct name *t, key_t key)		       \
+	{								       \
+		struct name##_group *group;				       \
+		size_t index;						       \
+		uint64_t hash = name##_internal_hash(t, key);		       \
+		return name##_internal_lookup(t, key, hash, &group, &index);   \
+	}								       \
+									       \
+	/* Slot of the key, a new one with the key if there was none. */       \
+	static inline slot_t *						       \
+	name##_internal_insert(struct name *t, key_t key)		       \
+	{								       \
+		struct name##_group *group;				       \
+		size_t index;						       \
+		uint64_t hash = name##_internal_hash(t, key);		       \
+		slot_t *slot = name##_internal_lookup(t, key, hash,	       \
+						      &group, &index);	       \
+		if (slot != NULL)					       \
+			return slot;					       \
+									       \
+		if (t->count >= t->grow_count)				       \
+			name##_internal_resize(t, t->size_in_groups * 2);      \
+		else if (t->was_full_groups > t->size_in_groups / 2)	       \
+			name##_internal_rehash(t);			       \
+		slot_t new_slot;					       \
+		memset(&new_slot, 0, sizeof(new_slot));			       \
+		new_slot.key = field_of(key);				       \
+		t->count += 1;						       \
+		return name##_internal_place(t, &new_slot, hash);	       \
+	}								       \
+									       \
+	static inline bool						       \
+	name##_internal_erase(struct name *t, key_t key, slot_t *erased)       \
+	{								       \
+		struct name##_group *group;				       \
+		size_t index;						       \
+		uint64_t hash = name##_internal_hash(t, key);		       \
+		slot_t *slot = name##_internal_lookup(t, key, hash,	       \
+						      &group, &index);	       \
+		if (slot == NULL)					       \
+			return false;					       \
+									       \
+		*erased = *slot;					       \
+		group->status &= ~(1u << index);			       \
+		t->count -= 1;						       \
+		if (t->count < t->shrink_count)				       \
+			name##_internal_resize(t, t->size_in_groups / 2);      \
+		return true;						       \
+	}
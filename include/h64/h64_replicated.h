@@ -0,0 +1,116 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "h64/h64.h"
+#include "h64/h64_concurrent.h"
+
+/**
+ * Table replicated on NUMA nodes, for read-mostly tables.
+ *
+ * Every replica is a concurrent table (see h64_concurrent.h) with its
+ * arrays allocated on a node of its own, so a reader probes memory of
+ * the node it runs on. The writer applies every modification to all the
+ * replicas, one after another, so writes cost as many times more as there
+ * are replicas. Batches are applied to a replica at a time.
+ *
+ * Readers register with the replica of their node and read as readers
+ * of concurrent tables do, with h64_reader_find:
+ *
+ *	struct h64_reader *r = h64_replicated_reader_register(hr);
+ *	...
+ *	h64_read_enter(r);
+ *	entry = h64_reader_find(r, key);
+ *	h64_read_exit(r);
+ *
+ * Replicas are placed on nodes with libnuma if the library is built with
+ * it, otherwise there is one replica unless more are asked for, and all
+ * of them are allocated as a concurrent table would be.
+ */
+struct h64_replicated;
+
+/**
+ * Constructor for a table of replicas replicas, 0 for one per NUMA node
+ * the process may allocate memory on. The replica i is on the i-th of
+ * these nodes, modulo their number. The options
+ * are the ones of h64_concurrent_create. Replicas use the allocator of the
+ * options if there is one, h64_numa_allocator of their nodes otherwise.
+ */
+struct h64_replicated *
+h64_replicated_create(const struct h64_options *options, size_t replicas);
+
+/** Destructor for a table. There must be no readers in sections. */
+void
+h64_replicated_destroy(struct h64_replicated *hr);
+
+/** Writer: same as h64_insert, for every replica. */
+void
+h64_replicated_insert(struct h64_replicated *hr, void *entry);
+
+/** Writer: same as h64_insert_batch, for a replica at a time. */
+void
+h64_replicated_insert_batch(struct h64_replicated *hr, void **entries,
+			    size_t n);
+
+/** Writer: same as h64_erase, for every replica. */
+void *
+h64_replicated_erase(struct h64_replicated *hr, const void *entry);
+
+/** Writer: same as h64_reserve, for every replica. */
+void
+h64_replicated_reserve(struct h64_replicated *hr, size_t size);
+
+/** Writer: h64_concurrent_synchronize of every replica. */
+void
+h64_replicated_synchronize(struct h64_replicated *hr);
+
+/** Number of entries as of the last completed writer operation. */
+size_t
+h64_replicated_count(const struct h64_replicated *hr);
+
+/** Number of replicas and the i-th one. */
+size_t
+h64_replicated_replicas(const struct h64_replicated *hr);
+
+struct h64_concurrent *
+h64_replicated_replica(struct h64_replicated *hr, size_t i);
+
+/**
+ * Register the calling thread as a reader of the replica of the node it
+ * runs on, so it should stay on the node. h64_reader_register of
+ * a replica picks one explicitly.
+ */
+struct h64_reader *
+h64_replicated_reader_register(struct h64_replicated *hr);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
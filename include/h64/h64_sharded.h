@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "h64/h64.h"
+
+/**
+ * Table split into independent shards for concurrent writers.
+ *
+ * An entry goes to the shard chosen by the high bits of its hash, right
+ * below the ones used for hints, and every shard is a regular table
+ * with its own lock. Writers of different shards don't contend with each
+ * other, and every shard resizes on its own, so a resize never blocks
+ * the whole table. The hash is computed once per operation, outside of
+ * the lock.
+ *
+ * All the functions are thread-safe.
+ */
+struct h64_sharded;
+
+/**
+ * Constructor for a table of shards_count shards, which must be a power
+ * of 2. The options are applied to every shard, see h64_create_ex.
+ */
+struct h64_sharded *
+h64_sharded_create(const struct h64_options *options, size_t shards_count);
+
+void
+h64_sharded_destroy(struct h64_sharded *hs);
+
+/** Same as h64_insert. */
+void
+h64_sharded_insert(struct h64_sharded *hs, void *entry);
+
+/** Same as h64_insert_new. */
+void
+h64_sharded_insert_new(struct h64_sharded *hs, void *entry);
+
+/** Same as h64_find. */
+void *
+h64_sharded_find(struct h64_sharded *hs, const void *entry);
+
+/** Same as h64_erase. */
+void *
+h64_sharded_erase(struct h64_sharded *hs, const void *entry);
+
+/** Sum of counts of the shards, each one is taken under its lock. */
+size_t
+h64_sharded_count(struct h64_sharded *hs);
+
+/**
+ * Call cb for every entry of every shard. A shard is locked while its
+ * entries are visited, cb must not modify the table.
+ */
+void
+h64_sharded_for_each(struct h64_sharded *hs,
+		     void (*cb)(void *entry, void *ctx), void *ctx);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "h64/h64.h"
+
+/**
+ * Snapshots of tables in files, mapped back without rehashing.
+ *
+ * A snapshot keeps the arrays of a table as they are in memory, so a
+ * mapped one is ready for lookups right away. Entries are pointers, so
+ * they are saved together with the arena they point into, and encoded
+ * for the snapshot mapped at an address chosen on saving. Mapped at that
+ * address, nothing is copied: pages of the file are shared with the page
+ * cache until they are written. Mapped elsewhere, every entry is
+ * relocated, which writes the groups but still calls no hasher.
+ *
+ * The file is specific to the pointer size and byte order of the machine
+ * it's written on, and to the hasher, which isn't saved.
+ */
+
+/** Default address of snapshots on 64-bit machines. */
+#define H64_SNAPSHOT_ADDRESS  ((uintptr_t)0x600000000000ull)
+
+struct h64_snapshot {
+	/**
+	 * Memory the entries point into, saved along with the table. NULL
+	 * if the entries aren't pointers, then they are saved as they are.
+	 */
+	const void *arena;
+	size_t arena_size;
+	/**
+	 * Page aligned address the snapshot is mapped at without relocating
+	 * entries, 0 for H64_SNAPSHOT_ADDRESS. Snapshots mapped by a process
+	 * at the same time need different addresses to all be zero-copy.
+	 */
+	uintptr_t address;
+};
+
+/**
+ * Save the table to a file at path, replacing it. Every entry must point
+ * into the arena of the snapshot, if there is one. A table in the middle
+ * of an incremental resize is saved with both arrays.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int
+h64_save(const struct h64 *h, const char *path,
+	 const struct h64_snapshot *snapshot);
+
+/**
+ * Map a table saved by h64_save. hasher and equals of the options must
+ * be the ones of the saved table, its seed, flags and resizing policy are
+ * restored. The allocator and the executor of the options are used for
+ * new arrays of the table, the rest of the options is ignored.
+ *
+ * The table is private: its modifications are never written to the file.
+ * It must be closed by h64_close_mmap instead of h64_destroy, as entries
+ * point into the mapping for as long as the table exists.
+ * Returns NULL with errno set on failure, EINVAL if the file is not a
+ * snapshot of this machine.
+ */
+struct h64 *
+h64_open_mmap(const char *path, const struct h64_options *options);
+
+/** Arena of a mapped table and its size, see struct h64_snapshot. */
+void *
+h64_mmap_arena(const struct h64 *h, size_t *size);
+
+/** Destroy a table mapped by h64_open_mmap and unmap it. */
+void
+h64_close_mmap(struct h64 *h);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -26,139 +26,299 @@
 #include <string.h>
 #include <stdbool.h>
 #include <limits.h>
-#include <stdio.h>
 #include <assert.h>
-
-#include <immintrin.h>
+#include <time.h>
 
 #include "utils.h"
+#include "h64_group.h"
+#include "h64_kernels.h"
+#include "h64_trace.h"
 #include "h64/h64.h"
 
 enum {
 	L1CACHE_LINE_SIZE = 64,
+	/* How many entries ahead batch operations hash and prefetch. */
+	PREFETCH_DISTANCE = 16,
 	DEFAULT_SIZE = 4,
 	MIN_SIZE = DEFAULT_SIZE,
-	GROUP_ENTRIES = H64_INTERNAL_GROUP_ENTRIES,
-	ENTRIES_MASK = 0x7F,
+	/*
+	 * Old groups moved per modification with H64_INCREMENTAL_RESIZE.
+	 * Growing leaves room for ~4.7 inserts per old group before the next
+	 * growth, so the migration always ends before it's needed again.
+	 */
+	MIGRATION_STEP = 2,
+	/*
+	 * Groups marked per modification by a H64_CLEAR_WAS_FULL cleanup, and
+	 * how many times more are cleared, which is only a status check.
+	 * A cleanup starts after grow_count erases, ~4.7 per group, so it's
+	 * done long before the next one.
+	 */
+	CLEANUP_STEP = 2,
+	CLEANUP_APPLY_RATIO = 16,
+	/* Smaller resizes aren't worth running in parallel. */
+	PARALLEL_MIN_ENTRIES = 1 << 16,
+	/* Shorter ranges of a parallel placement leave over too many entries. */
+	PARALLEL_MIN_GROUPS = 64,
+	/* Entries read from a source per call. */
+	SOURCE_CHUNK = 256,
+	/*
+	 * h64_build_from places entries partition by partition of groups.
+	 * Groups of a partition fit in L2, and partitions are few enough for
+	 * the scatter to them to stream.
+	 */
+	BUILD_PARTITION_GROUPS = 4096,
+	BUILD_MAX_PARTITIONS = 4096,
 };
 
+/* Default load factors, see struct h64_options. */
 #define MAX_LOAD_FACTOR  0.67
 #define MIN_LOAD_FACTOR  (MAX_LOAD_FACTOR / 4.0)
 
 static double
 h64_load_factor(const struct h64 *h);
 
-#ifdef H64_STORE_STATISTICS
-	#define DUMP_IF_STORING_STATS(h) do {					 \
-		size_t size_in_groups = h->size_in_groups;			 \
-		size_t count = h->count;					 \
-		double average_hint = h->hint_count != 0 ? 1. * h->hint_sum / h->hint_count : 0;		 \
-		double hitrate = h->compare_count != 0 ? 1. * h->equal_count / h->compare_count : 0;		 \
-		double find_average_probe_length = h->find_count != 0 ? 1. * h->find_probe_count / h->find_count : 0;	\
-		size_t find_max_probe_length = h->find_max_probe_count;	 \
-		double insert_average_probe_length = h->insert_count != 0 ? 1. * h->insert_probe_count / h->insert_count : 0;	\
-		size_t insert_max_probe_length = h->insert_max_probe_count;	 \
-		fprintf(stderr, "%s:\n", __func__);				 \
-		fprintf(stderr, "\t""size_in_groups: %zu\n", size_in_groups);    \
-		fprintf(stderr, "\t""count: %zu\n", count);			 \
-		fprintf(stderr, "\t""avg_hint: %lg\n", average_hint);		 \
-		fprintf(stderr, "\t""load_factor: %lg\n", h64_load_factor(h));   \
-		fprintf(stderr, "\t""hitrate: %lg\n", hitrate);			 \
-		fprintf(stderr, "\t""find:\n"					 \
-				"\t\t""avg_probe_length: %lg\n"		 	 \
-				"\t\t""max_probe_length: %zu\n",		 \
-				find_average_probe_length,			 \
-				find_max_probe_length);	       		 	 \
-		fprintf(stderr, "\t""insert:\n"					 \
-				"\t\t""avg_probe_length: %lg\n"			 \
-				"\t\t""max_probe_length: %zu\n",		 \
-				insert_average_probe_length,			 \
-				insert_max_probe_length);	       		 	 \
-	} while(0)
-
-	#define IF_STORING_STATS(...) __VA_ARGS__
-
-#else
-	#define DUMP_IF_STORING_STATS(h)  ;
+static size_t
+h64_shrink_count(const struct h64 *h, size_t size);
 
-	#define IF_STORING_STATS(...)  ;
+static size_t
+h64_size_for(const struct h64 *h, size_t entries_count);
 
-#endif
+/*
+ * Counters of H64_STATISTICS tables. Lookups of const tables update them
+ * too, possibly from several threads, so all the updates are relaxed
+ * atomic additions.
+ */
+struct h64_counters {
+	uint8_t sample_mask;
+	uint64_t lookup_probes[H64_STATS_PROBE_BUCKETS];
+	uint64_t place_probes[H64_STATS_PROBE_BUCKETS];
+	uint64_t hint_matches;
+	uint64_t hint_false_positives;
+	uint64_t filter_rejects;
+	uint64_t resizes;
+	uint64_t resize_ns;
+};
 
-static int
-group_was_full(const struct h64_group *group)
+static void
+counter_add(uint64_t *counter, uint64_t n)
 {
-	return group->status >> (CHAR_BIT - 1);
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
 }
 
-static int
-group_is_full(const struct h64_group *group)
+/*
+ * Counters to account the operation on the hash in, NULL if it isn't
+ * sampled. Sampling goes by the hint, which is kept by every hash the
+ * table works with, stored or sharded.
+ */
+static struct h64_counters *
+h64_sampled(const struct h64 *h, uint64_t hash)
 {
-	return (group->status & ENTRIES_MASK) == ENTRIES_MASK;
+	struct h64_counters *counters = h->counters;
+	if (likely(counters == NULL))
+		return NULL;
+	return (hash_hint(hash) & counters->sample_mask) == 0 ? counters
+							      : NULL;
 }
 
 static void
-group_insert(struct h64_group *group, void *entry, uint8_t hint, size_t idx)
+count_probes(uint64_t *histogram, size_t probes)
+{
+	size_t bucket = MIN(probes, (size_t)H64_STATS_PROBE_BUCKETS) - 1;
+	counter_add(&histogram[bucket], 1);
+}
+
+/*
+ * Trace a probe sequence of the hash, which took probes groups. Only the
+ * first group is probed inline, so long ones are traced in the tails.
+ */
+static inline void
+h64_trace_probes(const struct h64 *h, enum h64_probe_kind kind,
+		 uint64_t hash, size_t probes)
 {
-	assert(idx < GROUP_ENTRIES);
-	assert(group->entries[idx] == NULL);
-	assert(((group->status >> idx) & 0x1) == 0);
-	group->entries[idx] = entry;
-	group->hints[idx] = hint;
-	group->status |= 0x1 << idx;
-	if (group_is_full(group)) {
-		group->status = 0xFF;
+#ifdef H64_TRACING
+	if (probes > H64_TRACE_LONG_PROBE) {
+		if (kind == H64_PROBE_LOOKUP)
+			H64_TRACE3(lookup_long, h, hash, probes);
+		else
+			H64_TRACE3(place_long, h, hash, probes);
 	}
+	if (unlikely(h->probe_hook != NULL) &&
+	    (hash_hint(hash) & h->probe_hook_mask) == 0)
+		h->probe_hook(h, kind, hash, probes, h->probe_hook_ctx);
+#else
+	(void)h;
+	(void)kind;
+	(void)hash;
+	(void)probes;
+#endif
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *
+default_alloc(void *ctx, size_t size, size_t alignment)
+{
+	(void)ctx;
+	/* aligned_alloc wants the size to be a multiple of the alignment. */
+	size = (size + alignment - 1) / alignment * alignment;
+	void *ptr = aligned_alloc(alignment, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
 }
 
 static void
-group_update(struct h64_group *group, void *entry, size_t idx)
+default_free(void *ctx, void *ptr, size_t size)
 {
-	assert(idx < GROUP_ENTRIES);
-	assert(((group->status >> idx) & 0x1) == 1);
-	group->entries[idx] = entry;
+	(void)ctx;
+	(void)size;
+	free(ptr);
 }
 
+static const struct h64_allocator default_allocator = {
+	.alloc = default_alloc,
+	.free = default_free,
+	.ctx = NULL,
+};
+
+/* Zero filled memory from the table allocator. */
 static void *
-group_erase_entry(struct h64_group* group, size_t idx)
+h64_alloc(const struct h64 *h, size_t size)
+{
+	void *ptr = h->allocator.alloc(h->allocator.ctx, size,
+				       L1CACHE_LINE_SIZE);
+	assert(ptr && "Allocation failed");
+	H64_TRACE3(alloc, h, ptr, size);
+	return ptr;
+}
+
+static void
+h64_dealloc(const struct h64 *h, void *ptr, size_t size)
+{
+	if (ptr != NULL) {
+		H64_TRACE3(free, h, ptr, size);
+		h->allocator.free(h->allocator.ctx, ptr, size);
+	}
+}
+
+static size_t
+groups_bytes(size_t size_in_groups)
+{
+	return size_in_groups * sizeof(struct h64_group);
+}
+
+static size_t
+hashes_bytes(size_t size_in_groups)
+{
+	return size_in_groups * GROUP_ENTRIES * sizeof(uint32_t);
+}
+
+static size_t
+filter_bytes(size_t size_in_groups)
+{
+	return size_in_groups * sizeof(uint64_t);
+}
+
+static size_t
+clock_bytes(size_t size_in_groups)
+{
+	return size_in_groups * sizeof(struct h64_clock);
+}
+
+/*
+ * Miss filter (H64_MISS_FILTER).
+ *
+ * A blocked Bloom filter: an entry sets 4 bits of one 64-bit word, so a
+ * test is a single load. Words and bits are picked from the low 32 bits
+ * and the hint of the hash, which is all a stored hash keeps. Both are
+ * multiplied by odd constants to mix them, the word from the top bits of
+ * one product and the bits from the top bits of the other one.
+ */
+static uint64_t *
+filter_word(uint64_t *filter, size_t size_in_groups, uint64_t hash)
+{
+	uint64_t key = (uint32_t)hash | (uint64_t)hash_hint(hash) << 32;
+	size_t index = (key * 0x9E3779B97F4A7C15ull) >>
+		       (64 - __builtin_ctzll(size_in_groups));
+	return &filter[index];
+}
+
+static uint64_t
+filter_mask(uint64_t hash)
+{
+	uint64_t key = (uint32_t)hash | (uint64_t)hash_hint(hash) << 32;
+	uint64_t bits = key * 0xC2B2AE3D27D4EB4Full;
+	return 1ull << (bits >> 58) | 1ull << ((bits >> 52) & 63) |
+	       1ull << ((bits >> 46) & 63) | 1ull << ((bits >> 40) & 63);
+}
+
+static bool
+filter_test(uint64_t *filter, size_t size_in_groups, uint64_t hash)
 {
-	assert(idx < GROUP_ENTRIES);
-	void *entry = group->entries[idx];
-	group->entries[idx] = NULL;
-	group->hints[idx] = 0;
-	group->status &= ~(0x1 << idx);
-	return entry;
+	uint64_t mask = filter_mask(hash);
+	return (*filter_word(filter, size_in_groups, hash) & mask) == mask;
 }
 
+/* False if the entry of the hash is surely absent from both arrays. */
+static bool
+h64_filter_test(const struct h64 *h, uint64_t hash)
+{
+	if (filter_test(h->filter, h->size_in_groups, hash))
+		return true;
+	return h->old_filter != NULL &&
+	       filter_test(h->old_filter, h->old_size_in_groups, hash);
+}
+
+static void
+h64_filter_add(struct h64 *h, uint64_t hash)
+{
+	*filter_word(h->filter, h->size_in_groups, hash) |= filter_mask(hash);
+}
+
+/*
+ * Allocate size empty groups for the table. Configuration of the table
+ * (functions, seed, flags, allocator, policy) is left as is, so a copy
+ * of a table can be turned into an empty table of another size.
+ */
 static void
-h64_init(struct h64 *h, size_t size,
-	 h64_hasher_f hasher, h64_equals_f equals)
+h64_init(struct h64 *h, size_t size)
 {
 	assert(is_power_of_2(size) && "Size must be a power of 2.");
 
-	h->hasher = hasher;
-	h->equals = equals;
-	size = size < MIN_SIZE ? MIN_SIZE : size;
-	struct h64_group *groups = aligned_xalloc(
-		L1CACHE_LINE_SIZE, size * sizeof(*groups)
-	);
-	memset(groups, 0, size * sizeof(*groups));
-	h->groups = groups;
+	size = size < h->min_size_in_groups ? h->min_size_in_groups : size;
+	h->groups = h64_alloc(h, groups_bytes(size));
 	h->size_in_groups = size;
-	h->seed = mixer64((uint64_t)groups);
+	h->hashes = NULL;
+	h->old_groups = NULL;
+	h->old_hashes = NULL;
+	h->old_filter = NULL;
+	h->old_size_in_groups = 0;
+	h->migrated_groups = 0;
+	h->filter = NULL;
+	h->filter_erased = 0;
+	if (h->flags & H64_MISS_FILTER)
+		h->filter = h64_alloc(h, filter_bytes(size));
+	h->clock = NULL;
+	if (h->flags & H64_EVICT)
+		h->clock = h64_alloc(h, clock_bytes(size));
+	if (h->flags & H64_STORE_HASHES) {
+		assert(size <= UINT32_MAX &&
+		       "Stored hashes can't address so many groups.");
+		h->hashes = h64_alloc(h, hashes_bytes(size));
+	}
+	h->grow_count = h->max_load_factor * (size * GROUP_ENTRIES);
+	h->shrink_count = h64_shrink_count(h, size);
 	h->count = 0;
-	IF_STORING_STATS(
-		h->hint_sum = 0;
-		h->hint_count = 0;
-		h->find_count = 0;
-		h->find_probe_count = 0;
-		h->find_max_probe_count = 0;
-		h->insert_count = 0;
-		h->insert_probe_count = 0;
-		h->insert_max_probe_count = 0;
-		h->equal_count = 0;
-		h->compare_count = 0;
-	)
+	/* A resize leaves no stale bits, a running cleanup is for the old array. */
+	h->was_full_groups = 0;
+	h->cleanup_erased = 0;
+	h->cleanup = NULL;
 }
 
 static void
@@ -172,318 +332,1806 @@ h64_swap(struct h64 *h1, struct h64 *h2)
 struct h64 *
 h64_create(h64_hasher_f hasher, h64_equals_f equals)
 {
-	assert(hasher != NULL && "Need a hash function.");
-	assert(equals != NULL && "Need an equals function.");
+	struct h64_options options = {
+		.hasher = hasher,
+		.equals = equals,
+	};
+	return h64_create_ex(&options);
+}
+
+struct h64 *
+h64_create_ex(const struct h64_options *options)
+{
+	assert(options->hasher != NULL && "Need a hash function.");
+	assert(options->equals != NULL && "Need an equals function.");
 	struct h64 *h = xcalloc(1, sizeof(*h));
-	h64_init(h, DEFAULT_SIZE, hasher, equals);
+	h->hasher = options->hasher;
+	h->equals = options->equals;
+	h->flags = options->flags;
+	h->allocator = options->allocator != NULL ? *options->allocator
+						  : default_allocator;
+	if (options->executor != NULL) {
+		assert(options->executor->threads > 0 &&
+		       "Executor needs at least one thread.");
+		h->executor = *options->executor;
+	}
+	h->max_load_factor = options->max_load_factor != 0 ?
+			     options->max_load_factor : MAX_LOAD_FACTOR;
+	h->min_load_factor = options->min_load_factor != 0 ?
+			     options->min_load_factor :
+			     h->max_load_factor / 4.0;
+	assert(h->max_load_factor > 0 && h->max_load_factor < 1 &&
+	       "Max load factor must be in (0, 1).");
+	/* Otherwise a table might shrink right after growing. */
+	assert(h->min_load_factor < h->max_load_factor / 2 &&
+	       "Min load factor must be less than half of the max one.");
+	/* h64_size_for never returns less than the current minimum. */
+	h->min_size_in_groups = MIN_SIZE;
+	h->min_size_in_groups = h64_size_for(h, options->min_capacity);
+	if (h->flags & H64_STATISTICS) {
+		assert(options->stats_sample_shift <= CHAR_BIT &&
+		       "Operations are sampled by hints, 1 of 256 at most.");
+		h->counters = xcalloc(1, sizeof(*h->counters));
+		h->counters->sample_mask = (1u << options->stats_sample_shift) - 1;
+	}
+	h->evict = options->evict;
+	h->evict_ctx = options->evict_ctx;
+	assert(options->probe_hook_sample_shift <= CHAR_BIT &&
+	       "Operations are sampled by hints, 1 of 256 at most.");
+	h->probe_hook = options->probe_hook;
+	h->probe_hook_ctx = options->probe_hook_ctx;
+	h->probe_hook_mask = (1u << options->probe_hook_sample_shift) - 1;
+	h64_init(h, DEFAULT_SIZE);
+	h->seed = options->seed != 0 ? options->seed
+				     : mixer64((uint64_t)h->groups);
 	return h;
 }
 
 static void
 h64_free(struct h64 *h)
 {
-	free(h->groups);
+	h64_dealloc(h, h->groups, groups_bytes(h->size_in_groups));
+	h64_dealloc(h, h->hashes, hashes_bytes(h->size_in_groups));
+	h64_dealloc(h, h->filter, filter_bytes(h->size_in_groups));
+	h64_dealloc(h, h->clock, clock_bytes(h->size_in_groups));
+	h64_dealloc(h, h->old_groups, groups_bytes(h->old_size_in_groups));
+	h64_dealloc(h, h->old_hashes, hashes_bytes(h->old_size_in_groups));
+	h64_dealloc(h, h->old_filter, filter_bytes(h->old_size_in_groups));
+	free(h->cleanup);
 }
 
 void
 h64_destroy(struct h64 *h)
 {
 	h64_free(h);
+	free(h->counters);
 	free(h);
 }
 
-/* Prefetch memory with groups in order to avoid cache-misses. */
-static void
-h64_prefetch_groups(const struct h64 *h)
+/* Block shift of the probe sequences of the table. */
+static inline unsigned
+h64_block_shift(const struct h64 *h)
 {
-	__builtin_prefetch(h->groups, 0, 1);
+	return (h->flags & H64_WIDE_PROBING) ? WIDE_PROBE_SHIFT : 0;
 }
 
+/*
+ * Prefetch the first group of the probe sequence for the hash, and the
+ * word of the filter.
+ * It only helps if there is enough work to do before the group is
+ * accessed, so it's used by batch operations which hash ahead.
+ */
 static void
-h64_resize(struct h64 *h, size_t size)
+h64_prefetch_group(const struct h64 *h, uint64_t hash)
 {
-	DUMP_IF_STORING_STATS(h);
-	assert(is_power_of_2(size) && "Size must be a power of 2.");
+	size_t position = hash & (h->size_in_groups - 1);
+	__builtin_prefetch(&h->groups[position], 0, 3);
+	if (h->filter != NULL)
+		__builtin_prefetch(filter_word(h->filter, h->size_in_groups,
+					       hash), 0, 3);
+}
 
-	h64_prefetch_groups(h);
-	struct h64 tmp;
-	h64_init(&tmp, size, h->hasher, h->equals);
-	h64_for_each(h, entry)
-		h64_insert_new(&tmp, entry);
+static uint64_t
+h64_hash(const struct h64 *h, const void *entry);
 
-	h64_swap(h, &tmp);
-	h64_free(&tmp);
+static void
+h64_place(struct h64 *h, void *entry, uint64_t hash);
 
-}
+static void
+h64_place_slot(struct h64 *h, void *entry, uint64_t hash);
 
-void
-h64_reserve(struct h64 *h, size_t entries_count)
+/*
+ * Hash of the entry in the slot of groups. With H64_STORE_HASHES it's
+ * glued from the stored low half and the hint, which is enough to place
+ * the entry in a table of up to 2^32 groups, so the hasher isn't called.
+ */
+static uint64_t
+h64_slot_hash(const struct h64 *h, const struct h64_group *groups,
+	      const uint32_t *hashes, size_t position, size_t index)
 {
-	size_t total_entries = entries_count / MAX_LOAD_FACTOR;
-	size_t size_in_groups = roundup_to_pow2(total_entries / GROUP_ENTRIES + 1);
-	h64_resize(h, size_in_groups);
+	const struct h64_group *group = &groups[position];
+	if (hashes == NULL)
+		return h64_hash(h, group->entries[index]);
+
+	uint64_t low = hashes[position * GROUP_ENTRIES + index];
+	uint64_t high = (uint64_t)group->hints[index] << (CHAR_BIT * 7);
+	return high | low;
 }
 
+/*
+ * Build the filter anew from the entries of the current array. Entries
+ * of the old array are still covered by the old filter.
+ */
 static void
-h64_grow_up(struct h64 *h)
+h64_filter_rebuild(struct h64 *h)
+{
+	memset(h->filter, 0, filter_bytes(h->size_in_groups));
+	for (size_t i = 0; i < h->size_in_groups; ++i) {
+		uint8_t status = h->groups[i].status & ENTRIES_MASK;
+		while (status != 0) {
+			size_t idx = __builtin_ctz(status);
+			h64_filter_add(h, h64_slot_hash(h, h->groups,
+							h->hashes, i, idx));
+			status &= status - 1;
+		}
+	}
+	h->filter_erased = 0;
+}
+
+/*
+ * Cleanup of stale "was full" bits (H64_CLEAR_WAS_FULL).
+ *
+ * The bit of a group is needed only while an entry is displaced past it:
+ * the group precedes the group of the entry in its probe sequence. A
+ * cleanup walks probe sequences of all the entries, marks the groups they
+ * pass in a bitmap and then clears the bit of unmarked groups with empty
+ * slots. Both passes go a few groups per modification, as a migration.
+ *
+ * Entries placed meanwhile mark the groups they pass themselves. And a
+ * placement passes only full groups, which keep the bit, so a bit cleared
+ * before such a placement is never needed by it. A resize rebuilds every
+ * bit, so it simply drops the cleanup.
+ */
+struct h64_cleanup {
+	/* Group to mark next, or size_in_groups + group to clear next. */
+	size_t position;
+	uint64_t marks[];
+};
+
+static size_t
+cleanup_bytes(size_t size_in_groups)
 {
-	h64_resize(h, h->size_in_groups * 2);
+	return sizeof(struct h64_cleanup) +
+	       (size_in_groups + 63) / 64 * sizeof(uint64_t);
 }
 
 static void
-h64_grow_down(struct h64 *h)
+h64_cleanup_start(struct h64 *h)
 {
-	h64_resize(h, h->size_in_groups / 2);
+	assert(h->old_groups == NULL && "Can't clean up during a migration.");
+	h->cleanup = xcalloc(1, cleanup_bytes(h->size_in_groups));
+	h->cleanup_erased = 0;
 }
 
-static uint64_t
-h64_hash(const struct h64 *h, const void *entry)
+static void
+h64_cleanup_cancel(struct h64 *h)
 {
-	return h->hasher(entry, h->seed);
+	free(h->cleanup);
+	h->cleanup = NULL;
 }
 
-static bool
-h64_equals(const struct h64 *h, const void *lsh, const void *rhs)
+/* Mark groups the entry of the hash in the group at position is past. */
+static void
+h64_cleanup_mark(struct h64 *h, uint64_t hash, size_t position)
 {
-	return h->equals(lsh, rhs);
+	uint64_t *marks = h->cleanup->marks;
+	struct probe_sequence seq;
+	ps_init(&seq, hash, h->size_in_groups, h64_block_shift(h));
+	for (size_t p; (p = ps_position(&seq)) != position; ps_next(&seq))
+		marks[p / 64] |= 1ull << (p % 64);
 }
 
-static uint8_t
-hash_hint(uint64_t hash)
+static void
+h64_cleanup_step(struct h64 *h, size_t groups_count)
 {
-	/* Leftmost byte. */
-	return hash >> (CHAR_BIT * 7);
+	struct h64_cleanup *cleanup = h->cleanup;
+	if (likely(cleanup == NULL))
+		return;
+
+	size_t size = h->size_in_groups;
+	if (cleanup->position < size) {
+		size_t end = MIN(cleanup->position + groups_count, size);
+		for (size_t i = cleanup->position; i < end; ++i) {
+			uint8_t status = h->groups[i].status & ENTRIES_MASK;
+			while (status != 0) {
+				size_t idx = __builtin_ctz(status);
+				h64_cleanup_mark(h, h64_slot_hash(h, h->groups,
+								  h->hashes,
+								  i, idx), i);
+				status &= status - 1;
+			}
+		}
+		cleanup->position = end;
+		return;
+	}
+
+	size_t begin = cleanup->position - size;
+	size_t end = MIN(begin + groups_count * CLEANUP_APPLY_RATIO, size);
+	for (size_t i = begin; i < end; ++i) {
+		struct h64_group *group = &h->groups[i];
+		bool marked = (cleanup->marks[i / 64] >> (i % 64)) & 1;
+		if (marked || !group_was_full(group) || group_is_full(group))
+			continue;
+		/* Readers of concurrent tables may load the status meanwhile. */
+		__atomic_store_n(&group->status, group->status & ENTRIES_MASK,
+				 __ATOMIC_RELEASE);
+		h->was_full_groups -= 1;
+	}
+	cleanup->position = size + end;
+	if (end == size)
+		h64_cleanup_cancel(h);
 }
 
-/**
- * Quadratic probing sequence.
- * It assumes that hash table size is power of 2, so I can substitute mod with
- * using a mask, and stepping formula step[i] = start + (i^2 + i) / 2 guarantees
- * that every group will be traversed only once.
+/*
+ * Parallel placement.
+ *
+ * Groups of the destination are split into as many contiguous ranges as
+ * there are tasks, and every task places the entries whose probe sequence
+ * starts in its range. A task never touches groups out of its range, an
+ * entry probing past it is left over and placed serially after the tasks
+ * are done. Groups only get fuller meanwhile, so the probe sequences of
+ * placed entries stay valid whatever the order of placement is.
+ *
+ * The source is an array of entries or the groups of another table. It's
+ * split into chunks, one per task, which are passed twice: to hash the
+ * entries and count them per range, then to scatter them by range.
  */
-struct probe_sequence {
-	size_t start;
-	size_t iteration;
-	size_t size_mask;
+struct build_item {
+	void *entry;
+	uint64_t hash;
 };
 
-static void
-ps_init(struct probe_sequence *ps, uint64_t hash, size_t size)
+struct parallel_build {
+	struct h64 *h;
+	unsigned size_shift;
+	size_t tasks;
+	/* Entries of the array, or of the groups of src if it's not NULL. */
+	void **entries;
+	const struct h64 *src;
+	size_t source_size;
+	/* Hashes computed by the first pass, NULL if src stores them. */
+	uint64_t *hashes;
+	/* Counts of every chunk per range, then positions to scatter at. */
+	size_t *offsets;
+	/* Start of every range in items, and the end of the last one. */
+	size_t *bounds;
+	struct build_item *items;
+	/* Number of entries left over by every range, put at its start. */
+	size_t *leftovers;
+};
+
+typedef void (*pb_visit_f)(struct parallel_build *pb, size_t chunk,
+			   size_t k, void *entry);
+
+static size_t
+pb_range(const struct parallel_build *pb, size_t position)
 {
-	ps->size_mask = size - 1;
-	ps->iteration = 0;
-	ps->start = hash & ps->size_mask;
+	return (position * pb->tasks) >> pb->size_shift;
 }
 
+/* Call visit for every entry of the chunk with its index k in the source. */
 static void
-ps_next(struct probe_sequence *ps)
+pb_visit(struct parallel_build *pb, size_t chunk, pb_visit_f visit)
 {
-	ps->iteration += 1;
+	size_t begin = pb->source_size * chunk / pb->tasks;
+	size_t end = pb->source_size * (chunk + 1) / pb->tasks;
+	if (pb->src == NULL) {
+		for (size_t i = begin; i < end; ++i)
+			visit(pb, chunk, i, pb->entries[i]);
+		return;
+	}
+
+	for (size_t i = begin; i < end; ++i) {
+		struct h64_group *group = &pb->src->groups[i];
+		uint8_t status = group->status & ENTRIES_MASK;
+		while (status != 0) {
+			size_t idx = __builtin_ctz(status);
+			visit(pb, chunk, i * GROUP_ENTRIES + idx,
+			      group->entries[idx]);
+			status &= status - 1;
+		}
+	}
 }
 
-static size_t
-ps_position(const struct probe_sequence *ps)
+static uint64_t
+pb_hash(const struct parallel_build *pb, size_t k, const void *entry)
 {
-	size_t s = ps->start;
-	size_t i = ps->iteration;
-	size_t mask = ps->size_mask;
-	return (s + i * (i + 1) / 2) & mask;
+	if (pb->src == NULL)
+		return h64_hash(pb->h, entry);
+	const struct h64 *src = pb->src;
+	return h64_slot_hash(src, src->groups, src->hashes,
+			     k / GROUP_ENTRIES, k % GROUP_ENTRIES);
 }
 
-static uint8_t
-group_match_inserted(const struct h64_group* group, uint8_t hint)
+static void
+pb_count(struct parallel_build *pb, size_t chunk, size_t k, void *entry)
 {
-	__m128i hints = _mm_lddqu_si128((const __m128i *)group->hints);
-	__m128i target = _mm_set1_epi8(hint);
-	__m128i match = _mm_cmpeq_epi8(target, hints);
-	return _mm_movemask_epi8(match) & group->status & 0x7F;
+	uint64_t hash = pb_hash(pb, k, entry);
+	if (pb->hashes != NULL)
+		pb->hashes[k] = hash;
+	size_t position = hash & (pb->h->size_in_groups - 1);
+	pb->offsets[chunk * pb->tasks + pb_range(pb, position)] += 1;
 }
 
-struct find_result {
-	struct h64_group *group;
-	size_t index;
-	bool found;
-};
-
 static void
-find_result_init(struct find_result *result,
-		 struct h64_group *group, size_t index, bool found)
+pb_scatter(struct parallel_build *pb, size_t chunk, size_t k, void *entry)
 {
-	result->group = group;
-	result->index = index;
-	result->found = found;
+	uint64_t hash = pb->hashes != NULL ? pb->hashes[k]
+					   : pb_hash(pb, k, entry);
+	size_t position = hash & (pb->h->size_in_groups - 1);
+	size_t *offset = &pb->offsets[chunk * pb->tasks +
+				      pb_range(pb, position)];
+	pb->items[*offset] = (struct build_item){ entry, hash };
+	*offset += 1;
 }
 
 static void
-h64_find_entry(const struct h64 *h, const void *entry,
-	       uint64_t hash, struct find_result *result)
+pb_count_task(void *arg, size_t chunk)
 {
-	IF_STORING_STATS(
-		((struct h64 *)h)->find_count += 1;
-	)
-
-	uint8_t hint = hash_hint(hash);
-	struct probe_sequence seq;
-	ps_init(&seq, hash, h->size_in_groups);
-
-	while (true) {
+	pb_visit(arg, chunk, pb_count);
+}
 
-		IF_STORING_STATS(
-			((struct h64 *)h)->find_probe_count += 1;
-			((struct h64 *)h)->find_max_probe_count = MAX(
-				seq.iteration + 1,
-				h->find_max_probe_count
-			);
-		)
+static void
+pb_scatter_task(void *arg, size_t chunk)
+{
+	pb_visit(arg, chunk, pb_scatter);
+}
 
-		size_t position = ps_position(&seq);
-		struct h64_group *group = &h->groups[position];
-		void **entries = group->entries;
-		uint8_t match_byte = group_match_inserted(group, hint);
-		while (match_byte != 0) {
-			IF_STORING_STATS(((struct h64 *)h)->compare_count += 1;)
-			uint8_t match_bit = match_byte & (-match_byte);
-			uint8_t idx = __builtin_ctz(match_byte);
-			if (likely(h64_equals(h, entry, entries[idx]))) {
-				IF_STORING_STATS(((struct h64 *)h)->equal_count += 1;)
-				return find_result_init(result, group, idx, true);
+static void
+pb_place_task(void *arg, size_t range)
+{
+	struct parallel_build *pb = arg;
+	struct h64 *h = pb->h;
+	size_t begin = pb->bounds[range];
+	size_t end = pb->bounds[range + 1];
+	size_t leftovers = begin;
+	size_t filled = 0;
+	for (size_t i = begin; i < end; ++i) {
+		if (i + PREFETCH_DISTANCE < end)
+			h64_prefetch_group(h, pb->items[i + PREFETCH_DISTANCE].hash);
+
+		struct build_item item = pb->items[i];
+		struct probe_sequence seq;
+		ps_init(&seq, item.hash, h->size_in_groups, h64_block_shift(h));
+		while (true) {
+			size_t position = ps_position(&seq);
+			if (pb_range(pb, position) != range) {
+				pb->items[leftovers++] = item;
+				break;
 			}
-			match_byte ^= match_bit;
+			struct h64_group *group = &h->groups[position];
+			if (likely(!group_is_full(group))) {
+				size_t index = __builtin_ctz(~group->status);
+				bool was_full = group_was_full(group);
+				group_insert(group, item.entry,
+					     hash_hint(item.hash), index);
+				filled += !was_full && group_was_full(group);
+				if (h->hashes != NULL)
+					h->hashes[position * GROUP_ENTRIES +
+						  index] = item.hash;
+				/* Other ranges may set bits of the word too. */
+				if (h->filter != NULL)
+					__atomic_fetch_or(
+						filter_word(h->filter,
+							    h->size_in_groups,
+							    item.hash),
+						filter_mask(item.hash),
+						__ATOMIC_RELAXED);
+				break;
+			}
+			ps_next(&seq);
 		}
+	}
+	pb->leftovers[range] = leftovers - begin;
+	__atomic_fetch_add(&h->was_full_groups, filled, __ATOMIC_RELAXED);
+}
 
-		if (likely(!group_was_full(group)))
-			return find_result_init(result, NULL, -1, false);
+/*
+ * Number of tasks to place count entries in h with, 1 if it's better
+ * done serially.
+ */
+static size_t
+h64_parallel_tasks(const struct h64 *h, const struct h64_executor *executor,
+		   size_t count)
+{
+	/* Tasks spill past first groups, evicting tables never do. */
+	if (executor == NULL || count < PARALLEL_MIN_ENTRIES ||
+	    h->clock != NULL)
+		return 1;
+	return MAX(MIN(executor->threads,
+		       h->size_in_groups / PARALLEL_MIN_GROUPS), 1);
+}
 
-		ps_next(&seq);
+/*
+ * Place count entries, of the array or of the src table if it's not NULL,
+ * in h. There must be enough room for them below the max load factor.
+ */
+static void
+h64_place_parallel(struct h64 *h, void **entries, const struct h64 *src,
+		   size_t count, const struct h64_executor *executor,
+		   size_t tasks)
+{
+	/* Tasks don't mark groups for a cleanup, it starts over later. */
+	h64_cleanup_cancel(h);
+	struct parallel_build pb = {
+		.h = h,
+		.size_shift = __builtin_ctzll(h->size_in_groups),
+		.tasks = tasks,
+		.entries = entries,
+		.src = src,
+		.source_size = src != NULL ? src->size_in_groups : count,
+	};
+	if (src == NULL)
+		pb.hashes = xcalloc(count, sizeof(*pb.hashes));
+	else if (src->hashes == NULL)
+		pb.hashes = xcalloc(src->size_in_groups * GROUP_ENTRIES,
+				    sizeof(*pb.hashes));
+	pb.offsets = xcalloc(tasks * tasks, sizeof(*pb.offsets));
+	pb.bounds = xcalloc(tasks + 1, sizeof(*pb.bounds));
+	pb.items = xcalloc(count, sizeof(*pb.items));
+	pb.leftovers = xcalloc(tasks, sizeof(*pb.leftovers));
+
+	executor->run(executor->ctx, pb_count_task, &pb, tasks);
+	size_t total = 0;
+	for (size_t range = 0; range < tasks; ++range) {
+		pb.bounds[range] = total;
+		for (size_t chunk = 0; chunk < tasks; ++chunk) {
+			size_t *offset = &pb.offsets[chunk * tasks + range];
+			size_t chunk_count = *offset;
+			*offset = total;
+			total += chunk_count;
+		}
 	}
+	pb.bounds[tasks] = total;
+	assert(total == count);
+	executor->run(executor->ctx, pb_scatter_task, &pb, tasks);
+	executor->run(executor->ctx, pb_place_task, &pb, tasks);
+
+	for (size_t range = 0; range < tasks; ++range) {
+		size_t begin = pb.bounds[range];
+		size_t end = begin + pb.leftovers[range];
+		for (size_t i = begin; i < end; ++i)
+			h64_place_slot(h, pb.items[i].entry, pb.items[i].hash);
+	}
+	h->count += count;
+
+	free(pb.hashes);
+	free(pb.offsets);
+	free(pb.bounds);
+	free(pb.items);
+	free(pb.leftovers);
 }
 
 static void
-h64_find_empty_entry(const struct h64 *h, uint64_t hash,
-		     struct find_result *result)
-{
-	IF_STORING_STATS(
-		((struct h64 *)h)->insert_count += 1;
-	)
+h64_finish_migration(struct h64 *h);
 
-	uint8_t hint = hash_hint(hash);
-	struct probe_sequence seq;
-	ps_init(&seq, hash, h->size_in_groups);
+static void
+h64_resize_on(struct h64 *h, size_t size, const struct h64_executor *executor)
+{
+	assert(is_power_of_2(size) && "Size must be a power of 2.");
+	/* Tables of a bounded capacity keep their size. */
+	if (h->clock != NULL)
+		return;
+
+	uint64_t start = h->counters != NULL ? now_ns() : 0;
+	h64_finish_migration(h);
+	size_t old_size = h->size_in_groups;
+	H64_TRACE3(resize_start, h, old_size, size);
+	/* The copy keeps the seed, so precomputed hashes stay valid. */
+	struct h64 tmp = *h;
+	h64_init(&tmp, size);
+	size_t tasks = h64_parallel_tasks(&tmp, executor, h->count);
+	if (tasks > 1) {
+		h64_place_parallel(&tmp, NULL, h, h->count, executor, tasks);
+	} else {
+		for (size_t i = 0; i < h->size_in_groups; ++i) {
+			struct h64_group *group = &h->groups[i];
+			uint8_t status = group->status & ENTRIES_MASK;
+			while (status != 0) {
+				size_t idx = __builtin_ctz(status);
+				uint64_t hash = h64_slot_hash(h, h->groups,
+							      h->hashes, i, idx);
+				h64_place(&tmp, group->entries[idx], hash);
+				status &= status - 1;
+			}
+		}
+	}
 
-	while (true) {
+	h64_swap(h, &tmp);
+	h64_free(&tmp);
+	H64_TRACE3(resize_end, h, old_size, size);
+	if (h->counters != NULL) {
+		counter_add(&h->counters->resizes, 1);
+		counter_add(&h->counters->resize_ns, now_ns() - start);
+	}
+}
 
-		IF_STORING_STATS(
-			((struct h64 *)h)->insert_probe_count += 1;
-			((struct h64 *)h)->insert_max_probe_count = MAX(
-				seq.iteration + 1,
-				h->insert_max_probe_count
-			);
-		)
+/* Resize on the table executor if it has one. */
+static void
+h64_resize(struct h64 *h, size_t size)
+{
+	h64_resize_on(h, size, h->executor.run != NULL ? &h->executor : NULL);
+}
 
-		size_t position = ps_position(&seq);
-		struct h64_group *group = &h->groups[position];
-		if (likely(!group_is_full(group))) {
-			/* get an index of the first zero bit from right. */
-			size_t index = __builtin_ctz(~group->status);
-			return find_result_init(result, group, index, true);
+/*
+ * Incremental resizing (H64_INCREMENTAL_RESIZE).
+ *
+ * Instead of rehashing the whole table at once, a new array of groups is
+ * allocated and the old one is kept alongside. New entries go to the new
+ * array, and every modification moves MIGRATION_STEP old groups to it.
+ * Until the old array is drained, lookups probe both of them.
+ *
+ * Migrated old groups keep their "was full" bit: entries displaced past
+ * them in the old array are still found by probing through.
+ */
+static void
+h64_migrate(struct h64 *h, size_t groups_count)
+{
+	if (likely(h->old_groups == NULL))
+		return;
+
+	size_t end = h->migrated_groups + groups_count;
+	end = end < h->old_size_in_groups ? end : h->old_size_in_groups;
+	for (size_t i = h->migrated_groups; i < end; ++i) {
+		struct h64_group *group = &h->old_groups[i];
+		uint8_t status = group->status & ENTRIES_MASK;
+		while (status != 0) {
+			size_t idx = __builtin_ctz(status);
+			uint64_t hash = h64_slot_hash(h, h->old_groups,
+						      h->old_hashes, i, idx);
+			h64_place_slot(h, group_erase_entry(group, idx), hash);
+			status &= status - 1;
 		}
-		ps_next(&seq);
+	}
+	h->migrated_groups = end;
+
+	if (h->migrated_groups == h->old_size_in_groups) {
+		size_t size = h->old_size_in_groups;
+		h64_dealloc(h, h->old_groups, groups_bytes(size));
+		h64_dealloc(h, h->old_hashes, hashes_bytes(size));
+		h64_dealloc(h, h->old_filter, filter_bytes(size));
+		h->old_groups = NULL;
+		h->old_hashes = NULL;
+		h->old_filter = NULL;
+		h->old_size_in_groups = 0;
+		h->migrated_groups = 0;
+		H64_TRACE3(resize_end, h, size, h->size_in_groups);
 	}
 }
 
-void *
-h64_find(const struct h64 *h, const void *entry)
+static void
+h64_finish_migration(struct h64 *h)
 {
-	DUMP_IF_STORING_STATS(h);
-
-	h64_prefetch_groups(h);
-	uint64_t hash = h64_hash(h, entry);
-	struct find_result result;
-	h64_find_entry(h, entry, hash, &result);
-	return result.found ? result.group->entries[result.index]
-			    : NULL;
+	h64_migrate(h, h->old_size_in_groups);
 }
 
-static double
-h64_load_factor(const struct h64 *h)
+static void
+h64_start_migration(struct h64 *h, size_t size)
 {
-	return h->count / (h->size_in_groups * GROUP_ENTRIES * 1.0);
+	assert(is_power_of_2(size) && "Size must be a power of 2.");
+	if (h->clock != NULL)
+		return;
+
+	h64_finish_migration(h);
+	h64_cleanup_cancel(h);
+	H64_TRACE3(resize_start, h, h->size_in_groups, size);
+	struct h64 tmp = *h;
+	h64_init(&tmp, size);
+	tmp.count = h->count;
+	tmp.old_groups = h->groups;
+	tmp.old_hashes = h->hashes;
+	tmp.old_filter = h->filter;
+	tmp.old_size_in_groups = h->size_in_groups;
+	*h = tmp;
+	if (h->counters != NULL)
+		counter_add(&h->counters->resizes, 1);
 }
 
-static bool
-h64_should_grow_up(const struct h64 *h)
+/* Resize the table in a way chosen at the table creation. */
+static void
+h64_rebuild(struct h64 *h, size_t size)
 {
-	size_t max_count = MAX_LOAD_FACTOR * (h->size_in_groups * GROUP_ENTRIES);
-	return h->count > max_count;
+	if (h->flags & H64_INCREMENTAL_RESIZE)
+		h64_start_migration(h, size);
+	else
+		h64_resize(h, size);
 }
 
-static bool
-h64_should_grow_down(const struct h64 *h)
+/* Number of groups required to store entries_count entries. */
+static size_t
+h64_size_for(const struct h64 *h, size_t entries_count)
 {
-	size_t min_count = MIN_LOAD_FACTOR * (h->size_in_groups * GROUP_ENTRIES);
-	return h->count < min_count && h->size_in_groups > MIN_SIZE;
+	size_t total_entries = entries_count / h->max_load_factor;
+	size_t size = roundup_to_pow2(total_entries / GROUP_ENTRIES + 1);
+	return MAX(size, h->min_size_in_groups);
 }
 
 void
-h64_insert_new(struct h64 *h, void *entry)
+h64_reserve(struct h64 *h, size_t entries_count)
 {
-	if (h64_should_grow_up(h))
-		h64_grow_up(h);
-
-	h64_prefetch_groups(h);
-	uint64_t hash = h64_hash(h, entry);
-	uint8_t hint = hash_hint(hash);
-	struct find_result result;
-	h64_find_empty_entry(h, hash, &result);
-	group_insert(result.group, entry, hint, result.index);
-	h->count += 1;
+	h64_resize(h, h64_size_for(h, MAX(entries_count, h->count)));
 }
 
 void
-h64_insert(struct h64 *h, void *entry)
+h64_shrink_to_fit(struct h64 *h)
 {
-	DUMP_IF_STORING_STATS(h);
-
-	if (h64_should_grow_up(h))
-		h64_grow_up(h);
-
-	h64_prefetch_groups(h);
-	uint64_t hash = h64_hash(h, entry);
-	uint8_t hint = hash_hint(hash);
-	struct find_result result;
-	h64_find_entry(h, entry, hash, &result);
-	if (result.found) {
-		group_update(result.group, entry, result.index);
-	} else {
-		IF_STORING_STATS(
-			h->hint_sum += hint;
-			h->hint_count += 1;
-		)
-
-		h64_find_empty_entry(h, hash, &result);
-		group_insert(result.group, entry, hint, result.index);
-		h->count += 1;
-	}
+	size_t size_in_groups = h64_size_for(h, h->count);
+	if (size_in_groups < h->size_in_groups)
+		h64_resize(h, size_in_groups);
 }
 
-void *
-h64_erase(struct h64 *h, const void *entry)
+void
+h64_clear_was_full(struct h64 *h)
 {
-	DUMP_IF_STORING_STATS(h);
+	h64_finish_migration(h);
+	if (h->cleanup == NULL)
+		h64_cleanup_start(h);
+	while (h->cleanup != NULL)
+		h64_cleanup_step(h, h->size_in_groups);
+}
 
-	h64_prefetch_groups(h);
-	uint64_t hash = h64_hash(h, entry);
+static void
+h64_grow_up(struct h64 *h)
+{
+	h64_rebuild(h, h->size_in_groups * 2);
+}
+
+static void
+h64_grow_down(struct h64 *h)
+{
+	h64_rebuild(h, h->size_in_groups / 2);
+}
+
+static uint64_t
+h64_hash(const struct h64 *h, const void *entry)
+{
+	return h->hasher(entry, h->seed);
+}
+
+struct find_result {
+	struct h64_group *group;
+	size_t index;
+	bool found;
+};
+
+static void
+find_result_init(struct find_result *result,
+		 struct h64_group *group, size_t index, bool found)
+{
+	result->group = group;
+	result->index = index;
+	result->found = found;
+}
+
+/*
+ * The first group with an empty slot on the probe sequence of a search,
+ * and probes to get to it.
+ */
+struct empty_slot {
+	struct h64_group *group;
+	size_t probes;
+};
+
+/*
+ * Compare the entry with the matched entries of the group, and fill in
+ * the result if one of them is equal. The entry may be a key of another
+ * type, equals compares it with entries of the table.
+ */
+static bool
+h64_match_entries(struct h64_group *group, uint8_t match_byte,
+		  const void *entry, h64_equals_f equals,
+		  struct h64_counters *counters, struct find_result *result)
+{
+	void **entries = group->entries;
+	while (match_byte != 0) {
+		uint8_t match_bit = match_byte & (-match_byte);
+		uint8_t idx = __builtin_ctz(match_byte);
+		if (unlikely(counters != NULL))
+			counter_add(&counters->hint_matches, 1);
+		if (likely(equals(entry, entries[idx]))) {
+			find_result_init(result, group, idx, true);
+			return true;
+		}
+		if (unlikely(counters != NULL))
+			counter_add(&counters->hint_false_positives, 1);
+		match_byte ^= match_bit;
+	}
+	return false;
+}
+
+/*
+ * The probe sequence past a full first group, matched by windows of
+ * the runtime chosen kernel. Groups of a window past the end of the
+ * sequence are loaded but ignored.
+ */
+static __attribute__((noinline)) void
+h64_find_tail(const struct h64 *h, struct h64_group *groups,
+	      const void *entry, h64_equals_f equals, uint64_t hash,
+	      struct probe_sequence *seq, struct h64_counters *counters,
+	      struct find_result *result, struct empty_slot *empty)
+{
+	uint8_t hint = hash_hint(hash);
+	const struct h64_kernels *kernels = h64_kernels_get();
+	size_t width = kernels->width;
+	struct h64_group *window[KERNEL_MAX_WIDTH];
+	while (true) {
+		for (size_t i = 0; i < width; ++i) {
+			ps_next(seq);
+			window[i] = &groups[ps_position(seq)];
+		}
+		uint64_t lanes = kernels->match(window, hint);
+		for (size_t i = 0; i < width; ++i) {
+			unsigned lane = kernel_lane(lanes, i);
+			size_t probes = seq->iteration + 1 - (width - 1 - i);
+			if (empty != NULL && empty->group == NULL &&
+			    (lane & KERNEL_NOT_FULL)) {
+				empty->group = window[i];
+				empty->probes = probes;
+			}
+			bool found = h64_match_entries(window[i],
+						       lane & ENTRIES_MASK,
+						       entry, equals,
+						       counters, result);
+			if (!found && (lane & KERNEL_WAS_FULL))
+				continue;
+			if (unlikely(counters != NULL))
+				count_probes(counters->lookup_probes, probes);
+			h64_trace_probes(h, H64_PROBE_LOOKUP, hash, probes);
+			if (!found)
+				find_result_init(result, NULL, -1, false);
+			return;
+		}
+	}
+}
+
+/*
+ * Find the entry in the array. If empty isn't NULL, the first group with
+ * an empty slot on the way is remembered in it. There is always one: the
+ * search stops at a group which was never full.
+ */
+static void
+h64_find_in(const struct h64 *h, struct h64_group *groups, size_t size,
+	    const void *entry, h64_equals_f equals, uint64_t hash,
+	    struct find_result *result, struct empty_slot *empty)
+{
+	struct h64_counters *counters = h64_sampled(h, hash);
+	uint8_t hint = hash_hint(hash);
+	struct probe_sequence seq;
+	ps_init(&seq, hash, size, h64_block_shift(h));
+
+	struct h64_group *group = &groups[ps_position(&seq)];
+	if (empty != NULL) {
+		empty->group = group_is_full(group) ? NULL : group;
+		empty->probes = 1;
+	}
+	bool found = h64_match_entries(group, group_match_inserted(group, hint),
+				       entry, equals, counters, result);
+	if (unlikely(!found && group_was_full(group)))
+		return h64_find_tail(h, groups, entry, equals, hash, &seq,
+				     counters, result, empty);
+
+	if (unlikely(counters != NULL))
+		count_probes(counters->lookup_probes, 1);
+	h64_trace_probes(h, H64_PROBE_LOOKUP, hash, 1);
+	if (!found)
+		find_result_init(result, NULL, -1, false);
+}
+
+/*
+ * Set the reference bit of the slot found in a H64_EVICT table. Lookups of
+ * const tables set it too, with a relaxed atomic, and only if it's clear,
+ * so the lines of hot groups aren't written on every hit.
+ */
+static void
+h64_clock_touch(const struct h64 *h, const struct find_result *result)
+{
+	uint8_t *referenced = &h->clock[result->group - h->groups].referenced;
+	uint8_t bit = 1u << result->index;
+	if (!(__atomic_load_n(referenced, __ATOMIC_RELAXED) & bit))
+		__atomic_fetch_or(referenced, bit, __ATOMIC_RELAXED);
+}
+
+/*
+ * Evict an entry of the full first group of a H64_EVICT table, and put its
+ * slot to result. The hand gives referenced slots a second chance, then
+ * stops at the first unreferenced one.
+ */
+static void
+h64_clock_evict(struct h64 *h, struct h64_group *group,
+		struct find_result *result)
+{
+	struct h64_clock *clock = &h->clock[group - h->groups];
+	size_t hand = clock->hand;
+	while (clock->referenced >> hand & 0x1) {
+		clock->referenced &= ~(1u << hand);
+		hand = (hand + 1) % GROUP_ENTRIES;
+	}
+	clock->hand = (hand + 1) % GROUP_ENTRIES;
+
+	void *evicted = group_erase_entry(group, hand);
+	h->count -= 1;
+	if (h->filter != NULL && ++h->filter_erased > h->grow_count / 2)
+		h64_filter_rebuild(h);
+	if (h->evict != NULL)
+		h->evict(evicted, h->evict_ctx);
+	find_result_init(result, group, hand, true);
+}
+
+/* Find the entry in the table, in both arrays during a migration. */
+static void
+h64_find_by(const struct h64 *h, const void *entry, h64_equals_f equals,
+	    uint64_t hash, struct find_result *result)
+{
+	if (unlikely(h->filter != NULL) && !h64_filter_test(h, hash)) {
+		struct h64_counters *counters = h64_sampled(h, hash);
+		if (unlikely(counters != NULL))
+			counter_add(&counters->filter_rejects, 1);
+		return find_result_init(result, NULL, -1, false);
+	}
+	h64_find_in(h, h->groups, h->size_in_groups, entry, equals, hash,
+		    result, NULL);
+	if (unlikely(h->old_groups != NULL) && !result->found)
+		h64_find_in(h, h->old_groups, h->old_size_in_groups,
+			    entry, equals, hash, result, NULL);
+	if (unlikely(h->clock != NULL) && result->found)
+		h64_clock_touch(h, result);
+}
+
+static void
+h64_find_entry(const struct h64 *h, const void *entry,
+	       uint64_t hash, struct find_result *result)
+{
+	h64_find_by(h, entry, h->equals, hash, result);
+}
+
+/* Same as h64_find_tail, for a group with empty slots. */
+static __attribute__((noinline)) void
+h64_find_empty_tail(const struct h64 *h, uint64_t hash,
+		    struct probe_sequence *seq, struct h64_counters *counters,
+		    struct find_result *result)
+{
+	const struct h64_kernels *kernels = h64_kernels_get();
+	size_t width = kernels->width;
+	struct h64_group *window[KERNEL_MAX_WIDTH];
+	while (true) {
+		for (size_t i = 0; i < width; ++i) {
+			ps_next(seq);
+			window[i] = &h->groups[ps_position(seq)];
+		}
+		uint64_t lanes = kernels->match(window, 0);
+		for (size_t i = 0; i < width; ++i) {
+			if (!(kernel_lane(lanes, i) & KERNEL_NOT_FULL))
+				continue;
+			size_t probes = seq->iteration + 1 - (width - 1 - i);
+			if (unlikely(counters != NULL))
+				count_probes(counters->place_probes, probes);
+			h64_trace_probes(h, H64_PROBE_PLACE, hash, probes);
+			size_t index = __builtin_ctz(~window[i]->status);
+			return find_result_init(result, window[i], index, true);
+		}
+	}
+}
+
+/*
+ * Empty slot for an entry of the hash. For a H64_EVICT table it's always
+ * in the first group, where an entry is evicted if it's full.
+ */
+static void
+h64_find_empty_entry(struct h64 *h, uint64_t hash, struct find_result *result)
+{
+	struct h64_counters *counters = h64_sampled(h, hash);
+	struct probe_sequence seq;
+	ps_init(&seq, hash, h->size_in_groups, h64_block_shift(h));
+
+	struct h64_group *group = &h->groups[ps_position(&seq)];
+	if (unlikely(group_is_full(group))) {
+		if (h->clock != NULL) {
+			if (unlikely(counters != NULL))
+				count_probes(counters->place_probes, 1);
+			h64_trace_probes(h, H64_PROBE_PLACE, hash, 1);
+			return h64_clock_evict(h, group, result);
+		}
+		return h64_find_empty_tail(h, hash, &seq, counters, result);
+	}
+
+	if (unlikely(counters != NULL))
+		count_probes(counters->place_probes, 1);
+	h64_trace_probes(h, H64_PROBE_PLACE, hash, 1);
+	/* get an index of the first zero bit from right. */
+	size_t index = __builtin_ctz(~group->status);
+	find_result_init(result, group, index, true);
+}
+
+static void *
+h64_do_find(const struct h64 *h, const void *entry, uint64_t hash)
+{
 	struct find_result result;
 	h64_find_entry(h, entry, hash, &result);
-	if (result.found) {
-		void *ret = group_erase_entry(result.group, result.index);
-		h->count -= 1;
+	return result.found ? result.group->entries[result.index]
+			    : NULL;
+}
+
+void *
+h64_find(const struct h64 *h, const void *entry)
+{
+	return h64_do_find(h, entry, h64_hash(h, entry));
+}
+
+void *
+h64_find_hashed(const struct h64 *h, const void *entry, uint64_t hash)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	return h64_do_find(h, entry, hash);
+}
+
+void *
+h64_find_key(const struct h64 *h, const void *key, h64_key_hasher_f key_hash,
+	     h64_key_equals_f key_equals)
+{
+	return h64_find_key_hashed(h, key, key_hash(key, h->seed), key_equals);
+}
+
+void *
+h64_find_key_hashed(const struct h64 *h, const void *key, uint64_t hash,
+		    h64_key_equals_f key_equals)
+{
+	struct find_result result;
+	h64_find_by(h, key, key_equals, hash, &result);
+	return result.found ? result.group->entries[result.index]
+			    : NULL;
+}
 
-		if (h64_should_grow_down(h))
-			h64_grow_down(h);
+/*
+ * Batch operations keep hashes of the next PREFETCH_DISTANCE entries
+ * in a ring, so the first group of an entry is requested from memory
+ * PREFETCH_DISTANCE operations before it's probed.
+ */
+struct hash_pipeline {
+	uint64_t hashes[PREFETCH_DISTANCE];
+	const void **entries;
+	size_t n;
+};
+
+static void
+hp_push(struct hash_pipeline *hp, const struct h64 *h, size_t i)
+{
+	uint64_t hash = h64_hash(h, hp->entries[i]);
+	h64_prefetch_group(h, hash);
+	hp->hashes[i % PREFETCH_DISTANCE] = hash;
+}
 
-		return ret;
+static void
+hp_init(struct hash_pipeline *hp, const struct h64 *h,
+	const void **entries, size_t n)
+{
+	hp->entries = entries;
+	hp->n = n;
+	for (size_t i = 0; i < n && i < PREFETCH_DISTANCE; ++i)
+		hp_push(hp, h, i);
+}
+
+/* Hash of the i-th entry. Starts hashing of the (i + distance)-th one. */
+static uint64_t
+hp_pop(struct hash_pipeline *hp, const struct h64 *h, size_t i)
+{
+	uint64_t hash = hp->hashes[i % PREFETCH_DISTANCE];
+	if (i + PREFETCH_DISTANCE < hp->n)
+		hp_push(hp, h, i + PREFETCH_DISTANCE);
+	return hash;
+}
+
+void
+h64_find_batch(const struct h64 *h, const void **entries, size_t n,
+	       void **out)
+{
+	struct hash_pipeline hp;
+	hp_init(&hp, h, entries, n);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t hash = hp_pop(&hp, h, i);
+		struct find_result result;
+		h64_find_entry(h, entries[i], hash, &result);
+		out[i] = result.found ? result.group->entries[result.index]
+				      : NULL;
 	}
+}
 
+/* Start probing the array at the first group of the lookup. */
+static void
+h64_lookup_probe(struct h64_lookup_state *state, struct h64_group *groups,
+		 size_t size)
+{
+	struct probe_sequence seq;
+	ps_init(&seq, state->hash, size, h64_block_shift(state->h));
+	state->groups = groups;
+	state->start = seq.start;
+	state->iteration = 0;
+	state->size_mask = seq.size_mask;
+	state->block_shift = seq.block_shift;
+	state->pending = &groups[ps_position(&seq)];
+}
+
+static const struct h64_group *
+h64_do_lookup_start(struct h64_lookup_state *state, const struct h64 *h,
+		    const void *entry, uint64_t hash)
+{
+	state->found = NULL;
+	state->h = h;
+	state->entry = entry;
+	state->hash = hash;
+	if (unlikely(h->filter != NULL) && !h64_filter_test(h, hash)) {
+		struct h64_counters *counters = h64_sampled(h, hash);
+		if (unlikely(counters != NULL))
+			counter_add(&counters->filter_rejects, 1);
+		state->pending = NULL;
+		return NULL;
+	}
+	h64_lookup_probe(state, h->groups, h->size_in_groups);
+	return state->pending;
+}
+
+const struct h64_group *
+h64_lookup_start(struct h64_lookup_state *state, const struct h64 *h,
+		 const void *entry)
+{
+	return h64_do_lookup_start(state, h, entry, h64_hash(h, entry));
+}
+
+const struct h64_group *
+h64_lookup_start_hashed(struct h64_lookup_state *state, const struct h64 *h,
+			const void *entry, uint64_t hash)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	return h64_do_lookup_start(state, h, entry, hash);
+}
+
+/* Same as h64_find_by, a group per step. */
+const struct h64_group *
+h64_lookup_step(struct h64_lookup_state *state)
+{
+	const struct h64 *h = state->h;
+	struct h64_counters *counters = h64_sampled(h, state->hash);
+	struct h64_group *group = state->pending;
+	uint8_t match = group_match_inserted(group, hash_hint(state->hash));
+	struct find_result result;
+	bool found = h64_match_entries(group, match, state->entry, h->equals,
+				       counters, &result);
+	if (!found && group_was_full(group)) {
+		struct probe_sequence seq = {
+			.start = state->start,
+			.iteration = state->iteration + 1,
+			.size_mask = state->size_mask,
+			.block_shift = state->block_shift,
+		};
+		state->iteration = seq.iteration;
+		state->pending = &state->groups[ps_position(&seq)];
+		return state->pending;
+	}
+
+	if (unlikely(counters != NULL))
+		count_probes(counters->lookup_probes, state->iteration + 1);
+	h64_trace_probes(h, H64_PROBE_LOOKUP, state->hash,
+			 state->iteration + 1);
+	if (found) {
+		if (unlikely(h->clock != NULL))
+			h64_clock_touch(h, &result);
+		state->found = group->entries[result.index];
+	} else if (unlikely(h->old_groups != NULL) &&
+		   state->groups != h->old_groups) {
+		/* The entry may be not migrated yet. */
+		h64_lookup_probe(state, h->old_groups, h->old_size_in_groups);
+		return state->pending;
+	}
+	state->pending = NULL;
 	return NULL;
 }
+
+static double
+h64_load_factor(const struct h64 *h)
+{
+	return h->count / (h->size_in_groups * GROUP_ENTRIES * 1.0);
+}
+
+/*
+ * Count of entries to shrink a table of size groups at. It's 0 if the
+ * table of this size must not be shrunk.
+ */
+static size_t
+h64_shrink_count(const struct h64 *h, size_t size)
+{
+	if ((h->flags & (H64_NO_SHRINK | H64_EVICT)) ||
+	    size <= h->min_size_in_groups)
+		return 0;
+	return h->min_load_factor * (size * GROUP_ENTRIES);
+}
+
+static bool
+h64_should_grow_up(const struct h64 *h)
+{
+	return h->count > h->grow_count && h->clock == NULL;
+}
+
+static bool
+h64_should_grow_down(const struct h64 *h)
+{
+	return h->count < h->shrink_count;
+}
+
+/* Put the entry in the empty slot of the result. */
+static void
+h64_fill_slot(struct h64 *h, void *entry, uint64_t hash,
+	      const struct find_result *result)
+{
+	uint8_t hint = hash_hint(hash);
+	size_t position = result->group - h->groups;
+	bool was_full = group_was_full(result->group);
+	group_insert(result->group, entry, hint, result->index);
+	if (unlikely(h->clock != NULL)) {
+		/* Nothing is placed past the group, so misses stop at it. */
+		h->clock[position].referenced &= ~(1u << result->index);
+		result->group->status &= ENTRIES_MASK;
+	}
+	h->was_full_groups += !was_full && group_was_full(result->group);
+	if (h->hashes != NULL)
+		h->hashes[position * GROUP_ENTRIES + result->index] = hash;
+	if (unlikely(h->cleanup != NULL))
+		h64_cleanup_mark(h, hash, position);
+	if (h->filter != NULL)
+		h64_filter_add(h, hash);
+}
+
+/*
+ * Put the entry in the first empty slot of its probe sequence.
+ * The count of entries is left as is.
+ */
+static void
+h64_place_slot(struct h64 *h, void *entry, uint64_t hash)
+{
+	struct find_result result;
+	h64_find_empty_entry(h, hash, &result);
+	h64_fill_slot(h, entry, hash, &result);
+}
+
+static void
+h64_place(struct h64 *h, void *entry, uint64_t hash)
+{
+	h64_place_slot(h, entry, hash);
+	h->count += 1;
+}
+
+static void
+h64_do_insert_new(struct h64 *h, void *entry, uint64_t hash)
+{
+	if (h64_should_grow_up(h))
+		h64_grow_up(h);
+	h64_migrate(h, MIGRATION_STEP);
+	h64_cleanup_step(h, CLEANUP_STEP);
+
+	h64_place(h, entry, hash);
+}
+
+void
+h64_insert_new(struct h64 *h, void *entry)
+{
+	h64_do_insert_new(h, entry, h64_hash(h, entry));
+}
+
+void
+h64_insert_new_hashed(struct h64 *h, void *entry, uint64_t hash)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	h64_do_insert_new(h, entry, hash);
+}
+
+/*
+ * Find the entry, or place it if there's none, and count it. A search in
+ * the current array passes the first empty slot of the sequence before it
+ * stops, where a miss is placed without probing again. Return whether the
+ * entry is placed, result has its slot or the one of the entry found.
+ */
+static bool
+h64_find_or_place(struct h64 *h, void *entry, uint64_t hash,
+		  struct find_result *result)
+{
+	struct empty_slot empty = { NULL, 0 };
+	if (likely(h->filter == NULL) || h64_filter_test(h, hash)) {
+		h64_find_in(h, h->groups, h->size_in_groups, entry,
+			    h->equals, hash, result, &empty);
+		if (unlikely(h->old_groups != NULL) && !result->found)
+			h64_find_in(h, h->old_groups, h->old_size_in_groups,
+				    entry, h->equals, hash, result, NULL);
+		if (result->found) {
+			if (unlikely(h->clock != NULL))
+				h64_clock_touch(h, result);
+			return false;
+		}
+	} else {
+		struct h64_counters *counters = h64_sampled(h, hash);
+		if (unlikely(counters != NULL))
+			counter_add(&counters->filter_rejects, 1);
+	}
+
+	if (empty.group != NULL) {
+		struct h64_counters *counters = h64_sampled(h, hash);
+		if (unlikely(counters != NULL))
+			count_probes(counters->place_probes, empty.probes);
+		h64_trace_probes(h, H64_PROBE_PLACE, hash, empty.probes);
+		find_result_init(result, empty.group,
+				 __builtin_ctz(~empty.group->status), true);
+	} else {
+		h64_find_empty_entry(h, hash, result);
+	}
+	h64_fill_slot(h, entry, hash, result);
+	h->count += 1;
+	return true;
+}
+
+/* Insert or update an entry without checking the load factor. */
+static void
+h64_insert_no_grow(struct h64 *h, void *entry, uint64_t hash)
+{
+	struct find_result result;
+	if (!h64_find_or_place(h, entry, hash, &result))
+		group_update(result.group, entry, result.index);
+}
+
+static void
+h64_do_insert(struct h64 *h, void *entry, uint64_t hash)
+{
+	if (h64_should_grow_up(h))
+		h64_grow_up(h);
+	h64_migrate(h, MIGRATION_STEP);
+	h64_cleanup_step(h, CLEANUP_STEP);
+
+	h64_insert_no_grow(h, entry, hash);
+}
+
+void
+h64_insert(struct h64 *h, void *entry)
+{
+	h64_do_insert(h, entry, h64_hash(h, entry));
+}
+
+void
+h64_insert_hashed(struct h64 *h, void *entry, uint64_t hash)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	h64_do_insert(h, entry, hash);
+}
+
+static void **
+h64_do_find_or_insert(struct h64 *h, void *entry, uint64_t hash,
+		      bool *inserted)
+{
+	if (h64_should_grow_up(h))
+		h64_grow_up(h);
+	h64_migrate(h, MIGRATION_STEP);
+	h64_cleanup_step(h, CLEANUP_STEP);
+
+	struct find_result result;
+	*inserted = h64_find_or_place(h, entry, hash, &result);
+	return &result.group->entries[result.index];
+}
+
+void **
+h64_find_or_insert(struct h64 *h, void *entry, bool *inserted)
+{
+	return h64_do_find_or_insert(h, entry, h64_hash(h, entry), inserted);
+}
+
+void **
+h64_find_or_insert_hashed(struct h64 *h, void *entry, uint64_t hash,
+			  bool *inserted)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	return h64_do_find_or_insert(h, entry, hash, inserted);
+}
+
+void
+h64_insert_batch(struct h64 *h, void **entries, size_t n)
+{
+	/* Grow once for the worst case of all the entries being new. */
+	size_t size_in_groups = h64_size_for(h, h->count + n);
+	if (size_in_groups > h->size_in_groups)
+		h64_rebuild(h, size_in_groups);
+
+	struct hash_pipeline hp;
+	hp_init(&hp, h, (const void **)entries, n);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t hash = hp_pop(&hp, h, i);
+		h64_migrate(h, MIGRATION_STEP);
+		h64_cleanup_step(h, CLEANUP_STEP);
+		h64_insert_no_grow(h, entries[i], hash);
+	}
+}
+
+/* Erase an entry without checking the load factor. */
+static void *
+h64_erase_no_shrink(struct h64 *h, const void *entry, uint64_t hash)
+{
+	struct find_result result;
+	h64_find_entry(h, entry, hash, &result);
+	if (!result.found)
+		return NULL;
+
+	h->count -= 1;
+	void *erased = group_erase_entry(result.group, result.index);
+	/* Bits of erased entries pile up, rebuild before they take over. */
+	if (h->filter != NULL && ++h->filter_erased > h->grow_count / 2)
+		h64_filter_rebuild(h);
+	if ((h->flags & H64_CLEAR_WAS_FULL) &&
+	    ++h->cleanup_erased > h->grow_count &&
+	    h->cleanup == NULL && h->old_groups == NULL)
+		h64_cleanup_start(h);
+	return erased;
+}
+
+static void *
+h64_do_erase(struct h64 *h, const void *entry, uint64_t hash)
+{
+	h64_migrate(h, MIGRATION_STEP);
+	h64_cleanup_step(h, CLEANUP_STEP);
+	void *ret = h64_erase_no_shrink(h, entry, hash);
+	if (ret != NULL && h64_should_grow_down(h))
+		h64_grow_down(h);
+
+	return ret;
+}
+
+void *
+h64_erase(struct h64 *h, const void *entry)
+{
+	return h64_do_erase(h, entry, h64_hash(h, entry));
+}
+
+void *
+h64_erase_hashed(struct h64 *h, const void *entry, uint64_t hash)
+{
+	assert(hash == h64_hash(h, entry) && "Hash must match the hasher.");
+	return h64_do_erase(h, entry, hash);
+}
+
+void
+h64_erase_batch(struct h64 *h, const void **entries, size_t n, void **out)
+{
+	struct hash_pipeline hp;
+	hp_init(&hp, h, entries, n);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t hash = hp_pop(&hp, h, i);
+		h64_migrate(h, MIGRATION_STEP);
+		h64_cleanup_step(h, CLEANUP_STEP);
+		void *ret = h64_erase_no_shrink(h, entries[i], hash);
+		if (out != NULL)
+			out[i] = ret;
+	}
+
+	/* Same size as a sequence of h64_erase calls would leave. */
+	size_t size_in_groups = h->size_in_groups;
+	while (h->count < h64_shrink_count(h, size_in_groups))
+		size_in_groups /= 2;
+	if (size_in_groups < h->size_in_groups)
+		h64_rebuild(h, size_in_groups);
+}
+
+void
+h64_build_parallel(struct h64 *h, void **entries, size_t n, size_t nthreads)
+{
+	assert(nthreads > 0 && "Need at least one thread.");
+
+	struct h64_executor executor = h->executor.run != NULL ?
+				       h->executor :
+				       h64_thread_executor(nthreads);
+	executor.threads = nthreads;
+
+	size_t size_in_groups = h64_size_for(h, h->count + n);
+	if (size_in_groups > h->size_in_groups)
+		h64_resize_on(h, size_in_groups, &executor);
+	else
+		h64_finish_migration(h);
+
+	size_t tasks = h64_parallel_tasks(h, &executor, n);
+	if (tasks > 1) {
+		h64_place_parallel(h, entries, NULL, n, &executor, tasks);
+		return;
+	}
+	for (size_t i = 0; i < n; ++i)
+		h64_place(h, entries[i], h64_hash(h, entries[i]));
+}
+
+void
+h64_build_from(struct h64 *h, const struct h64_source *source, size_t n)
+{
+	size_t size_in_groups = h64_size_for(h, h->count + n);
+	if (size_in_groups > h->size_in_groups)
+		h64_resize(h, size_in_groups);
+	else
+		h64_finish_migration(h);
+	if (n == 0)
+		return;
+
+	/* Partitions are ranges of groups, by the top bits of positions. */
+	size_t size_shift = __builtin_ctzll(h->size_in_groups);
+	size_t partitions = MIN(h->size_in_groups / BUILD_PARTITION_GROUPS,
+				(size_t)BUILD_MAX_PARTITIONS);
+	partitions = MAX(partitions, (size_t)1);
+	size_t shift = size_shift - __builtin_ctzll(partitions);
+	size_t mask = h->size_in_groups - 1;
+
+	/* Read the entries, counting them per partition. */
+	size_t *offsets = xcalloc(partitions + 1, sizeof(*offsets));
+	struct build_item *items = xcalloc(n, sizeof(*items));
+	void *entries[SOURCE_CHUNK];
+	uint64_t hashes[SOURCE_CHUNK];
+	size_t count = 0;
+	while (count < n) {
+		size_t max = MIN(n - count, (size_t)SOURCE_CHUNK);
+		size_t read = source->read(source->ctx, entries,
+					   source->hashed ? hashes : NULL, max);
+		assert(read <= max && "Source read too many entries.");
+		if (read == 0)
+			break;
+		for (size_t i = 0; i < read; ++i) {
+			uint64_t hash = source->hashed ? hashes[i]
+						       : h64_hash(h, entries[i]);
+			assert(hash == h64_hash(h, entries[i]) &&
+			       "Hash must match the hasher.");
+			items[count + i] = (struct build_item){ entries[i], hash };
+			offsets[((hash & mask) >> shift) + 1] += 1;
+		}
+		count += read;
+	}
+
+	/* Partition, then place partition by partition. */
+	for (size_t i = 1; i <= partitions; ++i)
+		offsets[i] += offsets[i - 1];
+	struct build_item *sorted = xcalloc(MAX(count, (size_t)1),
+					    sizeof(*sorted));
+	for (size_t i = 0; i < count; ++i)
+		sorted[offsets[(items[i].hash & mask) >> shift]++] = items[i];
+	free(items);
+	for (size_t i = 0; i < count; ++i)
+		h64_place_slot(h, sorted[i].entry, sorted[i].hash);
+	h->count += count;
+	free(sorted);
+	free(offsets);
+}
+
+/*
+ * Visit entries of the array whose first group is home: they are on its
+ * probe sequence, up to the first group which was never full.
+ */
+static void
+h64_scan_home(const struct h64 *h, const struct h64_group *groups,
+	      const uint32_t *hashes, size_t size, size_t home,
+	      void (*cb)(void *entry, void *ctx), void *ctx)
+{
+	struct probe_sequence seq;
+	ps_init(&seq, home, size, h64_block_shift(h));
+	for (size_t probes = 0; probes < size; ++probes) {
+		size_t position = ps_position(&seq);
+		const struct h64_group *group = &groups[position];
+		uint8_t status = group->status & ENTRIES_MASK;
+		while (status) {
+			size_t idx = __builtin_ctz(status);
+			status &= status - 1;
+			uint64_t hash = h64_slot_hash(h, groups, hashes,
+						      position, idx);
+			if ((hash & (size - 1)) == home)
+				cb(group->entries[idx], ctx);
+		}
+		if (!group_was_full(group))
+			return;
+		ps_next(&seq);
+	}
+}
+
+static uint64_t
+reverse_bits(uint64_t v)
+{
+	const uint64_t m1 = 0x5555555555555555ull;
+	const uint64_t m2 = 0x3333333333333333ull;
+	const uint64_t m4 = 0x0F0F0F0F0F0F0F0Full;
+	v = ((v >> 1) & m1) | ((v & m1) << 1);
+	v = ((v >> 2) & m2) | ((v & m2) << 2);
+	v = ((v >> 4) & m4) | ((v & m4) << 4);
+	return __builtin_bswap64(v);
+}
+
+/* Increment the bits of the cursor under the mask, starting at the top. */
+static uint64_t
+cursor_next(uint64_t cursor, uint64_t mask)
+{
+	cursor |= ~mask;
+	return reverse_bits(reverse_bits(cursor) + 1);
+}
+
+/*
+ * The cursor runs over first groups in the reversed bit order, so groups
+ * visited in an array of one size cover the images of theirs in arrays of
+ * any other: groups of a twice larger array are visited in pairs, groups
+ * of a twice smaller one are visited at the same time as its images. Two
+ * arrays of a resize are walked as the smaller one plus all the images
+ * of its group in the larger one.
+ */
+uint64_t
+h64_scan(const struct h64 *h, uint64_t cursor,
+	 void (*cb)(void *entry, void *ctx), void *ctx)
+{
+	if (h->old_groups == NULL) {
+		uint64_t mask = h->size_in_groups - 1;
+		h64_scan_home(h, h->groups, h->hashes, h->size_in_groups,
+			      cursor & mask, cb, ctx);
+		return cursor_next(cursor, mask);
+	}
+
+	const struct h64_group *small = h->groups, *large = h->old_groups;
+	const uint32_t *small_hashes = h->hashes, *large_hashes = h->old_hashes;
+	size_t small_size = h->size_in_groups, large_size = h->old_size_in_groups;
+	if (small_size > large_size) {
+		const struct h64_group *groups = small;
+		small = large;
+		large = groups;
+		const uint32_t *hashes = small_hashes;
+		small_hashes = large_hashes;
+		large_hashes = hashes;
+		size_t size = small_size;
+		small_size = large_size;
+		large_size = size;
+	}
+	uint64_t small_mask = small_size - 1, large_mask = large_size - 1;
+	h64_scan_home(h, small, small_hashes, small_size, cursor & small_mask,
+		      cb, ctx);
+	do {
+		h64_scan_home(h, large, large_hashes, large_size,
+			      cursor & large_mask, cb, ctx);
+		cursor = cursor_next(cursor, large_mask);
+	} while (cursor & (small_mask ^ large_mask));
+	return cursor;
+}
+
+/* Copy of an array of the table, NULL if there is none. */
+static void *
+h64_copy_array(const struct h64 *h, const void *array, size_t bytes)
+{
+	if (array == NULL)
+		return NULL;
+	void *copy = h64_alloc(h, bytes);
+	memcpy(copy, array, bytes);
+	return copy;
+}
+
+struct h64 *
+h64_clone(const struct h64 *h)
+{
+	struct h64 *clone = xcalloc(1, sizeof(*clone));
+	*clone = *h;
+	size_t size = h->size_in_groups;
+	size_t old_size = h->old_size_in_groups;
+	clone->groups = h64_copy_array(h, h->groups, groups_bytes(size));
+	clone->hashes = h64_copy_array(h, h->hashes, hashes_bytes(size));
+	clone->filter = h64_copy_array(h, h->filter, filter_bytes(size));
+	clone->clock = h64_copy_array(h, h->clock, clock_bytes(size));
+	clone->old_groups = h64_copy_array(h, h->old_groups,
+					   groups_bytes(old_size));
+	clone->old_hashes = h64_copy_array(h, h->old_hashes,
+					   hashes_bytes(old_size));
+	clone->old_filter = h64_copy_array(h, h->old_filter,
+					   filter_bytes(old_size));
+	if (h->cleanup != NULL) {
+		size_t bytes = cleanup_bytes(size);
+		clone->cleanup = xcalloc(1, bytes);
+		memcpy(clone->cleanup, h->cleanup, bytes);
+	}
+	if (h->counters != NULL) {
+		clone->counters = xcalloc(1, sizeof(*clone->counters));
+		clone->counters->sample_mask = h->counters->sample_mask;
+	}
+	return clone;
+}
+
+/*
+ * Entries of a table with their hashes for another table, for merges and
+ * diffs. Groups are read in order, a few ahead, and the first groups of
+ * the next PREFETCH_DISTANCE entries in the other table are requested
+ * before the entries are returned, as batch operations do.
+ *
+ * A group of the current array equal to the group of the other table at
+ * the same position is skipped: its entries are all in the other table,
+ * the same pointers. So groups of a clone left as they were cost a
+ * comparison.
+ */
+struct slot_pipeline {
+	const struct h64 *h;
+	const struct h64 *other;
+	/* Hashes of h are hashes of other too, the same hasher and seed. */
+	bool same_hash;
+	/* Next group to read, over both arrays as h64_internal_group. */
+	size_t next;
+	/* The array of the current group, its position and slots left. */
+	const struct h64_group *groups;
+	const uint32_t *hashes;
+	size_t position;
+	unsigned status;
+	/* Entries from head to tail are hashed and prefetched. */
+	struct build_item ring[PREFETCH_DISTANCE];
+	size_t head;
+	size_t tail;
+};
+
+static void
+sp_init(struct slot_pipeline *sp, const struct h64 *h,
+	const struct h64 *other)
+{
+	memset(sp, 0, sizeof(*sp));
+	sp->h = h;
+	sp->other = other;
+	sp->same_hash = h->hasher == other->hasher && h->seed == other->seed;
+}
+
+static bool
+sp_read(struct slot_pipeline *sp, struct build_item *item)
+{
+	const struct h64 *h = sp->h;
+	const struct h64 *other = sp->other;
+	size_t count = h64_internal_groups_count(h);
+	while (sp->status == 0) {
+		if (sp->next == count)
+			return false;
+		size_t i = sp->next++;
+		size_t ahead = i + H64_INTERNAL_ITERATOR_PREFETCH;
+		if (ahead < count)
+			__builtin_prefetch(h64_internal_group(h, ahead));
+		if (ahead < other->size_in_groups)
+			__builtin_prefetch(&other->groups[ahead]);
+		bool old = i >= h->size_in_groups;
+		sp->groups = old ? h->old_groups : h->groups;
+		sp->hashes = old ? h->old_hashes : h->hashes;
+		sp->position = old ? i - h->size_in_groups : i;
+		const struct h64_group *group = &sp->groups[sp->position];
+		sp->status = group->status & ENTRIES_MASK;
+		if (sp->status != 0 && !old && i < other->size_in_groups &&
+		    memcmp(group, &other->groups[i], sizeof(*group)) == 0)
+			sp->status = 0;
+	}
+
+	size_t idx = __builtin_ctz(sp->status);
+	sp->status &= sp->status - 1;
+	void *entry = sp->groups[sp->position].entries[idx];
+	uint64_t hash = sp->same_hash ?
+			h64_slot_hash(h, sp->groups, sp->hashes,
+				      sp->position, idx) :
+			h64_hash(other, entry);
+	*item = (struct build_item){ entry, hash };
+	return true;
+}
+
+/* Next entry with its hash for the other table, false at the end. */
+static bool
+sp_pop(struct slot_pipeline *sp, struct build_item *item)
+{
+	struct build_item next;
+	while (sp->tail - sp->head < PREFETCH_DISTANCE && sp_read(sp, &next)) {
+		h64_prefetch_group(sp->other, next.hash);
+		sp->ring[sp->tail++ % PREFETCH_DISTANCE] = next;
+	}
+	if (sp->head == sp->tail)
+		return false;
+	*item = sp->ring[sp->head++ % PREFETCH_DISTANCE];
+	return true;
+}
+
+void
+h64_merge(struct h64 *dst, const struct h64 *src)
+{
+	assert(dst != src && "Can't merge a table into itself.");
+	struct slot_pipeline sp;
+	sp_init(&sp, src, dst);
+	struct build_item item;
+	while (sp_pop(&sp, &item))
+		h64_do_insert(dst, item.entry, item.hash);
+}
+
+static void *
+h64_find_item(const struct h64 *h, const struct build_item *item)
+{
+	struct find_result result;
+	h64_find_entry(h, item->entry, item->hash, &result);
+	return result.found ? result.group->entries[result.index] : NULL;
+}
+
+size_t
+h64_diff(const struct h64 *from, const struct h64 *to,
+	 void (*cb)(void *from_entry, void *to_entry, void *ctx), void *ctx)
+{
+	size_t count = 0;
+	struct slot_pipeline sp;
+	struct build_item item;
+	sp_init(&sp, from, to);
+	while (sp_pop(&sp, &item)) {
+		void *found = h64_find_item(to, &item);
+		if (found == item.entry)
+			continue;
+		count += 1;
+		if (cb != NULL)
+			cb(item.entry, found, ctx);
+	}
+	sp_init(&sp, to, from);
+	while (sp_pop(&sp, &item)) {
+		if (h64_find_item(from, &item) != NULL)
+			continue;
+		count += 1;
+		if (cb != NULL)
+			cb(NULL, item.entry, ctx);
+	}
+	return count;
+}
+
+void
+h64_stats(const struct h64 *h, struct h64_stats *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->count = h->count;
+	out->capacity = h->size_in_groups * GROUP_ENTRIES;
+	out->load_factor = h64_load_factor(h);
+	out->memory_bytes = sizeof(*h) + groups_bytes(h->size_in_groups) +
+			    groups_bytes(h->old_size_in_groups);
+	if (h->hashes != NULL)
+		out->memory_bytes += hashes_bytes(h->size_in_groups);
+	if (h->old_hashes != NULL)
+		out->memory_bytes += hashes_bytes(h->old_size_in_groups);
+	if (h->filter != NULL)
+		out->memory_bytes += filter_bytes(h->size_in_groups);
+	if (h->old_filter != NULL)
+		out->memory_bytes += filter_bytes(h->old_size_in_groups);
+	if (h->clock != NULL)
+		out->memory_bytes += clock_bytes(h->size_in_groups);
+	if (h->cleanup != NULL)
+		out->memory_bytes += cleanup_bytes(h->size_in_groups);
+	out->was_full_groups = h->was_full_groups;
+	/* Geometric, every probed group has the bit with the same chance. */
+	double was_full = (double)h->was_full_groups / h->size_in_groups;
+	out->expected_miss_probes = was_full < 1 ?
+		MIN(1 / (1 - was_full), (double)h->size_in_groups) :
+		(double)h->size_in_groups;
+
+	const struct h64_counters *counters = h->counters;
+	if (counters == NULL)
+		return;
+	out->memory_bytes += sizeof(*counters);
+	out->sample_shift = __builtin_popcount(counters->sample_mask);
+	for (size_t i = 0; i < H64_STATS_PROBE_BUCKETS; ++i) {
+		out->lookup_probes[i] = __atomic_load_n(
+			&counters->lookup_probes[i], __ATOMIC_RELAXED);
+		out->place_probes[i] = __atomic_load_n(
+			&counters->place_probes[i], __ATOMIC_RELAXED);
+	}
+	out->hint_matches = __atomic_load_n(&counters->hint_matches,
+					    __ATOMIC_RELAXED);
+	out->hint_false_positives = __atomic_load_n(
+		&counters->hint_false_positives, __ATOMIC_RELAXED);
+	out->filter_rejects = __atomic_load_n(&counters->filter_rejects,
+					      __ATOMIC_RELAXED);
+	out->resizes = __atomic_load_n(&counters->resizes, __ATOMIC_RELAXED);
+	out->resize_ns = __atomic_load_n(&counters->resize_ns,
+					 __ATOMIC_RELAXED);
+}
+
+void
+h64_stats_reset(struct h64 *h)
+{
+	struct h64_counters *counters = h->counters;
+	if (counters == NULL)
+		return;
+	uint8_t sample_mask = counters->sample_mask;
+	memset(counters, 0, sizeof(*counters));
+	counters->sample_mask = sample_mask;
+}
@@ -0,0 +1,370 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sched.h>
+
+#include "utils.h"
+#include "h64_group.h"
+#include "h64/h64.h"
+#include "h64/h64_concurrent.h"
+
+enum {
+	L1CACHE_LINE_SIZE = 64,
+};
+
+/* Array of groups as seen by readers. */
+struct h64_view {
+	struct h64_group *groups;
+	size_t size_in_groups;
+};
+
+/* Memory freed by the writer, which readers may still access. */
+struct retired {
+	struct retired *next;
+	/* Can be freed when every reader is outside or past the epoch. */
+	uint64_t epoch;
+	void *ptr;
+	/* Size for the table allocator, 0 for views allocated by malloc. */
+	size_t size;
+};
+
+struct h64_reader {
+	/*
+	 * Epoch the reader entered its section at, 0 outside of sections.
+	 * The only memory a reader writes, so it owns the cache line.
+	 */
+	uint64_t epoch __attribute__((aligned(L1CACHE_LINE_SIZE)));
+	const struct h64_concurrent *hc;
+	struct h64_reader *next;
+	bool registered;
+};
+
+struct h64_concurrent {
+	/* Read-mostly part, changed only on resizing. */
+	struct h64_view *view;
+	uint64_t epoch;
+	h64_hasher_f hasher;
+	h64_equals_f equals;
+	uint64_t seed;
+	/* Block shift of the probe sequences of the writer table. */
+	unsigned block_shift;
+
+	/* The writer part. */
+	struct h64 *table __attribute__((aligned(L1CACHE_LINE_SIZE)));
+	/* Allocator of the user, the table allocates through defer_*. */
+	struct h64_allocator allocator;
+	/* Retired memory, which is not tagged with an epoch yet. */
+	struct retired *pending;
+	/* Retired memory waiting for readers. */
+	struct retired *retired;
+	/* Registered readers, pushed by readers and scanned by the writer. */
+	struct h64_reader *readers;
+	size_t count;
+};
+
+static void *
+defer_alloc(void *ctx, size_t size, size_t alignment)
+{
+	struct h64_concurrent *hc = ctx;
+	return hc->allocator.alloc(hc->allocator.ctx, size, alignment);
+}
+
+/* Groups freed by the table are retired instead until readers leave. */
+static void
+defer_free(void *ctx, void *ptr, size_t size)
+{
+	struct h64_concurrent *hc = ctx;
+	struct retired *r = xcalloc(1, sizeof(*r));
+	r->ptr = ptr;
+	r->size = size;
+	r->next = hc->pending;
+	hc->pending = r;
+}
+
+static void
+retired_free(struct h64_concurrent *hc, struct retired *r)
+{
+	if (r->size == 0)
+		free(r->ptr);
+	else
+		hc->allocator.free(hc->allocator.ctx, r->ptr, r->size);
+	free(r);
+}
+
+/* The oldest epoch a reader can be in, UINT64_MAX if there are none. */
+static uint64_t
+min_reader_epoch(const struct h64_concurrent *hc)
+{
+	/* Pairs with the fence in h64_read_enter. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	uint64_t min = UINT64_MAX;
+	struct h64_reader *r = __atomic_load_n(&hc->readers, __ATOMIC_ACQUIRE);
+	for (; r != NULL; r = r->next) {
+		uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+		if (epoch != 0 && epoch < min)
+			min = epoch;
+	}
+	return min;
+}
+
+/* Free retired memory no reader can access anymore. */
+static void
+h64_concurrent_reclaim(struct h64_concurrent *hc)
+{
+	if (hc->retired == NULL)
+		return;
+
+	uint64_t min = min_reader_epoch(hc);
+	struct retired **link = &hc->retired;
+	while (*link != NULL) {
+		struct retired *r = *link;
+		if (r->epoch <= min) {
+			*link = r->next;
+			retired_free(hc, r);
+		} else {
+			link = &r->next;
+		}
+	}
+}
+
+/*
+ * Make the table state visible to readers after a writer operation:
+ * publish the new array if the table was resized and retire the old one.
+ */
+static void
+h64_concurrent_publish(struct h64_concurrent *hc)
+{
+	__atomic_store_n(&hc->count, hc->table->count, __ATOMIC_RELAXED);
+	struct h64_view *view = hc->view;
+	if (likely(view->groups == hc->table->groups))
+		return;
+
+	struct h64_view *new_view = xcalloc(1, sizeof(*new_view));
+	new_view->groups = hc->table->groups;
+	new_view->size_in_groups = hc->table->size_in_groups;
+	__atomic_store_n(&hc->view, new_view, __ATOMIC_RELEASE);
+	defer_free(hc, view, 0);
+
+	/*
+	 * Readers entering the new epoch see the new view. The retired
+	 * memory waits for readers which entered before.
+	 */
+	uint64_t epoch = __atomic_add_fetch(&hc->epoch, 1, __ATOMIC_SEQ_CST);
+	while (hc->pending != NULL) {
+		struct retired *r = hc->pending;
+		hc->pending = r->next;
+		r->epoch = epoch;
+		r->next = hc->retired;
+		hc->retired = r;
+	}
+	h64_concurrent_reclaim(hc);
+}
+
+struct h64_concurrent *
+h64_concurrent_create(const struct h64_options *options)
+{
+	assert(!(options->flags & H64_INCREMENTAL_RESIZE) &&
+	       "Readers can't probe two arrays.");
+	assert(!(options->flags & H64_MISS_FILTER) &&
+	       "Readers don't keep up with the filter.");
+	assert(!(options->flags & H64_EVICT) &&
+	       "Evictions aren't reclaimed for readers.");
+
+	struct h64_concurrent *hc = aligned_xalloc(L1CACHE_LINE_SIZE,
+						   sizeof(*hc));
+	memset(hc, 0, sizeof(*hc));
+	hc->epoch = 1;
+	hc->table = h64_create_ex(options);
+	/* Keep the allocator of the table to free memory by it later. */
+	hc->allocator = hc->table->allocator;
+	hc->table->allocator.alloc = defer_alloc;
+	hc->table->allocator.free = defer_free;
+	hc->table->allocator.ctx = hc;
+	hc->hasher = hc->table->hasher;
+	hc->equals = hc->table->equals;
+	hc->seed = hc->table->seed;
+	hc->block_shift = (hc->table->flags & H64_WIDE_PROBING) ?
+			  WIDE_PROBE_SHIFT : 0;
+
+	hc->view = xcalloc(1, sizeof(*hc->view));
+	hc->view->groups = hc->table->groups;
+	hc->view->size_in_groups = hc->table->size_in_groups;
+	return hc;
+}
+
+void
+h64_concurrent_destroy(struct h64_concurrent *hc)
+{
+	h64_destroy(hc->table);
+	defer_free(hc, hc->view, 0);
+	while (hc->pending != NULL) {
+		struct retired *r = hc->pending;
+		hc->pending = r->next;
+		retired_free(hc, r);
+	}
+	while (hc->retired != NULL) {
+		struct retired *r = hc->retired;
+		hc->retired = r->next;
+		retired_free(hc, r);
+	}
+	while (hc->readers != NULL) {
+		struct h64_reader *r = hc->readers;
+		hc->readers = r->next;
+		free(r);
+	}
+	free(hc);
+}
+
+void
+h64_concurrent_insert(struct h64_concurrent *hc, void *entry)
+{
+	h64_insert(hc->table, entry);
+	h64_concurrent_publish(hc);
+}
+
+void
+h64_concurrent_insert_batch(struct h64_concurrent *hc, void **entries,
+			    size_t n)
+{
+	h64_insert_batch(hc->table, entries, n);
+	h64_concurrent_publish(hc);
+}
+
+void *
+h64_concurrent_erase(struct h64_concurrent *hc, const void *entry)
+{
+	void *ret = h64_erase(hc->table, entry);
+	h64_concurrent_publish(hc);
+	return ret;
+}
+
+void
+h64_concurrent_reserve(struct h64_concurrent *hc, size_t size)
+{
+	h64_reserve(hc->table, size);
+	h64_concurrent_publish(hc);
+}
+
+void
+h64_concurrent_synchronize(struct h64_concurrent *hc)
+{
+	uint64_t epoch = __atomic_add_fetch(&hc->epoch, 1, __ATOMIC_SEQ_CST);
+	while (min_reader_epoch(hc) < epoch)
+		sched_yield();
+	h64_concurrent_reclaim(hc);
+}
+
+size_t
+h64_concurrent_count(const struct h64_concurrent *hc)
+{
+	return __atomic_load_n(&hc->count, __ATOMIC_RELAXED);
+}
+
+struct h64_reader *
+h64_reader_register(struct h64_concurrent *hc)
+{
+	struct h64_reader *r = aligned_xalloc(L1CACHE_LINE_SIZE, sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->hc = hc;
+	r->registered = true;
+	r->next = __atomic_load_n(&hc->readers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&hc->readers, &r->next, r, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+	return r;
+}
+
+/* The reader stays in the list until the table is destroyed. */
+void
+h64_reader_unregister(struct h64_reader *reader)
+{
+	assert(reader->epoch == 0 && "Reader must be outside of a section.");
+	reader->registered = false;
+}
+
+void
+h64_read_enter(struct h64_reader *reader)
+{
+	assert(reader->registered && reader->epoch == 0);
+	uint64_t epoch = __atomic_load_n(&reader->hc->epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&reader->epoch, epoch, __ATOMIC_RELAXED);
+	/*
+	 * Either the writer sees the epoch of the reader, or the reader sees
+	 * the view the writer published before looking at readers.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+h64_read_exit(struct h64_reader *reader)
+{
+	assert(reader->epoch != 0 && "Reader must be inside a section.");
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void *
+h64_concurrent_find(const struct h64_concurrent *hc, const void *entry)
+{
+	const struct h64_view *view = __atomic_load_n(&hc->view,
+						      __ATOMIC_ACQUIRE);
+	uint64_t hash = hc->hasher(entry, hc->seed);
+	uint8_t hint = hash_hint(hash);
+	struct probe_sequence seq;
+	ps_init(&seq, hash, view->size_in_groups, hc->block_shift);
+
+	while (true) {
+		struct h64_group *group = &view->groups[ps_position(&seq)];
+		/* Entries of set bits are published before the status. */
+		uint8_t status = __atomic_load_n(&group->status,
+						 __ATOMIC_ACQUIRE);
+		uint8_t match_byte = group_match_concurrent(group, status,
+							    hint);
+		while (match_byte != 0) {
+			size_t idx = __builtin_ctz(match_byte);
+			/* The entry may be erased since the status load. */
+			void *candidate = __atomic_load_n(&group->entries[idx],
+							  __ATOMIC_ACQUIRE);
+			if (candidate != NULL && hc->equals(entry, candidate))
+				return candidate;
+			match_byte &= match_byte - 1;
+		}
+
+		if (likely(!(status >> (CHAR_BIT - 1))))
+			return NULL;
+
+		ps_next(&seq);
+	}
+}
+
+void *
+h64_reader_find(const struct h64_reader *reader, const void *entry)
+{
+	return h64_concurrent_find(reader->hc, entry);
+}
@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "h64/h64.h"
+
+struct thread_task {
+	pthread_t thread;
+	void (*task)(void *arg, size_t i);
+	void *arg;
+	size_t i;
+	bool started;
+};
+
+static void *
+thread_task_main(void *ptr)
+{
+	struct thread_task *t = ptr;
+	t->task(t->arg, t->i);
+	return NULL;
+}
+
+/*
+ * The first task runs on the calling thread. A task which didn't get
+ * a thread runs there too, after the first one.
+ */
+static void
+thread_executor_run(void *ctx, void (*task)(void *arg, size_t i), void *arg,
+		    size_t ntasks)
+{
+	(void)ctx;
+	if (ntasks == 0)
+		return;
+
+	struct thread_task *tasks = xcalloc(ntasks, sizeof(*tasks));
+	for (size_t i = 1; i < ntasks; ++i) {
+		struct thread_task *t = &tasks[i];
+		t->task = task;
+		t->arg = arg;
+		t->i = i;
+		t->started = pthread_create(&t->thread, NULL,
+					    thread_task_main, t) == 0;
+	}
+	task(arg, 0);
+	for (size_t i = 1; i < ntasks; ++i) {
+		if (tasks[i].started)
+			pthread_join(tasks[i].thread, NULL);
+		else
+			task(arg, i);
+	}
+	free(tasks);
+}
+
+struct h64_executor
+h64_thread_executor(size_t threads)
+{
+	assert(threads > 0 && "Need at least one thread.");
+	struct h64_executor executor = {
+		.run = thread_executor_run,
+		.ctx = NULL,
+		.threads = threads,
+	};
+	return executor;
+}
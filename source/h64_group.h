@@ -0,0 +1,248 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Operations on a single group and the probing sequence over groups,
+ * shared by all the table flavors.
+ *
+ * Groups are modified in an order which is safe for lock-free readers
+ * (see h64_concurrent.h): an entry and its hint are written before the
+ * status bit that makes them visible, and the status bit of an erased
+ * entry is cleared before the entry. The stores are release stores,
+ * that's a plain store on x86, so single-threaded tables pay nothing.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <assert.h>
+
+#include <string.h>
+
+#include "h64/h64.h"
+
+/*
+ * Hints are matched with the SIMD instructions every CPU of the target
+ * architecture has, SSE2 on x86-64 and NEON on aarch64, or with 64-bit
+ * integer arithmetic elsewhere. Wider instruction sets are used by the
+ * runtime dispatched kernels in h64_kernels.h for long probe sequences.
+ */
+#if defined(__SSE2__) && !defined(H64_NO_SIMD)
+#define H64_GROUP_MATCH_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(H64_NO_SIMD)
+#define H64_GROUP_MATCH_NEON 1
+#include <arm_neon.h>
+#else
+#define H64_GROUP_MATCH_SWAR 1
+#endif
+
+enum {
+	GROUP_ENTRIES = H64_INTERNAL_GROUP_ENTRIES,
+	ENTRIES_MASK = 0x7F,
+};
+
+/* CLOCK state of a group of a H64_EVICT table. */
+struct h64_clock {
+	/* Slots found by lookups since the hand passed them. */
+	uint8_t referenced;
+	/* Slot to evict next, unless it's referenced. */
+	uint8_t hand;
+};
+
+static inline int
+group_was_full(const struct h64_group *group)
+{
+	return group->status >> (CHAR_BIT - 1);
+}
+
+static inline int
+group_is_full(const struct h64_group *group)
+{
+	return (group->status & ENTRIES_MASK) == ENTRIES_MASK;
+}
+
+static inline void
+group_insert(struct h64_group *group, void *entry, uint8_t hint, size_t idx)
+{
+	assert(idx < GROUP_ENTRIES);
+	assert(group->entries[idx] == NULL);
+	assert(((group->status >> idx) & 0x1) == 0);
+	/*
+	 * Release: a reader of the status before an erase of the slot may
+	 * load the new entry, so it must be published by the entry itself.
+	 */
+	__atomic_store_n(&group->entries[idx], entry, __ATOMIC_RELEASE);
+	__atomic_store_n(&group->hints[idx], hint, __ATOMIC_RELAXED);
+	uint8_t status = group->status | 0x1 << idx;
+	if ((status & ENTRIES_MASK) == ENTRIES_MASK)
+		status = 0xFF;
+	__atomic_store_n(&group->status, status, __ATOMIC_RELEASE);
+}
+
+static inline void
+group_update(struct h64_group *group, void *entry, size_t idx)
+{
+	assert(idx < GROUP_ENTRIES);
+	assert(((group->status >> idx) & 0x1) == 1);
+	__atomic_store_n(&group->entries[idx], entry, __ATOMIC_RELEASE);
+}
+
+static inline void *
+group_erase_entry(struct h64_group* group, size_t idx)
+{
+	assert(idx < GROUP_ENTRIES);
+	void *entry = group->entries[idx];
+	__atomic_store_n(&group->status, group->status & ~(0x1 << idx),
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&group->entries[idx], NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&group->hints[idx], 0, __ATOMIC_RELAXED);
+	return entry;
+}
+
+static inline uint8_t
+hash_hint(uint64_t hash)
+{
+	/* Leftmost byte. */
+	return hash >> (CHAR_BIT * 7);
+}
+
+/**
+ * Quadratic probing sequence.
+ * It assumes that hash table size is power of 2, so I can substitute mod with
+ * using a mask, and stepping formula step[i] = start + (i^2 + i) / 2 guarantees
+ * that every group will be traversed only once.
+ *
+ * With a block shift the sequence steps quadratically over blocks of
+ * 2^shift adjacent groups and linearly inside a block:
+ * step[i] = start + ((j^2 + j) / 2 << shift) + i % 2^shift, j = i >> shift.
+ * The first two blocks are adjacent, so the first 2^(shift + 1) groups
+ * are probed linearly. Every group is still traversed only once when the
+ * table has at least 2^shift groups.
+ */
+struct probe_sequence {
+	size_t start;
+	size_t iteration;
+	size_t size_mask;
+	unsigned block_shift;
+};
+
+/* Block shift of H64_WIDE_PROBING tables: the widest window, 4 groups. */
+enum { WIDE_PROBE_SHIFT = 2 };
+
+static inline void
+ps_init(struct probe_sequence *ps, uint64_t hash, size_t size,
+	unsigned block_shift)
+{
+	ps->size_mask = size - 1;
+	ps->iteration = 0;
+	ps->start = hash & ps->size_mask;
+	ps->block_shift = block_shift;
+}
+
+static inline void
+ps_next(struct probe_sequence *ps)
+{
+	ps->iteration += 1;
+}
+
+static inline size_t
+ps_position(const struct probe_sequence *ps)
+{
+	size_t s = ps->start;
+	size_t shift = ps->block_shift;
+	size_t j = ps->iteration >> shift;
+	size_t i = ps->iteration & ((1u << shift) - 1);
+	size_t mask = ps->size_mask;
+	return (s + (j * (j + 1) / 2 << shift) + i) & mask;
+}
+
+/* Byte i of the mask has its top bit set, to bit i of the result. */
+static inline uint8_t
+byte_mask_bits(uint64_t mask)
+{
+	return ((mask & 0x8080808080808080ull) * 0x0002040810204081ull) >> 56;
+}
+
+/*
+ * group_match with 64-bit integer arithmetic, for targets without SIMD
+ * and for the "swar" kernel of the others.
+ */
+static inline uint8_t
+group_match_swar(const struct h64_group *group, uint8_t status, uint8_t hint)
+{
+	/* Status and hints make the first word, zero bytes are matches. */
+	const uint64_t low7 = 0x7F7F7F7F7F7F7F7Full;
+	uint64_t word;
+	memcpy(&word, group, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	uint64_t diff = word ^ (0x0101010101010101ull * hint);
+	uint64_t zero = ~(((diff & low7) + low7) | diff | low7);
+	return (byte_mask_bits(zero) >> 1) & status & ENTRIES_MASK;
+}
+
+/* Bitmask of present entries with the hint among the status bits. */
+static inline uint8_t
+group_match(const struct h64_group *group, uint8_t status, uint8_t hint)
+{
+#if defined(H64_GROUP_MATCH_SSE2)
+	__m128i hints = _mm_loadu_si128((const __m128i *)group->hints);
+	__m128i target = _mm_set1_epi8(hint);
+	__m128i match = _mm_cmpeq_epi8(target, hints);
+	return _mm_movemask_epi8(match) & status & ENTRIES_MASK;
+#elif defined(H64_GROUP_MATCH_NEON)
+	uint8x8_t hints = vld1_u8(group->hints);
+	uint8x8_t match = vceq_u8(hints, vdup_n_u8(hint));
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(match), 0);
+	return byte_mask_bits(mask) & status & ENTRIES_MASK;
+#else
+	return group_match_swar(group, status, hint);
+#endif
+}
+
+/*
+ * group_match for readers of a group the writer changes concurrently,
+ * with the hints read by relaxed atomic loads.
+ */
+static inline uint8_t
+group_match_concurrent(const struct h64_group *group, uint8_t status,
+		       uint8_t hint)
+{
+	uint8_t match = 0;
+	for (size_t i = 0; i < GROUP_ENTRIES; ++i) {
+		uint8_t h = __atomic_load_n(&group->hints[i], __ATOMIC_RELAXED);
+		match |= (uint8_t)(h == hint) << i;
+	}
+	return match & status & ENTRIES_MASK;
+}
+
+static inline uint8_t
+group_match_inserted(const struct h64_group* group, uint8_t hint)
+{
+	return group_match(group, group->status, hint);
+}
@@ -0,0 +1,349 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "h64/h64_hash.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(H64_NO_SIMD)
+#define H64_HASH_X86 1
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32) && !defined(H64_NO_SIMD)
+#define H64_HASH_ARM 1
+#include <arm_acle.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+enum {
+	/* Reflected polynomial of CRC32-C. */
+	CRC32C_POLY = 0x82F63B78,
+	/* Reads within a page this small never fault. */
+	MIN_PAGE_SIZE = 4096,
+};
+
+typedef uint64_t unaligned_u64 __attribute__((aligned(1), may_alias));
+
+/* Little-endian word of 8 bytes at p. */
+static ALWAYS_INLINE uint64_t
+load_word(const void *p)
+{
+	uint64_t word = *(const unaligned_u64 *)p;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+static ALWAYS_INLINE uint32_t
+load_half(const void *p)
+{
+	uint32_t half;
+	memcpy(&half, p, sizeof(half));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	half = __builtin_bswap32(half);
+#endif
+	return half;
+}
+
+/*
+ * Little-endian word of the last 0 < n < 8 bytes at p, zero padded. The
+ * loads overlap rather than loop over the bytes: len is the length of
+ * the whole key, so a key of 8 bytes or more is read from its end.
+ */
+static ALWAYS_INLINE uint64_t
+load_tail(const unsigned char *p, size_t n, size_t len)
+{
+	if (len >= 8)
+		return load_word(p + n - 8) >> ((8 - n) * 8);
+	if (n >= 4)
+		return load_half(p) |
+		       ((uint64_t)load_half(p + n - 4) << ((n - 4) * 8));
+	return p[0] | ((uint64_t)p[n / 2] << (n / 2 * 8)) |
+	       ((uint64_t)p[n - 1] << ((n - 1) * 8));
+}
+
+typedef uint32_t (*crc_step_f)(uint32_t crc, uint64_t word);
+
+/*
+ * Words go to two chains of CRCs in turn, so the latency of one step
+ * overlaps with the next. Both the chains and the length are mixed at
+ * the end, CRCs alone are linear.
+ */
+struct crc_state {
+	uint32_t crc[2];
+};
+
+static ALWAYS_INLINE void
+crc_init(struct crc_state *state, uint64_t seed)
+{
+	state->crc[0] = (uint32_t)seed;
+	state->crc[1] = (uint32_t)(seed >> 32);
+}
+
+/* Add the word to the first chain, the next one goes to the other. */
+static ALWAYS_INLINE void
+crc_add(struct crc_state *state, uint64_t word, crc_step_f step)
+{
+	uint32_t crc = step(state->crc[0], word);
+	state->crc[0] = state->crc[1];
+	state->crc[1] = crc;
+}
+
+static ALWAYS_INLINE uint64_t
+crc_finish(const struct crc_state *state, size_t len, uint64_t seed)
+{
+	uint64_t crcs = ((uint64_t)state->crc[0] << 32) | state->crc[1];
+	return h64_mix64(crcs ^ seed ^ (len * 0x9E3779B97F4A7C15ull));
+}
+
+static ALWAYS_INLINE uint64_t
+crc_bytes(const void *key, size_t len, uint64_t seed, crc_step_f step)
+{
+	const unsigned char *p = key;
+	struct crc_state state;
+	crc_init(&state, seed);
+	size_t n = len;
+	for (; n >= 16; n -= 16, p += 16) {
+		crc_add(&state, load_word(p), step);
+		crc_add(&state, load_word(p + 8), step);
+	}
+	if (n >= 8) {
+		crc_add(&state, load_word(p), step);
+		n -= 8;
+		p += 8;
+	}
+	if (n > 0)
+		crc_add(&state, load_tail(p, n, len), step);
+	return crc_finish(&state, len, seed);
+}
+
+/*
+ * Words are read whole while they are within a page, the NUL is found
+ * among their bytes with the bit trick of strlen. The bytes past the NUL
+ * read with it are what asan would complain about.
+ */
+static ALWAYS_INLINE NO_SANITIZE_ADDRESS uint64_t
+crc_str(const char *str, uint64_t seed, crc_step_f step)
+{
+	const uint64_t ones = 0x0101010101010101ull;
+	const uint64_t highs = 0x8080808080808080ull;
+	const unsigned char *p = (const unsigned char *)str;
+	struct crc_state state;
+	crc_init(&state, seed);
+	size_t len = 0;
+	while (true) {
+		uint64_t word;
+		if (likely(((uintptr_t)p & (MIN_PAGE_SIZE - 1)) <=
+			   MIN_PAGE_SIZE - sizeof(word))) {
+			word = load_word(p);
+		} else {
+			word = 0;
+			for (size_t i = 0; i < sizeof(word) && p[i] != 0; ++i)
+				word |= (uint64_t)p[i] << (i * 8);
+		}
+		uint64_t zeros = (word - ones) & ~word & highs;
+		if (zeros == 0) {
+			crc_add(&state, word, step);
+			len += sizeof(word);
+			p += sizeof(word);
+			continue;
+		}
+		/* The lowest bit is exact, the rest may be borrows. */
+		size_t n = __builtin_ctzll(zeros) / 8;
+		if (n > 0)
+			crc_add(&state, word & ((1ull << (n * 8)) - 1), step);
+		return crc_finish(&state, len + n, seed);
+	}
+}
+
+/* Slicing by 8: crc_table[k][b] is the CRC of b followed by k zeros. */
+static uint32_t crc_table[8][256];
+
+static void
+crc_table_init(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; ++k)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crc_table[0][i] = crc;
+	}
+	for (int k = 1; k < 8; ++k)
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t prev = crc_table[k - 1][i];
+			crc_table[k][i] = (prev >> 8) ^ crc_table[0][prev & 0xFF];
+		}
+}
+
+static ALWAYS_INLINE uint32_t
+crc_step_soft(uint32_t crc, uint64_t word)
+{
+	word ^= crc;
+	return crc_table[7][word & 0xFF] ^
+	       crc_table[6][(word >> 8) & 0xFF] ^
+	       crc_table[5][(word >> 16) & 0xFF] ^
+	       crc_table[4][(word >> 24) & 0xFF] ^
+	       crc_table[3][(word >> 32) & 0xFF] ^
+	       crc_table[2][(word >> 40) & 0xFF] ^
+	       crc_table[1][(word >> 48) & 0xFF] ^
+	       crc_table[0][word >> 56];
+}
+
+static uint64_t
+crc_bytes_soft(const void *key, size_t len, uint64_t seed)
+{
+	return crc_bytes(key, len, seed, crc_step_soft);
+}
+
+static NO_SANITIZE_ADDRESS uint64_t
+crc_str_soft(const char *str, uint64_t seed)
+{
+	return crc_str(str, seed, crc_step_soft);
+}
+
+#if defined(H64_HASH_X86)
+
+__attribute__((target("sse4.2"))) static ALWAYS_INLINE uint32_t
+crc_step_sse42(uint32_t crc, uint64_t word)
+{
+	return (uint32_t)_mm_crc32_u64(crc, word);
+}
+
+__attribute__((target("sse4.2"))) static uint64_t
+crc_bytes_sse42(const void *key, size_t len, uint64_t seed)
+{
+	return crc_bytes(key, len, seed, crc_step_sse42);
+}
+
+__attribute__((target("sse4.2"))) static NO_SANITIZE_ADDRESS uint64_t
+crc_str_sse42(const char *str, uint64_t seed)
+{
+	return crc_str(str, seed, crc_step_sse42);
+}
+
+#elif defined(H64_HASH_ARM)
+
+static ALWAYS_INLINE uint32_t
+crc_step_armv8(uint32_t crc, uint64_t word)
+{
+	return __crc32cd(crc, word);
+}
+
+static uint64_t
+crc_bytes_armv8(const void *key, size_t len, uint64_t seed)
+{
+	return crc_bytes(key, len, seed, crc_step_armv8);
+}
+
+static NO_SANITIZE_ADDRESS uint64_t
+crc_str_armv8(const char *str, uint64_t seed)
+{
+	return crc_str(str, seed, crc_step_armv8);
+}
+
+#endif
+
+struct crc_impl {
+	const char *name;
+	uint64_t (*bytes)(const void *key, size_t len, uint64_t seed);
+	uint64_t (*str)(const char *str, uint64_t seed);
+};
+
+/* The best first, the software one is the last. */
+static const struct crc_impl crc_impls[] = {
+#if defined(H64_HASH_X86)
+	{"sse4.2", crc_bytes_sse42, crc_str_sse42},
+#elif defined(H64_HASH_ARM)
+	{"armv8", crc_bytes_armv8, crc_str_armv8},
+#endif
+	{"soft", crc_bytes_soft, crc_str_soft},
+};
+
+static const struct crc_impl *crc_selected;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void
+crc_select(void)
+{
+	size_t count = sizeof(crc_impls) / sizeof(crc_impls[0]);
+	const struct crc_impl *impl = &crc_impls[0];
+#if defined(H64_HASH_X86)
+	if (!__builtin_cpu_supports("sse4.2"))
+		impl = &crc_impls[count - 1];
+#endif
+	const char *name = getenv("H64_HASH");
+	if (name != NULL && strcmp(name, "soft") == 0)
+		impl = &crc_impls[count - 1];
+	if (impl == &crc_impls[count - 1])
+		crc_table_init();
+	__atomic_store_n(&crc_selected, impl, __ATOMIC_RELEASE);
+}
+
+static const struct crc_impl *
+crc_get(void)
+{
+	const struct crc_impl *impl = __atomic_load_n(&crc_selected,
+						      __ATOMIC_ACQUIRE);
+	if (unlikely(impl == NULL)) {
+		pthread_once(&crc_once, crc_select);
+		impl = crc_selected;
+	}
+	return impl;
+}
+
+uint64_t
+h64_crc_hash(const void *key, size_t len, uint64_t seed)
+{
+	return crc_get()->bytes(key, len, seed);
+}
+
+uint64_t
+h64_str_hash(const char *str, uint64_t seed)
+{
+	return crc_get()->str(str, seed);
+}
+
+uint64_t
+h64_str_hasher(const void *entry, uint64_t seed)
+{
+	return crc_get()->str(entry, seed);
+}
+
+const char *
+h64_hash_name(void)
+{
+	return crc_get()->name;
+}
@@ -0,0 +1,177 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "utils.h"
+#include "h64_group.h"
+#include "h64_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(H64_NO_SIMD)
+#define H64_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Lane of the group from the bitmask of its hint matches. */
+static inline uint64_t
+kernel_lane_of(const struct h64_group *group, unsigned matches)
+{
+	uint8_t status = group->status;
+	uint64_t lane = matches & status & ENTRIES_MASK;
+	lane |= status & KERNEL_WAS_FULL;
+	if ((status & ENTRIES_MASK) != ENTRIES_MASK)
+		lane |= KERNEL_NOT_FULL;
+	return lane;
+}
+
+static uint64_t
+match_baseline(struct h64_group *const *groups, uint8_t hint)
+{
+	const struct h64_group *group = groups[0];
+	return kernel_lane_of(group, group_match(group, group->status, hint));
+}
+
+static uint64_t
+match_swar(struct h64_group *const *groups, uint8_t hint)
+{
+	const struct h64_group *group = groups[0];
+	return kernel_lane_of(group,
+			      group_match_swar(group, group->status, hint));
+}
+
+#if defined(H64_KERNELS_X86)
+
+__attribute__((target("avx2"))) static uint64_t
+match_avx2(struct h64_group *const *groups, uint8_t hint)
+{
+	__m128i low = _mm_loadu_si128((const __m128i *)groups[0]->hints);
+	__m128i high = _mm_loadu_si128((const __m128i *)groups[1]->hints);
+	__m256i hints = _mm256_inserti128_si256(_mm256_castsi128_si256(low),
+						high, 1);
+	__m256i match = _mm256_cmpeq_epi8(hints, _mm256_set1_epi8(hint));
+	uint32_t mask = _mm256_movemask_epi8(match);
+	return kernel_lane_of(groups[0], mask & 0xFFFF) |
+	       kernel_lane_of(groups[1], mask >> 16) << KERNEL_LANE_BITS;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+match_avx512(struct h64_group *const *groups, uint8_t hint)
+{
+	__m512i hints = _mm512_castsi128_si512(
+		_mm_loadu_si128((const __m128i *)groups[0]->hints));
+	hints = _mm512_inserti32x4(hints,
+		_mm_loadu_si128((const __m128i *)groups[1]->hints), 1);
+	hints = _mm512_inserti32x4(hints,
+		_mm_loadu_si128((const __m128i *)groups[2]->hints), 2);
+	hints = _mm512_inserti32x4(hints,
+		_mm_loadu_si128((const __m128i *)groups[3]->hints), 3);
+	uint64_t mask = _mm512_cmpeq_epi8_mask(hints, _mm512_set1_epi8(hint));
+	uint64_t lanes = 0;
+	for (size_t i = 0; i < 4; ++i)
+		lanes |= kernel_lane_of(groups[i], kernel_lane(mask, i))
+			 << (KERNEL_LANE_BITS * i);
+	return lanes;
+}
+
+#endif
+
+static const struct h64_kernels kernels[] = {
+#if defined(H64_KERNELS_X86)
+	{"avx512", 4, match_avx512},
+	{"avx2", 2, match_avx2},
+#endif
+#if defined(H64_GROUP_MATCH_SSE2)
+	{"sse2", 1, match_baseline},
+#elif defined(H64_GROUP_MATCH_NEON)
+	{"neon", 1, match_baseline},
+#endif
+	/* Every target has it, so it's tested on SIMD ones too. */
+	{"swar", 1, match_swar},
+};
+
+static bool
+kernels_supported(const struct h64_kernels *k)
+{
+#if defined(H64_KERNELS_X86)
+	if (k->match == match_avx512)
+		return __builtin_cpu_supports("avx512f") &&
+		       __builtin_cpu_supports("avx512bw");
+	if (k->match == match_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	(void)k;
+	return true;
+}
+
+static const struct h64_kernels *
+kernels_select(void)
+{
+	size_t count = sizeof(kernels) / sizeof(kernels[0]);
+	const char *name = getenv("H64_KERNEL");
+	if (name != NULL) {
+		for (size_t i = 0; i < count; ++i) {
+			if (strcmp(kernels[i].name, name) != 0)
+				continue;
+			if (kernels_supported(&kernels[i]))
+				return &kernels[i];
+			fprintf(stderr, "h64: H64_KERNEL=%s is not supported "
+				"by the CPU, the best supported kernel is "
+				"used\n", name);
+			name = NULL;
+			break;
+		}
+		if (name != NULL)
+			fprintf(stderr, "h64: H64_KERNEL=%s is unknown, the "
+				"best supported kernel is used\n", name);
+	}
+	for (size_t i = 0; i < count; ++i)
+		if (kernels_supported(&kernels[i]))
+			return &kernels[i];
+	/* The baseline is always supported. */
+	return &kernels[count - 1];
+}
+
+const struct h64_kernels *
+h64_kernels_get(void)
+{
+	static const struct h64_kernels *selected;
+	const struct h64_kernels *k = __atomic_load_n(&selected,
+						      __ATOMIC_RELAXED);
+	if (unlikely(k == NULL)) {
+		/* Racing selections agree, so any of them may win. */
+		k = kernels_select();
+		__atomic_store_n(&selected, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+
+const char *
+h64_kernel_name(void)
+{
+	return h64_kernels_get()->name;
+}
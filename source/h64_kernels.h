@@ -0,0 +1,79 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ * Kernels matching a hint in a window of several groups at once, chosen
+ * for the CPU at runtime.
+ *
+ * A lookup matches its first group with group_match. Only when the group
+ * was full, the rest of the probe sequence is matched window by window:
+ * AVX2 compares the hints of two groups with one instruction and AVX-512
+ * of four, and the loads of a window's groups are issued together.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "h64/h64.h"
+
+enum {
+	KERNEL_MAX_WIDTH = 4,
+	/* Bits of a group in the result of a window match. */
+	KERNEL_LANE_BITS = 16,
+	/* Lane bit of a group which was full, above the matched slots. */
+	KERNEL_WAS_FULL = 1 << 7,
+	/* Lane bit of a group which has empty slots. */
+	KERNEL_NOT_FULL = 1 << 8,
+};
+
+/*
+ * Match the hint in the groups of the window. Lane i of the result, bits
+ * [KERNEL_LANE_BITS * i, KERNEL_LANE_BITS * (i + 1)), has the bitmask of
+ * present entries of groups[i] with the hint, KERNEL_WAS_FULL and
+ * KERNEL_NOT_FULL.
+ */
+typedef uint64_t (*window_match_f)(struct h64_group *const *groups,
+				   uint8_t hint);
+
+struct h64_kernels {
+	const char *name;
+	/* Number of groups matched by one call, up to KERNEL_MAX_WIDTH. */
+	size_t width;
+	window_match_f match;
+};
+
+/*
+ * The best kernels the CPU supports. The H64_KERNEL environment variable
+ * may name a narrower one for testing and benchmarking.
+ */
+const struct h64_kernels *
+h64_kernels_get(void);
+
+static inline unsigned
+kernel_lane(uint64_t lanes, size_t i)
+{
+	return (lanes >> (KERNEL_LANE_BITS * i)) & 0xFFFF;
+}
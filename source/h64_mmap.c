@@ -0,0 +1,202 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h64/h64.h"
+
+#ifdef H64_HAVE_LIBNUMA
+#include <numa.h>
+
+/* numa_alloc_onnode maps pages, zero filled and page aligned. */
+static void *
+numa_node_alloc(void *ctx, size_t size, size_t alignment)
+{
+	(void)alignment;
+	return numa_alloc_onnode(size, (int)(intptr_t)ctx);
+}
+
+static void
+numa_node_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	numa_free(ptr, size);
+}
+
+struct h64_allocator
+h64_numa_allocator(int node)
+{
+	if (numa_available() < 0)
+		return h64_mmap_allocator(0);
+	struct h64_allocator allocator = {
+		.alloc = numa_node_alloc,
+		.free = numa_node_free,
+		.ctx = (void *)(intptr_t)node,
+	};
+	return allocator;
+}
+
+#else /* !H64_HAVE_LIBNUMA */
+
+struct h64_allocator
+h64_numa_allocator(int node)
+{
+	(void)node;
+	return h64_mmap_allocator(0);
+}
+
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+enum {
+	HUGE_PAGE_2MB = 1 << 21,
+	HUGE_PAGE_1GB = 1 << 30,
+};
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static size_t
+roundup(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Size of the mapping. munmap needs the same size, so it's recomputed
+ * by mmap_free from the size of the allocation.
+ */
+static size_t
+mapping_size(unsigned flags, size_t size, size_t *page_size)
+{
+	*page_size = sysconf(_SC_PAGESIZE);
+	if ((flags & H64_MMAP_HUGETLB_1GB) && size >= HUGE_PAGE_1GB)
+		*page_size = HUGE_PAGE_1GB;
+	else if ((flags & (H64_MMAP_HUGETLB_1GB | H64_MMAP_HUGETLB_2MB)) &&
+		 size >= HUGE_PAGE_2MB)
+		*page_size = HUGE_PAGE_2MB;
+	return roundup(size, *page_size);
+}
+
+static void *
+mmap_anonymous(size_t size, int extra_flags)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void *
+mmap_alloc(void *ctx, size_t size, size_t alignment)
+{
+	unsigned flags = (uintptr_t)ctx;
+	size_t page_size;
+	size = mapping_size(flags, size, &page_size);
+	if (alignment > page_size)
+		return NULL;
+
+	void *ptr = NULL;
+#ifdef MAP_HUGETLB
+	if (page_size >= HUGE_PAGE_2MB) {
+		int log2_page = __builtin_ctzll(page_size);
+		ptr = mmap_anonymous(size, MAP_HUGETLB |
+					   (log2_page << MAP_HUGE_SHIFT));
+		/*
+		 * Huge pages may be not reserved. Then the mapping falls
+		 * back to regular pages, but the size is kept rounded to the
+		 * huge page for mmap_free.
+		 */
+		if (ptr != NULL)
+			return ptr;
+	}
+#endif
+	ptr = mmap_anonymous(size, 0);
+#ifdef MADV_HUGEPAGE
+	if (ptr != NULL && (flags & H64_MMAP_THP) && size >= HUGE_PAGE_2MB)
+		madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	return ptr;
+}
+
+static void
+mmap_free(void *ctx, void *ptr, size_t size)
+{
+	unsigned flags = (uintptr_t)ctx;
+	size_t page_size;
+	munmap(ptr, mapping_size(flags, size, &page_size));
+}
+
+struct h64_allocator
+h64_mmap_allocator(unsigned flags)
+{
+	struct h64_allocator allocator = {
+		.alloc = mmap_alloc,
+		.free = mmap_free,
+		.ctx = (void *)(uintptr_t)flags,
+	};
+	return allocator;
+}
+
+#else /* !(defined(__unix__) || defined(__APPLE__)) */
+
+static void *
+calloc_alloc(void *ctx, size_t size, size_t alignment)
+{
+	(void)ctx;
+	size = (size + alignment - 1) / alignment * alignment;
+	void *ptr = aligned_alloc(alignment, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+static void
+calloc_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+/* No mmap, the flags are ignored. */
+struct h64_allocator
+h64_mmap_allocator(unsigned flags)
+{
+	(void)flags;
+	struct h64_allocator allocator = {
+		.alloc = calloc_alloc,
+		.free = calloc_free,
+		.ctx = NULL,
+	};
+	return allocator;
+}
+
+#endif
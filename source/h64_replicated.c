@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For sched_getcpu. */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "h64/h64.h"
+#include "h64/h64_concurrent.h"
+#include "h64/h64_replicated.h"
+
+#ifdef H64_HAVE_LIBNUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+
+struct h64_replicated {
+	struct h64_concurrent **replicas;
+	size_t replicas_count;
+	/* Nodes to allocate on, the replica i is on nodes[i % nodes_count]. */
+	int *nodes;
+	size_t nodes_count;
+};
+
+/*
+ * Nodes the process may allocate memory on, node 0 without libnuma. Node
+ * ids may be sparse, and nodes without memory aren't allowed.
+ */
+static void
+numa_nodes(struct h64_replicated *hr)
+{
+#ifdef H64_HAVE_LIBNUMA
+	if (numa_available() >= 0) {
+		struct bitmask *allowed = numa_get_mems_allowed();
+		hr->nodes = xcalloc(numa_bitmask_weight(allowed) + 1,
+				    sizeof(*hr->nodes));
+		for (unsigned long node = 0; node < allowed->size; ++node)
+			if (numa_bitmask_isbitset(allowed, node))
+				hr->nodes[hr->nodes_count++] = (int)node;
+		numa_bitmask_free(allowed);
+		if (hr->nodes_count > 0)
+			return;
+		free(hr->nodes);
+	}
+#endif
+	hr->nodes = xcalloc(1, sizeof(*hr->nodes));
+	hr->nodes_count = 1;
+}
+
+/* Index of the node of the CPU the calling thread runs on in hr->nodes. */
+static size_t
+numa_current_node(const struct h64_replicated *hr)
+{
+#ifdef H64_HAVE_LIBNUMA
+	if (numa_available() >= 0) {
+		int cpu = sched_getcpu();
+		int node = cpu >= 0 ? numa_node_of_cpu(cpu) : -1;
+		for (size_t i = 0; i < hr->nodes_count; ++i)
+			if (hr->nodes[i] == node)
+				return i;
+	}
+#endif
+	(void)hr;
+	return 0;
+}
+
+struct h64_replicated *
+h64_replicated_create(const struct h64_options *options, size_t replicas)
+{
+	struct h64_replicated *hr = xcalloc(1, sizeof(*hr));
+	numa_nodes(hr);
+	hr->replicas_count = replicas != 0 ? replicas : hr->nodes_count;
+	hr->replicas = xcalloc(hr->replicas_count, sizeof(*hr->replicas));
+
+	/* One seed for all the replicas, so the hash of an entry is one. */
+	struct h64_options replica_options = *options;
+	if (replica_options.seed == 0)
+		replica_options.seed = mixer64((uint64_t)hr);
+	for (size_t i = 0; i < hr->replicas_count; ++i) {
+		struct h64_allocator allocator =
+			h64_numa_allocator(hr->nodes[i % hr->nodes_count]);
+		if (options->allocator == NULL)
+			replica_options.allocator = &allocator;
+		/* The table keeps a copy of the allocator. */
+		hr->replicas[i] = h64_concurrent_create(&replica_options);
+	}
+	return hr;
+}
+
+void
+h64_replicated_destroy(struct h64_replicated *hr)
+{
+	for (size_t i = 0; i < hr->replicas_count; ++i)
+		h64_concurrent_destroy(hr->replicas[i]);
+	free(hr->replicas);
+	free(hr->nodes);
+	free(hr);
+}
+
+void
+h64_replicated_insert(struct h64_replicated *hr, void *entry)
+{
+	for (size_t i = 0; i < hr->replicas_count; ++i)
+		h64_concurrent_insert(hr->replicas[i], entry);
+}
+
+void
+h64_replicated_insert_batch(struct h64_replicated *hr, void **entries,
+			    size_t n)
+{
+	for (size_t i = 0; i < hr->replicas_count; ++i)
+		h64_concurrent_insert_batch(hr->replicas[i], entries, n);
+}
+
+void *
+h64_replicated_erase(struct h64_replicated *hr, const void *entry)
+{
+	void *ret = h64_concurrent_erase(hr->replicas[0], entry);
+	for (size_t i = 1; i < hr->replicas_count; ++i) {
+		void *erased = h64_concurrent_erase(hr->replicas[i], entry);
+		assert(erased == ret && "Replicas diverged.");
+		(void)erased;
+	}
+	return ret;
+}
+
+void
+h64_replicated_reserve(struct h64_replicated *hr, size_t size)
+{
+	for (size_t i = 0; i < hr->replicas_count; ++i)
+		h64_concurrent_reserve(hr->replicas[i], size);
+}
+
+void
+h64_replicated_synchronize(struct h64_replicated *hr)
+{
+	for (size_t i = 0; i < hr->replicas_count; ++i)
+		h64_concurrent_synchronize(hr->replicas[i]);
+}
+
+size_t
+h64_replicated_count(const struct h64_replicated *hr)
+{
+	/* The last replica is the last one modified. */
+	return h64_concurrent_count(hr->replicas[hr->replicas_count - 1]);
+}
+
+size_t
+h64_replicated_replicas(const struct h64_replicated *hr)
+{
+	return hr->replicas_count;
+}
+
+struct h64_concurrent *
+h64_replicated_replica(struct h64_replicated *hr, size_t i)
+{
+	assert(i < hr->replicas_count);
+	return hr->replicas[i];
+}
+
+struct h64_reader *
+h64_replicated_reader_register(struct h64_replicated *hr)
+{
+	size_t replica = numa_current_node(hr) % hr->replicas_count;
+	return h64_reader_register(hr->replicas[replica]);
+}
@@ -0,0 +1,165 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "h64/h64.h"
+#include "h64/h64_sharded.h"
+
+enum {
+	L1CACHE_LINE_SIZE = 64,
+	/* Hints take the top byte of the hash, shards take the next bits. */
+	SHARD_SHIFT = CHAR_BIT * 7,
+};
+
+/* Lock and table pointer of a shard own a cache line. */
+struct shard {
+	pthread_mutex_t lock;
+	struct h64 *table;
+} __attribute__((aligned(L1CACHE_LINE_SIZE)));
+
+struct h64_sharded {
+	struct shard *shards;
+	size_t shards_count;
+	unsigned shard_bits;
+	/* Copies of the shard parameters to hash outside of the locks. */
+	h64_hasher_f hasher;
+	uint64_t seed;
+};
+
+struct h64_sharded *
+h64_sharded_create(const struct h64_options *options, size_t shards_count)
+{
+	assert(shards_count > 0 && is_power_of_2(shards_count) &&
+	       "Shards count must be a power of 2.");
+	assert(shards_count <= (1 << 16) && "Too many shards.");
+
+	struct h64_sharded *hs = xcalloc(1, sizeof(*hs));
+	hs->shards = aligned_xalloc(L1CACHE_LINE_SIZE,
+				    shards_count * sizeof(*hs->shards));
+	hs->shards_count = shards_count;
+	hs->shard_bits = __builtin_ctzll(shards_count);
+
+	/* One seed for all the shards lets a hash be routed and reused. */
+	struct h64_options shard_options = *options;
+	if (shard_options.seed == 0)
+		shard_options.seed = mixer64((uint64_t)hs);
+	hs->hasher = options->hasher;
+	hs->seed = shard_options.seed;
+	for (size_t i = 0; i < shards_count; ++i) {
+		pthread_mutex_init(&hs->shards[i].lock, NULL);
+		hs->shards[i].table = h64_create_ex(&shard_options);
+	}
+	return hs;
+}
+
+void
+h64_sharded_destroy(struct h64_sharded *hs)
+{
+	for (size_t i = 0; i < hs->shards_count; ++i) {
+		h64_destroy(hs->shards[i].table);
+		pthread_mutex_destroy(&hs->shards[i].lock);
+	}
+	free(hs->shards);
+	free(hs);
+}
+
+static struct shard *
+h64_sharded_route(const struct h64_sharded *hs, uint64_t hash)
+{
+	size_t idx = (hash >> (SHARD_SHIFT - hs->shard_bits)) &
+		     (hs->shards_count - 1);
+	return &hs->shards[idx];
+}
+
+void
+h64_sharded_insert(struct h64_sharded *hs, void *entry)
+{
+	uint64_t hash = hs->hasher(entry, hs->seed);
+	struct shard *shard = h64_sharded_route(hs, hash);
+	pthread_mutex_lock(&shard->lock);
+	h64_insert_hashed(shard->table, entry, hash);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void
+h64_sharded_insert_new(struct h64_sharded *hs, void *entry)
+{
+	uint64_t hash = hs->hasher(entry, hs->seed);
+	struct shard *shard = h64_sharded_route(hs, hash);
+	pthread_mutex_lock(&shard->lock);
+	h64_insert_new_hashed(shard->table, entry, hash);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void *
+h64_sharded_find(struct h64_sharded *hs, const void *entry)
+{
+	uint64_t hash = hs->hasher(entry, hs->seed);
+	struct shard *shard = h64_sharded_route(hs, hash);
+	pthread_mutex_lock(&shard->lock);
+	void *ret = h64_find_hashed(shard->table, entry, hash);
+	pthread_mutex_unlock(&shard->lock);
+	return ret;
+}
+
+void *
+h64_sharded_erase(struct h64_sharded *hs, const void *entry)
+{
+	uint64_t hash = hs->hasher(entry, hs->seed);
+	struct shard *shard = h64_sharded_route(hs, hash);
+	pthread_mutex_lock(&shard->lock);
+	void *ret = h64_erase_hashed(shard->table, entry, hash);
+	pthread_mutex_unlock(&shard->lock);
+	return ret;
+}
+
+size_t
+h64_sharded_count(struct h64_sharded *hs)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < hs->shards_count; ++i) {
+		pthread_mutex_lock(&hs->shards[i].lock);
+		count += h64_count(hs->shards[i].table);
+		pthread_mutex_unlock(&hs->shards[i].lock);
+	}
+	return count;
+}
+
+void
+h64_sharded_for_each(struct h64_sharded *hs,
+		     void (*cb)(void *entry, void *ctx), void *ctx)
+{
+	for (size_t i = 0; i < hs->shards_count; ++i) {
+		pthread_mutex_lock(&hs->shards[i].lock);
+		h64_for_each(hs->shards[i].table, entry)
+			cb(entry, ctx);
+		pthread_mutex_unlock(&hs->shards[i].lock);
+	}
+}
@@ -0,0 +1,543 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "h64_group.h"
+#include "h64/h64.h"
+#include "h64/h64_snapshot.h"
+
+/*
+ * A snapshot is a header followed by the arrays of the table and the
+ * arena, each at its offset in the file. Arrays are aligned as the table
+ * allocates them, and the arena to a page, so entries in a mapped arena
+ * are aligned at least as they were.
+ */
+enum {
+	SNAPSHOT_VERSION = 1,
+	ARRAY_ALIGNMENT = 64,
+	ARENA_ALIGNMENT = 4096,
+	/* Groups encoded per write. */
+	WRITE_CHUNK = 1024,
+};
+
+/* Reads differently on a machine of the other byte order. */
+#define SNAPSHOT_BYTE_ORDER  0x0102030405060708ull
+
+static const char snapshot_magic[8] = "h64snap";
+
+enum snapshot_array {
+	ARRAY_GROUPS,
+	ARRAY_HASHES,
+	ARRAY_FILTER,
+	ARRAY_OLD_GROUPS,
+	ARRAY_OLD_HASHES,
+	ARRAY_OLD_FILTER,
+	ARRAY_ARENA,
+	ARRAYS_COUNT,
+};
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t pointer_size;
+	uint64_t byte_order;
+	uint64_t file_size;
+	/* Address of the mapping the entries are encoded for. */
+	uint64_t address;
+	uint64_t flags;
+	uint64_t seed;
+	uint64_t count;
+	double max_load_factor;
+	double min_load_factor;
+	uint64_t min_size_in_groups;
+	uint64_t grow_count;
+	uint64_t shrink_count;
+	uint64_t was_full_groups;
+	uint64_t size_in_groups;
+	uint64_t old_size_in_groups;
+	uint64_t migrated_groups;
+	/* Offsets of the arrays in the file, an absent one has size 0. */
+	uint64_t offsets[ARRAYS_COUNT];
+	uint64_t sizes[ARRAYS_COUNT];
+};
+
+static uint64_t
+roundup(uint64_t size, uint64_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+static size_t
+groups_bytes(size_t size_in_groups)
+{
+	return size_in_groups * sizeof(struct h64_group);
+}
+
+static size_t
+hashes_bytes(const uint32_t *hashes, size_t size_in_groups)
+{
+	return hashes != NULL ? size_in_groups * GROUP_ENTRIES * sizeof(*hashes)
+			      : 0;
+}
+
+static size_t
+filter_bytes(const uint64_t *filter, size_t size_in_groups)
+{
+	return filter != NULL ? size_in_groups * sizeof(*filter) : 0;
+}
+
+/* Place the arrays of the given sizes one after another. */
+static void
+snapshot_layout(struct snapshot_header *header)
+{
+	uint64_t offset = roundup(sizeof(*header), ARRAY_ALIGNMENT);
+	for (size_t i = 0; i < ARRAYS_COUNT; ++i) {
+		if (header->sizes[i] == 0)
+			continue;
+		offset = roundup(offset, i == ARRAY_ARENA ? ARENA_ALIGNMENT
+							  : ARRAY_ALIGNMENT);
+		header->offsets[i] = offset;
+		offset += header->sizes[i];
+	}
+	header->file_size = offset;
+}
+
+static void
+snapshot_header_init(struct snapshot_header *header, const struct h64 *h,
+		     const struct h64_snapshot *snapshot)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, snapshot_magic, sizeof(header->magic));
+	header->version = SNAPSHOT_VERSION;
+	header->pointer_size = sizeof(void *);
+	header->byte_order = SNAPSHOT_BYTE_ORDER;
+	header->address = snapshot->address;
+	if (header->address == 0 && sizeof(void *) == sizeof(uint64_t))
+		header->address = H64_SNAPSHOT_ADDRESS;
+	header->flags = h->flags;
+	header->seed = h->seed;
+	header->count = h->count;
+	header->max_load_factor = h->max_load_factor;
+	header->min_load_factor = h->min_load_factor;
+	header->min_size_in_groups = h->min_size_in_groups;
+	header->grow_count = h->grow_count;
+	header->shrink_count = h->shrink_count;
+	header->was_full_groups = h->was_full_groups;
+	header->size_in_groups = h->size_in_groups;
+	header->old_size_in_groups = h->old_size_in_groups;
+	header->migrated_groups = h->migrated_groups;
+
+	header->sizes[ARRAY_GROUPS] = groups_bytes(h->size_in_groups);
+	header->sizes[ARRAY_HASHES] = hashes_bytes(h->hashes,
+						   h->size_in_groups);
+	header->sizes[ARRAY_FILTER] = filter_bytes(h->filter,
+						   h->size_in_groups);
+	if (h->old_groups != NULL) {
+		size_t size = h->old_size_in_groups;
+		header->sizes[ARRAY_OLD_GROUPS] = groups_bytes(size);
+		header->sizes[ARRAY_OLD_HASHES] = hashes_bytes(h->old_hashes,
+							       size);
+		header->sizes[ARRAY_OLD_FILTER] = filter_bytes(h->old_filter,
+							       size);
+	}
+	if (snapshot->arena != NULL)
+		header->sizes[ARRAY_ARENA] = snapshot->arena_size;
+	snapshot_layout(header);
+}
+
+/* Write zeros up to the offset. */
+static bool
+write_padding(FILE *f, uint64_t *position, uint64_t offset)
+{
+	static const char zeros[ARENA_ALIGNMENT];
+	assert(offset >= *position && offset - *position <= sizeof(zeros));
+	size_t size = offset - *position;
+	*position = offset;
+	return fwrite(zeros, 1, size, f) == size;
+}
+
+/*
+ * Write groups with entries encoded for the arena mapped at
+ * arena_address. Fails with EINVAL on an entry out of the arena.
+ */
+static bool
+write_groups(FILE *f, const struct h64_group *groups, size_t size,
+	     const struct h64_snapshot *snapshot, uint64_t arena_address)
+{
+	struct h64_group *chunk = malloc(WRITE_CHUNK * sizeof(*chunk));
+	if (chunk == NULL)
+		return false;
+	bool ok = true;
+	for (size_t i = 0; ok && i < size; i += WRITE_CHUNK) {
+		size_t n = MIN((size_t)WRITE_CHUNK, size - i);
+		memcpy(chunk, &groups[i], n * sizeof(*chunk));
+		for (size_t j = 0; snapshot->arena != NULL && j < n; ++j) {
+			uint8_t status = chunk[j].status & ENTRIES_MASK;
+			while (status != 0) {
+				size_t idx = __builtin_ctz(status);
+				uintptr_t offset = (uintptr_t)chunk[j].entries[idx] -
+						   (uintptr_t)snapshot->arena;
+				if (offset >= snapshot->arena_size) {
+					errno = EINVAL;
+					ok = false;
+				}
+				chunk[j].entries[idx] =
+					(void *)(uintptr_t)(arena_address + offset);
+				status &= status - 1;
+			}
+		}
+		ok = ok && fwrite(chunk, sizeof(*chunk), n, f) == n;
+	}
+	free(chunk);
+	return ok;
+}
+
+static bool
+snapshot_write(FILE *f, const struct snapshot_header *header,
+	       const struct h64 *h, const struct h64_snapshot *snapshot)
+{
+	const void *arrays[ARRAYS_COUNT] = {
+		[ARRAY_GROUPS] = h->groups,
+		[ARRAY_HASHES] = h->hashes,
+		[ARRAY_FILTER] = h->filter,
+		[ARRAY_OLD_GROUPS] = h->old_groups,
+		[ARRAY_OLD_HASHES] = h->old_hashes,
+		[ARRAY_OLD_FILTER] = h->old_filter,
+		[ARRAY_ARENA] = snapshot->arena,
+	};
+	uint64_t arena_address = header->address + header->offsets[ARRAY_ARENA];
+	if (fwrite(header, sizeof(*header), 1, f) != 1)
+		return false;
+	uint64_t position = sizeof(*header);
+	for (size_t i = 0; i < ARRAYS_COUNT; ++i) {
+		uint64_t size = header->sizes[i];
+		if (size == 0)
+			continue;
+		if (!write_padding(f, &position, header->offsets[i]))
+			return false;
+		bool ok;
+		if (i == ARRAY_GROUPS || i == ARRAY_OLD_GROUPS)
+			ok = write_groups(f, arrays[i],
+					  size / sizeof(struct h64_group),
+					  snapshot, arena_address);
+		else
+			ok = fwrite(arrays[i], 1, size, f) == size;
+		if (!ok)
+			return false;
+		position += size;
+	}
+	return true;
+}
+
+int
+h64_save(const struct h64 *h, const char *path,
+	 const struct h64_snapshot *snapshot)
+{
+	assert(snapshot->address % ARENA_ALIGNMENT == 0 &&
+	       "Snapshot address must be page aligned.");
+	struct snapshot_header header;
+	snapshot_header_init(&header, h, snapshot);
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+	bool ok = snapshot_write(f, &header, h, snapshot);
+	int error = errno;
+	if (fclose(f) != 0 && ok) {
+		ok = false;
+		error = errno;
+	}
+	if (!ok) {
+		remove(path);
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Mapping of a snapshot, the context of the allocator of its table.
+ * Arrays in the mapping are never freed, new ones go to the allocator
+ * of the options.
+ */
+struct snapshot_mapping {
+	char *base;
+	size_t size;
+	void *arena;
+	size_t arena_size;
+	struct h64_allocator allocator;
+};
+
+static void *
+mapping_alloc(void *ctx, size_t size, size_t alignment)
+{
+	struct snapshot_mapping *m = ctx;
+	return m->allocator.alloc(m->allocator.ctx, size, alignment);
+}
+
+static void
+mapping_free(void *ctx, void *ptr, size_t size)
+{
+	struct snapshot_mapping *m = ctx;
+	if ((char *)ptr >= m->base && (char *)ptr < m->base + m->size)
+		return;
+	m->allocator.free(m->allocator.ctx, ptr, size);
+}
+
+static void *
+calloc_alloc(void *ctx, size_t size, size_t alignment)
+{
+	(void)ctx;
+	size = roundup(size, alignment);
+	void *ptr = aligned_alloc(alignment, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+static void
+calloc_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+/* Array i is present or absent as the table needs, and inside the file. */
+static bool
+array_valid(const struct snapshot_header *header, size_t i,
+	    uint64_t expected_size)
+{
+	uint64_t offset = header->offsets[i];
+	uint64_t size = header->sizes[i];
+	if (size != expected_size)
+		return false;
+	return size == 0 || (offset % ARRAY_ALIGNMENT == 0 &&
+			     offset <= header->file_size &&
+			     size <= header->file_size - offset);
+}
+
+static bool
+snapshot_valid(const struct snapshot_header *header, uint64_t file_size)
+{
+	if (memcmp(header->magic, snapshot_magic, sizeof(header->magic)) != 0 ||
+	    header->version != SNAPSHOT_VERSION ||
+	    header->pointer_size != sizeof(void *) ||
+	    header->byte_order != SNAPSHOT_BYTE_ORDER ||
+	    header->file_size != file_size ||
+	    header->address % ARENA_ALIGNMENT != 0)
+		return false;
+
+	uint64_t size = header->size_in_groups;
+	uint64_t old_size = header->old_size_in_groups;
+	if (size == 0 || !is_power_of_2(size) || !is_power_of_2(old_size) ||
+	    size > SIZE_MAX / sizeof(struct h64_group))
+		return false;
+	bool hashes = header->flags & H64_STORE_HASHES;
+	bool filter = header->flags & H64_MISS_FILTER;
+	return array_valid(header, ARRAY_GROUPS, groups_bytes(size)) &&
+	       array_valid(header, ARRAY_HASHES,
+			   hashes ? size * GROUP_ENTRIES * sizeof(uint32_t) : 0) &&
+	       array_valid(header, ARRAY_FILTER,
+			   filter ? size * sizeof(uint64_t) : 0) &&
+	       array_valid(header, ARRAY_OLD_GROUPS, groups_bytes(old_size)) &&
+	       array_valid(header, ARRAY_OLD_HASHES, hashes ?
+			   old_size * GROUP_ENTRIES * sizeof(uint32_t) : 0) &&
+	       array_valid(header, ARRAY_OLD_FILTER,
+			   filter ? old_size * sizeof(uint64_t) : 0) &&
+	       array_valid(header, ARRAY_ARENA, header->sizes[ARRAY_ARENA]);
+}
+
+/* Move entries of the groups for the arena moved by delta. */
+static void
+relocate_groups(struct h64_group *groups, size_t size, uintptr_t delta)
+{
+	for (size_t i = 0; i < size; ++i) {
+		uint8_t status = groups[i].status & ENTRIES_MASK;
+		while (status != 0) {
+			size_t idx = __builtin_ctz(status);
+			groups[i].entries[idx] =
+				(char *)groups[i].entries[idx] + delta;
+			status &= status - 1;
+		}
+	}
+}
+
+static void *
+mapping_array(const struct snapshot_mapping *m,
+	      const struct snapshot_header *header, size_t i)
+{
+	return header->sizes[i] != 0 ? m->base + header->offsets[i] : NULL;
+}
+
+struct h64 *
+h64_open_mmap(const char *path, const struct h64_options *options)
+{
+	assert(options->hasher != NULL && "Need a hash function.");
+	assert(options->equals != NULL && "Need an equals function.");
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct snapshot_header header;
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+	    pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    !snapshot_valid(&header, st.st_size)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	/* Only a hint, the kernel maps elsewhere if the range is taken. */
+	void *base = mmap((void *)(uintptr_t)header.address, header.file_size,
+			  PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		errno = error;
+		return NULL;
+	}
+
+	struct snapshot_mapping *m = xcalloc(1, sizeof(*m));
+	m->base = base;
+	m->size = header.file_size;
+	m->arena = mapping_array(m, &header, ARRAY_ARENA);
+	m->arena_size = header.sizes[ARRAY_ARENA];
+	if (options->allocator != NULL)
+		m->allocator = *options->allocator;
+	else
+		m->allocator = (struct h64_allocator){ calloc_alloc,
+						       calloc_free, NULL };
+
+	struct h64 *h = xcalloc(1, sizeof(*h));
+	h->hasher = options->hasher;
+	h->equals = options->equals;
+	h->seed = header.seed;
+	/* Counters aren't saved. */
+	h->flags = header.flags & ~H64_STATISTICS;
+	h->count = header.count;
+	h->groups = mapping_array(m, &header, ARRAY_GROUPS);
+	h->size_in_groups = header.size_in_groups;
+	h->hashes = mapping_array(m, &header, ARRAY_HASHES);
+	h->filter = mapping_array(m, &header, ARRAY_FILTER);
+	h->old_groups = mapping_array(m, &header, ARRAY_OLD_GROUPS);
+	h->old_hashes = mapping_array(m, &header, ARRAY_OLD_HASHES);
+	h->old_filter = mapping_array(m, &header, ARRAY_OLD_FILTER);
+	h->old_size_in_groups = header.old_size_in_groups;
+	h->migrated_groups = header.migrated_groups;
+	h->max_load_factor = header.max_load_factor;
+	h->min_load_factor = header.min_load_factor;
+	h->min_size_in_groups = header.min_size_in_groups;
+	h->grow_count = header.grow_count;
+	h->shrink_count = header.shrink_count;
+	h->was_full_groups = header.was_full_groups;
+	h->allocator = (struct h64_allocator){ mapping_alloc, mapping_free, m };
+	if (options->executor != NULL)
+		h->executor = *options->executor;
+	/* Reference bits aren't saved, every entry starts unreferenced. */
+	if (h->flags & H64_EVICT) {
+		h->clock = mapping_alloc(m, h->size_in_groups *
+					    sizeof(struct h64_clock), 64);
+		assert(h->clock && "Allocation failed");
+		h->evict = options->evict;
+		h->evict_ctx = options->evict_ctx;
+	}
+	assert(options->probe_hook_sample_shift <= CHAR_BIT &&
+	       "Operations are sampled by hints, 1 of 256 at most.");
+	h->probe_hook = options->probe_hook;
+	h->probe_hook_ctx = options->probe_hook_ctx;
+	h->probe_hook_mask = (1u << options->probe_hook_sample_shift) - 1;
+
+	uintptr_t delta = (uintptr_t)base - header.address;
+	if (delta != 0 && m->arena != NULL) {
+		relocate_groups(h->groups, h->size_in_groups, delta);
+		if (h->old_groups != NULL)
+			relocate_groups(h->old_groups, h->old_size_in_groups,
+					delta);
+	}
+	return h;
+}
+
+void *
+h64_mmap_arena(const struct h64 *h, size_t *size)
+{
+	assert(h->allocator.free == mapping_free && "Table isn't mapped.");
+	const struct snapshot_mapping *m = h->allocator.ctx;
+	*size = m->arena_size;
+	return m->arena;
+}
+
+void
+h64_close_mmap(struct h64 *h)
+{
+	assert(h->allocator.free == mapping_free && "Table isn't mapped.");
+	struct snapshot_mapping *m = h->allocator.ctx;
+	h64_destroy(h);
+	munmap(m->base, m->size);
+	free(m);
+}
+
+#else /* !(defined(__unix__) || defined(__APPLE__)) */
+
+/* No mmap, snapshots can be saved but not opened. */
+struct h64 *
+h64_open_mmap(const char *path, const struct h64_options *options)
+{
+	(void)path;
+	(void)options;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void *
+h64_mmap_arena(const struct h64 *h, size_t *size)
+{
+	(void)h;
+	*size = 0;
+	return NULL;
+}
+
+void
+h64_close_mmap(struct h64 *h)
+{
+	h64_destroy(h);
+}
+
+#endif
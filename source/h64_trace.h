@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+/*
+ * Static tracepoints of libraries built with h64_TRACING, which defines
+ * H64_TRACING. They are USDT probes of the provider h64 if <sys/sdt.h> is
+ * found: a nop in the code and a note in the ELF file until bpftrace or
+ * perf attaches to them, e.g.
+ *
+ *	bpftrace -e 'usdt:libh64.so:h64:resize_start { @s[arg0] = nsecs; }
+ *		     usdt:libh64.so:h64:resize_end { @ns = hist(nsecs - @s[arg0]); }'
+ *
+ * Probes and their arguments:
+ *	resize_start, resize_end (table, old size_in_groups, new size_in_groups).
+ *		Incremental resizes end once the old array is migrated.
+ *	lookup_long, place_long (table, hash, groups probed), for probe
+ *		sequences longer than H64_TRACE_LONG_PROBE groups.
+ *	alloc, free (table, pointer, bytes) of the table allocator.
+ *
+ * Without H64_TRACING every tracepoint compiles to nothing.
+ */
+
+#if defined(H64_TRACING) && defined(H64_HAVE_SDT)
+#include <sys/sdt.h>
+#define H64_TRACE3(name, a1, a2, a3)  DTRACE_PROBE3(h64, name, a1, a2, a3)
+#else
+#define H64_TRACE3(name, a1, a2, a3)  ((void)(a1), (void)(a2), (void)(a3))
+#endif
+
+/* Probe sequences of more groups are traced as long ones. */
+#ifndef H64_TRACE_LONG_PROBE
+#define H64_TRACE_LONG_PROBE  8
+#endif
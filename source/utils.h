@@ -27,6 +27,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "h64/h64_hash.h"
+
 #define xcalloc(n, size)						\
 ({									\
 	void *ret = calloc((n), (size));				\
@@ -58,19 +60,12 @@
 #endif
 
 #define MAX(a, b)  ((a) > (b) ? (a) : (b))
+#define MIN(a, b)  ((a) < (b) ? (a) : (b))
 
 static inline uint64_t
 mixer64(uint64_t n)
 {
-	const uint64_t z = 0x9FB21C651E98DF25;
-
-	n ^= ((n << 49) | (n >> 15)) ^ ((n << 24) | (n >> 40));
-	n *= z;
-	n ^= n >> 35;
-	n *= z;
-	n ^= n >> 28;
-
-	return n;
+	return h64_mix64(n);
 }
 
 
@@ -0,0 +1,187 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "h64/h64.h"
+#include "h64/h64_concurrent.h"
+
+static int
+int_equals(const void *ptr1, const void *ptr2)
+{
+	const int *i1 = ptr1;
+	const int *i2 = ptr2;
+	return *i1 == *i2;
+}
+
+static uint64_t
+int_hash(const void *ptr, uint64_t seed)
+{
+	const int *i = ptr;
+	return h64_byte_hash(i, sizeof(*i), seed);
+}
+
+enum {
+	N = 20000,
+	/* Entries below are never erased, so readers must always find them. */
+	STABLE = 1000,
+	READERS = 4,
+	ROUNDS = 5,
+};
+
+static int data[N];
+
+static void
+single_thread_test(unsigned flags)
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.flags = flags,
+	};
+	struct h64_concurrent *hc = h64_concurrent_create(&options);
+	struct h64_reader *r = h64_reader_register(hc);
+
+	for (int i = 0; i < N; ++i)
+		h64_concurrent_insert(hc, &data[i]);
+	assert(h64_concurrent_count(hc) == N);
+
+	h64_read_enter(r);
+	for (int i = 0; i < N; ++i)
+		assert(h64_concurrent_find(hc, &data[i]) == &data[i]);
+	h64_read_exit(r);
+
+	for (int i = 0; i < N; ++i) {
+		int *erased = h64_concurrent_erase(hc, &data[i]);
+		assert(erased == &data[i]);
+	}
+	assert(h64_concurrent_count(hc) == 0);
+
+	h64_read_enter(r);
+	for (int i = 0; i < N; ++i)
+		assert(h64_concurrent_find(hc, &data[i]) == NULL);
+	h64_read_exit(r);
+
+	h64_reader_unregister(r);
+	h64_concurrent_destroy(hc);
+}
+
+static void
+batch_test()
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64_concurrent *hc = h64_concurrent_create(&options);
+	struct h64_reader *r = h64_reader_register(hc);
+
+	static void *entries[N];
+	for (int i = 0; i < N; ++i)
+		entries[i] = &data[i];
+	h64_concurrent_insert_batch(hc, entries, N / 2);
+	/* Stored entries of a batch are replaced, the rest are added. */
+	h64_concurrent_insert_batch(hc, entries, N);
+	assert(h64_concurrent_count(hc) == N);
+
+	/* The grown array is published with the batch. */
+	h64_read_enter(r);
+	for (int i = 0; i < N; ++i)
+		assert(h64_reader_find(r, &data[i]) == &data[i]);
+	h64_read_exit(r);
+
+	h64_reader_unregister(r);
+	h64_concurrent_destroy(hc);
+}
+
+struct reader_args {
+	struct h64_concurrent *hc;
+	bool *stop;
+};
+
+static void *
+reader_main(void *ptr)
+{
+	struct reader_args *args = ptr;
+	struct h64_reader *r = h64_reader_register(args->hc);
+	while (!__atomic_load_n(args->stop, __ATOMIC_ACQUIRE)) {
+		h64_read_enter(r);
+		for (int i = 0; i < N; i += 7) {
+			int *found = h64_concurrent_find(args->hc, &data[i]);
+			if (i < STABLE)
+				assert(found == &data[i]);
+			else
+				assert(found == NULL || found == &data[i]);
+		}
+		h64_read_exit(r);
+	}
+	h64_reader_unregister(r);
+	return NULL;
+}
+
+static void
+readers_test()
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64_concurrent *hc = h64_concurrent_create(&options);
+	for (int i = 0; i < STABLE; ++i)
+		h64_concurrent_insert(hc, &data[i]);
+
+	bool stop = false;
+	struct reader_args args = { .hc = hc, .stop = &stop };
+	pthread_t readers[READERS];
+	for (int i = 0; i < READERS; ++i)
+		pthread_create(&readers[i], NULL, reader_main, &args);
+
+	/* Grow and shrink the table under the readers. */
+	for (int round = 0; round < ROUNDS; ++round) {
+		for (int i = STABLE; i < N; ++i)
+			h64_concurrent_insert(hc, &data[i]);
+		for (int i = STABLE; i < N; ++i)
+			h64_concurrent_erase(hc, &data[i]);
+		h64_concurrent_synchronize(hc);
+	}
+
+	__atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+	for (int i = 0; i < READERS; ++i)
+		pthread_join(readers[i], NULL);
+	assert(h64_concurrent_count(hc) == STABLE);
+	h64_concurrent_destroy(hc);
+}
+
+int main()
+{
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+	single_thread_test(0);
+	single_thread_test(H64_WIDE_PROBING);
+	batch_test();
+	readers_test();
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h64/h64.h"
+#include "h64/h64_hash.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static void
+implementation_test()
+{
+	const char *name = getenv("H64_HASH");
+	if (name != NULL && strcmp(name, "soft") == 0)
+		assert(strcmp(h64_hash_name(), "soft") == 0);
+
+	/* Every implementation gives the same values. */
+	assert(h64_str_hash("", 42) == 0xf15deaf07cbbacadull);
+	assert(h64_str_hash("a", 42) == 0x9cdbf9b86e6d0766ull);
+	assert(h64_str_hash("abcdefgh", 42) == 0x42e178fc7604af38ull);
+	assert(h64_str_hash("The quick brown fox jumps over the lazy dog",
+			    42) == 0x6054960fc6fdf44full);
+}
+
+static void
+str_test()
+{
+	enum { MAX_LEN = 100, ALIGNMENTS = 8 };
+	static char buffer[MAX_LEN + ALIGNMENTS + 1];
+	for (size_t offset = 0; offset < ALIGNMENTS; ++offset) {
+		for (size_t len = 0; len <= MAX_LEN; ++len) {
+			char *str = buffer + offset;
+			for (size_t i = 0; i < len; ++i)
+				str[i] = (char)('a' + (i * 7 + len) % 26);
+			str[len] = '\0';
+			uint64_t hash = h64_crc_hash(str, len, len);
+			assert(h64_str_hash(str, len) == hash);
+			assert(h64_str_hasher(str, len) == hash);
+			/* Bytes past the NUL don't matter. */
+			str[len + 1] = 'x';
+			assert(h64_str_hash(str, len) == hash);
+			assert(h64_crc_hash(str, len, len + 1) != hash);
+		}
+	}
+	/* A zero byte is a byte of the key, not its end. */
+	assert(h64_crc_hash("ab\0", 3, 0) != h64_crc_hash("ab", 2, 0));
+}
+
+/* Keys at any alignment hash as their aligned copies. */
+static void
+byte_hash_test()
+{
+	uint64_t aligned[4];
+	unsigned char buf[sizeof(aligned) + 8];
+	for (int len = 0; len <= (int)sizeof(aligned); ++len) {
+		for (int i = 0; i < len; ++i)
+			((unsigned char *)aligned)[i] = (unsigned char)(i * 37 + 1);
+		uint64_t hash = h64_byte_hash(aligned, len, 42);
+		for (size_t offset = 0; offset < 8; ++offset) {
+			memcpy(buf + offset, aligned, len);
+			assert(h64_byte_hash(buf + offset, len, 42) == hash);
+		}
+	}
+}
+
+/* Strings at the end of a page followed by an inaccessible one. */
+static void
+page_end_test()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	long page = sysconf(_SC_PAGESIZE);
+	char *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(pages != MAP_FAILED);
+	int rc = mprotect(pages + page, page, PROT_NONE);
+	assert(rc == 0);
+	for (size_t len = 0; len < 24; ++len) {
+		char *str = pages + page - len - 1;
+		memset(str, 'k', len);
+		str[len] = '\0';
+		assert(h64_str_hash(str, 7) == h64_crc_hash(str, len, 7));
+	}
+	munmap(pages, 2 * page);
+#endif
+}
+
+/* Hashes of consecutive keys spread evenly over low bits and hints. */
+static void
+check_spread(const uint64_t *hashes, size_t n)
+{
+	enum { BUCKETS = 256 };
+	size_t low[BUCKETS] = {0}, high[BUCKETS] = {0};
+	for (size_t i = 0; i < n; ++i) {
+		low[hashes[i] % BUCKETS] += 1;
+		high[hashes[i] >> 56] += 1;
+	}
+	for (size_t i = 0; i < BUCKETS; ++i) {
+		assert(low[i] > n / BUCKETS / 2 && low[i] < n / BUCKETS * 2);
+		assert(high[i] > n / BUCKETS / 2 && high[i] < n / BUCKETS * 2);
+	}
+}
+
+static void
+fixed_width_test()
+{
+	enum { N = 1 << 16 };
+	static uint64_t hashes[N];
+	uint64_t seed = 0x5eed;
+
+	for (uint32_t i = 0; i < N; ++i) {
+		hashes[i] = h64_hash_u32(i, seed);
+		assert(h64_u32_hasher(&i, seed) == hashes[i]);
+	}
+	check_spread(hashes, N);
+
+	for (uint64_t i = 0; i < N; ++i) {
+		hashes[i] = h64_hash_u64(i << 32, seed);
+		uint64_t key = i << 32;
+		assert(h64_u64_hasher(&key, seed) == hashes[i]);
+	}
+	check_spread(hashes, N);
+
+	for (uint64_t i = 0; i < N; ++i) {
+		uint64_t key[2] = {i, ~i};
+		hashes[i] = h64_hash_u128(i, ~i, seed);
+		assert(h64_u128_hasher(key, seed) == hashes[i]);
+		assert(h64_hash_u128(~i, i, seed) != hashes[i]);
+	}
+	check_spread(hashes, N);
+
+	for (size_t i = 0; i < N; ++i) {
+		char str[16];
+		snprintf(str, sizeof(str), "%zu", i);
+		hashes[i] = h64_str_hash(str, seed);
+	}
+	check_spread(hashes, N);
+}
+
+static int
+str_equals(const void *lhs, const void *rhs)
+{
+	return strcmp(lhs, rhs) == 0;
+}
+
+struct slice {
+	const char *data;
+	size_t len;
+};
+
+static int
+slice_equals(const void *key, const void *entry)
+{
+	const struct slice *slice = key;
+	const char *str = entry;
+	return strncmp(str, slice->data, slice->len) == 0 &&
+	       str[slice->len] == '\0';
+}
+
+static void
+table_test()
+{
+	static const char *words[] = {"get", "set", "del", "getset", "incr"};
+	enum { N = sizeof(words) / sizeof(words[0]) };
+	struct h64 *h = h64_create(h64_str_hasher, str_equals);
+	for (int i = 0; i < N; ++i)
+		h64_insert(h, (void *)words[i]);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h, words[i]) == words[i]);
+
+	/* Slices are hashed the same as the strings. */
+	const char *request = "getset key value";
+	struct slice slice = { request, 3 };
+	uint64_t hash = h64_crc_hash(slice.data, slice.len, h64_seed(h));
+	assert(h64_find_key_hashed(h, &slice, hash, slice_equals) ==
+	       words[0]);
+	slice.len = 6;
+	hash = h64_crc_hash(slice.data, slice.len, h64_seed(h));
+	assert(h64_find_key_hashed(h, &slice, hash, slice_equals) ==
+	       words[3]);
+	h64_destroy(h);
+}
+
+int main()
+{
+	implementation_test();
+	str_test();
+	byte_hash_test();
+	page_end_test();
+	fixed_width_test();
+	table_test();
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h64/h64_map.h"
+
+H64_MAP_DEFINE(u64_map, uint64_t, uint64_t, h64_map_u64_hash,
+	       h64_map_int_equals)
+
+struct id {
+	uint64_t high;
+	uint64_t low;
+};
+
+static inline uint64_t
+id_hash(struct id id, uint64_t seed)
+{
+	return h64_map_u64_hash(id.high ^ h64_map_u64_hash(id.low, seed), seed);
+}
+
+#define id_equals(a, b)  ((a).high == (b).high && (a).low == (b).low)
+
+H64_MAP_DEFINE(id_map, struct id, uint32_t, id_hash, id_equals)
+
+H64_DEFINE(u64_set, uint64_t, h64_map_u64_hash, h64_map_int_equals)
+
+static inline uint64_t
+str_hash(const char *str, uint64_t seed)
+{
+	return h64_byte_hash(str, (int)strlen(str), seed);
+}
+
+#define str_equals(a, b)  (strcmp((a), (b)) == 0)
+
+H64_DEFINE(str_set, const char *, str_hash, str_equals)
+
+H64_MAP_DEFINE_HINT16(u64_map16, uint64_t, uint64_t, h64_map_u64_hash,
+		      h64_map_int_equals)
+
+static size_t str_compares;
+
+#define counted_str_equals(a, b)  (str_compares += 1, strcmp((a), (b)) == 0)
+
+H64_DEFINE(counted_set, const char *, str_hash, counted_str_equals)
+H64_DEFINE_HINT16(counted_set16, const char *, str_hash, counted_str_equals)
+
+struct item {
+	uint64_t key;
+	uint64_t value;
+};
+
+/* The arena of the items of item_set. */
+static struct item *items;
+
+static inline uint64_t
+item_hash(const struct item *item, uint64_t seed)
+{
+	return h64_map_u64_hash(item->key, seed);
+}
+
+#define item_equals(a, b)  ((a)->key == (b)->key)
+
+H64_DEFINE_ARENA(item_set, struct item, items, 4, item_hash, item_equals)
+
+static_assert(sizeof(struct u64_set_group) == 64, "One cache line");
+static_assert(sizeof(struct str_set_group) == 64, "One cache line");
+static_assert(sizeof(struct u64_map_group) == 128, "Two cache lines");
+static_assert(sizeof(struct id_map_group) == 192, "Three cache lines");
+static_assert(sizeof(struct counted_set16_group) == 64, "One cache line");
+static_assert(sizeof(struct u64_map16_group) == 128, "Two cache lines");
+static_assert(sizeof(struct item_set_group) == 64, "One cache line");
+
+enum { N = 20000 };
+
+static void
+u64_map_test()
+{
+	static bool present[N];
+	struct u64_map *m = u64_map_create();
+	assert(u64_map_find(m, 0) == NULL);
+
+	for (uint64_t i = 0; i < N; i += 2) {
+		uint64_t *value = u64_map_insert(m, i, i * 3);
+		assert(*value == i * 3);
+		present[i] = true;
+	}
+	assert(u64_map_count(m) == N / 2);
+	/* Update keeps the count. */
+	*u64_map_insert(m, 0, 7) += 1;
+	assert(*u64_map_find(m, 0) == 8);
+	assert(u64_map_count(m) == N / 2);
+
+	/* Erase every 3rd key, with and without taking the value. */
+	for (uint64_t i = 0; i < N; i += 3) {
+		uint64_t value = 0;
+		bool erased = u64_map_erase(m, i, i % 2 ? NULL : &value);
+		assert(erased == present[i]);
+		if (erased && i % 2 == 0)
+			assert(value == (i == 0 ? 8 : i * 3));
+		present[i] = false;
+	}
+	size_t count = 0;
+	for (uint64_t i = 0; i < N; ++i) {
+		uint64_t *value = u64_map_find(m, i);
+		assert((value != NULL) == present[i]);
+		if (value != NULL)
+			assert(*value == i * 3);
+		count += present[i];
+	}
+	assert(u64_map_count(m) == count);
+
+	size_t seen = 0;
+	h64_map_for_each(m, slot) {
+		assert(present[slot->key] && slot->value == slot->key * 3);
+		seen += 1;
+	}
+	assert(seen == count);
+
+	/* Shrinks back when drained. */
+	for (uint64_t i = 0; i < N; ++i) {
+		bool erased = u64_map_erase(m, i, NULL);
+		assert(erased == present[i]);
+	}
+	assert(u64_map_count(m) == 0);
+	assert(m->size_in_groups == 4);
+	u64_map_destroy(m);
+}
+
+static void
+id_map_test()
+{
+	struct id_map *m = id_map_create();
+	id_map_reserve(m, N);
+	size_t size = m->size_in_groups;
+	for (uint32_t i = 0; i < N; ++i) {
+		struct id id = {i, ~(uint64_t)i};
+		id_map_insert(m, id, i);
+	}
+	assert(m->size_in_groups == size);
+	assert(id_map_count(m) == N);
+	for (uint32_t i = 0; i < N; ++i) {
+		struct id id = {i, ~(uint64_t)i};
+		struct id other = {i, i};
+		assert(*id_map_find(m, id) == i);
+		assert(id_map_find(m, other) == NULL);
+	}
+	id_map_destroy(m);
+}
+
+static void
+set_test()
+{
+	struct u64_set *s = u64_set_create();
+	for (uint64_t i = 0; i < N; ++i)
+		u64_set_insert(s, i * 7);
+	assert(u64_set_count(s) == N);
+	for (uint64_t i = 0; i < 7 * N; ++i)
+		assert((u64_set_find(s, i) != NULL) == (i % 7 == 0));
+	for (uint64_t i = 0; i < N; i += 2) {
+		uint64_t erased = 0;
+		bool found = u64_set_erase(s, i * 7, &erased);
+		assert(found && erased == i * 7);
+		found = u64_set_erase(s, i * 7, NULL);
+		assert(!found);
+	}
+	assert(u64_set_count(s) == N / 2);
+	u64_set_destroy(s);
+
+	/* Entries by pointers, the stored one is replaced by insert. */
+	char str1[] = "help";
+	char str2[] = "help";
+	char str3[] = "me";
+	struct str_set *ss = str_set_create();
+	str_set_insert(ss, str1);
+	str_set_insert(ss, str3);
+	assert(*str_set_find(ss, "help") == str1);
+	str_set_insert(ss, str2);
+	assert(str_set_count(ss) == 2);
+	assert(*str_set_find(ss, "help") == str2);
+	const char *erased = NULL;
+	bool found = str_set_erase(ss, "me", &erased);
+	assert(found && erased == str3);
+	assert(str_set_find(ss, "me") == NULL);
+	str_set_destroy(ss);
+}
+
+static void
+hint16_test()
+{
+	struct u64_map16 *m = u64_map16_create();
+	for (uint64_t i = 0; i < N; ++i)
+		u64_map16_insert(m, i, i * 3);
+	assert(u64_map16_count(m) == N);
+	for (uint64_t i = 0; i < 2 * N; ++i) {
+		uint64_t *value = u64_map16_find(m, i);
+		assert(i < N ? value != NULL && *value == i * 3 : value == NULL);
+	}
+	size_t seen = 0;
+	h64_map_for_each(m, slot) {
+		assert(slot->value == slot->key * 3);
+		seen += 1;
+	}
+	assert(seen == N);
+	for (uint64_t i = 0; i < N; ++i) {
+		bool erased = u64_map16_erase(m, i, NULL);
+		assert(erased);
+	}
+	assert(u64_map16_count(m) == 0);
+	assert(m->size_in_groups == 4);
+	u64_map16_destroy(m);
+
+	/* Misses compare keys with 16 bit hints far less often. */
+	enum { LEN = 24 };
+	static char keys[2 * N][LEN];
+	for (int i = 0; i < 2 * N; ++i)
+		snprintf(keys[i], LEN, "key-%d", i);
+	struct counted_set *s = counted_set_create();
+	struct counted_set16 *s16 = counted_set16_create();
+	for (int i = 0; i < N; ++i) {
+		counted_set_insert(s, keys[i]);
+		counted_set16_insert(s16, keys[i]);
+	}
+	str_compares = 0;
+	for (int i = N; i < 2 * N; ++i)
+		assert(counted_set_find(s, keys[i]) == NULL);
+	size_t compares = str_compares;
+	str_compares = 0;
+	for (int i = N; i < 2 * N; ++i)
+		assert(counted_set16_find(s16, keys[i]) == NULL);
+	assert(str_compares * 16 < compares);
+	for (int i = 0; i < N; ++i)
+		assert(*counted_set16_find(s16, keys[i]) == keys[i]);
+	counted_set_destroy(s);
+	counted_set16_destroy(s16);
+}
+
+static void
+arena_test()
+{
+	items = malloc((N + 1) * sizeof(*items));
+	assert(items != NULL);
+	assert(item_set_offset(&items[5]) == 5 && item_set_entry(5) == &items[5]);
+
+	struct item_set *s = item_set_create();
+	for (uint64_t i = 0; i < N; ++i) {
+		items[i].key = i * 7;
+		items[i].value = i;
+		item_set_insert(s, &items[i]);
+	}
+	assert(item_set_count(s) == N);
+	for (uint64_t i = 0; i < 2 * N; ++i) {
+		struct item probe = {i * 7, 0};
+		struct item *found = item_set_find(s, &probe);
+		assert(i < N ? found == &items[i] : found == NULL);
+	}
+	size_t seen = 0;
+	h64_map_for_each(s, slot) {
+		struct item *item = item_set_entry(slot->key);
+		assert(item->key == item->value * 7);
+		seen += 1;
+	}
+	assert(seen == N);
+
+	/* An equal entry replaces the stored one. */
+	struct item *copy = &items[N];
+	*copy = items[0];
+	item_set_insert(s, copy);
+	assert(item_set_count(s) == N);
+	assert(item_set_find(s, &items[0]) == copy);
+
+	for (uint64_t i = 0; i < N; ++i) {
+		struct item probe = {i * 7, 0};
+		struct item *erased = NULL;
+		bool found = item_set_erase(s, &probe, &erased);
+		assert(found && erased == (i == 0 ? copy : &items[i]));
+		assert(item_set_find(s, &probe) == NULL);
+	}
+	assert(item_set_count(s) == 0);
+	assert(s->size_in_groups == 4);
+	item_set_destroy(s);
+	free(items);
+}
+
+/*
+ * Erases leave "was full" bits behind, so keys churning at a constant
+ * count set them in every group unless the table is rebuilt, and a miss
+ * then never stops probing.
+ */
+enum { CHURN_LIVE = 1000, CHURN_STEPS = 100000 };
+
+static void
+churn_test()
+{
+	struct u64_map *m = u64_map_create();
+	struct u64_map16 *m16 = u64_map16_create();
+	for (uint64_t i = 0; i < CHURN_LIVE; ++i) {
+		u64_map_insert(m, i, i);
+		u64_map16_insert(m16, i, i);
+	}
+	for (uint64_t i = CHURN_LIVE; i < CHURN_STEPS; ++i) {
+		bool erased = u64_map_erase(m, i - CHURN_LIVE, NULL);
+		bool erased16 = u64_map16_erase(m16, i - CHURN_LIVE, NULL);
+		assert(erased && erased16);
+		u64_map_insert(m, i, i);
+		u64_map16_insert(m16, i, i);
+	}
+	assert(u64_map_count(m) == CHURN_LIVE);
+	assert(u64_map16_count(m16) == CHURN_LIVE);
+	assert(m->was_full_groups <= m->size_in_groups / 2 + 1);
+	for (uint64_t i = 0; i < CHURN_STEPS; ++i) {
+		bool live = i >= CHURN_STEPS - CHURN_LIVE;
+		uint64_t *value = u64_map_find(m, i);
+		assert(live ? *value == i : value == NULL);
+		value = u64_map16_find(m16, i);
+		assert(live ? *value == i : value == NULL);
+	}
+	u64_map_destroy(m);
+	u64_map16_destroy(m16);
+}
+
+static void
+arena_churn_test()
+{
+	items = malloc(CHURN_LIVE * sizeof(*items));
+	assert(items != NULL);
+	struct item_set *s = item_set_create();
+	for (uint64_t i = 0; i < CHURN_LIVE; ++i) {
+		items[i].key = i;
+		item_set_insert(s, &items[i]);
+	}
+	/* An erased item comes back with the next key. */
+	for (uint64_t i = CHURN_LIVE; i < CHURN_STEPS; ++i) {
+		struct item *item = &items[i % CHURN_LIVE];
+		bool erased = item_set_erase(s, item, NULL);
+		assert(erased);
+		item->key = i;
+		item_set_insert(s, item);
+	}
+	assert(item_set_count(s) == CHURN_LIVE);
+	assert(s->was_full_groups <= s->size_in_groups / 2 + 1);
+	for (uint64_t i = 0; i < CHURN_STEPS; ++i) {
+		struct item probe = {i, 0};
+		struct item *found = item_set_find(s, &probe);
+		assert(i >= CHURN_STEPS - CHURN_LIVE ?
+		       found == &items[i % CHURN_LIVE] : found == NULL);
+	}
+	item_set_destroy(s);
+	free(items);
+}
+
+int main()
+{
+	u64_map_test();
+	id_map_test();
+	set_test();
+	hint16_test();
+	arena_test();
+	churn_test();
+	arena_churn_test();
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "h64/h64.h"
+#include "h64/h64_concurrent.h"
+#include "h64/h64_replicated.h"
+
+static int
+int_equals(const void *ptr1, const void *ptr2)
+{
+	const int *i1 = ptr1;
+	const int *i2 = ptr2;
+	return *i1 == *i2;
+}
+
+static uint64_t
+int_hash(const void *ptr, uint64_t seed)
+{
+	const int *i = ptr;
+	return h64_byte_hash(i, sizeof(*i), seed);
+}
+
+enum {
+	N = 50000,
+	READERS = 3,
+};
+
+static int data[N];
+
+/* Every replica has the even entries only. */
+static void *
+reader_main(void *ptr)
+{
+	struct h64_reader *r = ptr;
+	h64_read_enter(r);
+	for (int i = 0; i < N; ++i) {
+		int *found = h64_reader_find(r, &data[i]);
+		assert(found == (i % 2 == 0 ? &data[i] : NULL));
+	}
+	h64_read_exit(r);
+	h64_reader_unregister(r);
+	return NULL;
+}
+
+static void
+replicated_test(size_t replicas)
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64_replicated *hr = h64_replicated_create(&options, replicas);
+	size_t count = h64_replicated_replicas(hr);
+	assert(replicas == 0 ? count >= 1 : count == replicas);
+
+	h64_replicated_reserve(hr, N / 2);
+	for (int i = 0; i < N / 2; ++i)
+		h64_replicated_insert(hr, &data[i]);
+	void *batch[N / 2];
+	for (int i = 0; i < N / 2; ++i)
+		batch[i] = &data[N / 2 + i];
+	h64_replicated_insert_batch(hr, batch, N / 2);
+	assert(h64_replicated_count(hr) == N);
+	for (int i = 1; i < N; i += 2) {
+		int *erased = h64_replicated_erase(hr, &data[i]);
+		assert(erased == &data[i]);
+	}
+	int *erased = h64_replicated_erase(hr, &data[1]);
+	assert(erased == NULL);
+	assert(h64_replicated_count(hr) == N / 2);
+	h64_replicated_synchronize(hr);
+
+	pthread_t readers[READERS];
+	for (int i = 0; i < READERS; ++i) {
+		struct h64_concurrent *hc =
+			h64_replicated_replica(hr, i % count);
+		assert(h64_concurrent_count(hc) == N / 2);
+		pthread_create(&readers[i], NULL, reader_main,
+			       h64_reader_register(hc));
+	}
+	for (int i = 0; i < READERS; ++i)
+		pthread_join(readers[i], NULL);
+	reader_main(h64_replicated_reader_register(hr));
+	h64_replicated_destroy(hr);
+}
+
+int main()
+{
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+	replicated_test(0);
+	replicated_test(3);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "h64/h64.h"
+#include "h64/h64_sharded.h"
+
+static int
+int_equals(const void *ptr1, const void *ptr2)
+{
+	const int *i1 = ptr1;
+	const int *i2 = ptr2;
+	return *i1 == *i2;
+}
+
+static uint64_t
+int_hash(const void *ptr, uint64_t seed)
+{
+	const int *i = ptr;
+	return h64_byte_hash(i, sizeof(*i), seed);
+}
+
+enum {
+	WRITERS = 4,
+	PER_WRITER = 20000,
+	N = WRITERS * PER_WRITER,
+	SHARDS = 8,
+};
+
+static int data[N];
+
+struct writer_args {
+	struct h64_sharded *hs;
+	int first;
+};
+
+static void *
+writer_main(void *ptr)
+{
+	struct writer_args *args = ptr;
+	int end = args->first + PER_WRITER;
+	for (int i = args->first; i < end; ++i)
+		h64_sharded_insert(args->hs, &data[i]);
+	for (int i = args->first; i < end; ++i)
+		assert(h64_sharded_find(args->hs, &data[i]) == &data[i]);
+	/* Erase odd entries, so the others stay till the end. */
+	for (int i = args->first + 1; i < end; i += 2) {
+		int *erased = h64_sharded_erase(args->hs, &data[i]);
+		assert(erased == &data[i]);
+	}
+	return NULL;
+}
+
+static void
+count_cb(void *entry, void *ctx)
+{
+	int *i = entry;
+	assert(*i % 2 == 0);
+	*(size_t *)ctx += 1;
+}
+
+static void
+writers_test()
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64_sharded *hs = h64_sharded_create(&options, SHARDS);
+
+	pthread_t writers[WRITERS];
+	struct writer_args args[WRITERS];
+	for (int i = 0; i < WRITERS; ++i) {
+		args[i].hs = hs;
+		args[i].first = i * PER_WRITER;
+		pthread_create(&writers[i], NULL, writer_main, &args[i]);
+	}
+	for (int i = 0; i < WRITERS; ++i)
+		pthread_join(writers[i], NULL);
+
+	assert(h64_sharded_count(hs) == N / 2);
+	size_t visited = 0;
+	h64_sharded_for_each(hs, count_cb, &visited);
+	assert(visited == N / 2);
+	for (int i = 0; i < N; ++i) {
+		int *found = h64_sharded_find(hs, &data[i]);
+		assert(found == (i % 2 == 0 ? &data[i] : NULL));
+	}
+
+	h64_sharded_insert_new(hs, &data[0]);
+	assert(h64_sharded_count(hs) == N / 2 + 1);
+	h64_sharded_destroy(hs);
+}
+
+int main()
+{
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+	writers_test();
+	return 0;
+}
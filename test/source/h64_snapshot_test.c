@@ -0,0 +1,196 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Kaitmazian Maksim
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "h64/h64.h"
+#include "h64/h64_snapshot.h"
+
+static int
+int_equals(const void *ptr1, const void *ptr2)
+{
+	const int *i1 = ptr1;
+	const int *i2 = ptr2;
+	return *i1 == *i2;
+}
+
+static uint64_t
+int_hash(const void *ptr, uint64_t seed)
+{
+	const int *i = ptr;
+	return h64_byte_hash(i, sizeof(*i), seed);
+}
+
+/* Entries which aren't pointers, saved as they are. */
+static int
+value_equals(const void *lhs, const void *rhs)
+{
+	return lhs == rhs;
+}
+
+static uint64_t
+value_hash(const void *ptr, uint64_t seed)
+{
+	uintptr_t value = (uintptr_t)ptr;
+	return h64_byte_hash(&value, sizeof(value), seed);
+}
+
+enum { N = 50000 };
+
+static const char *path = "h64_snapshot_test.bin";
+
+/*
+ * The first saved entries of the mapped table are the ones of the arena
+ * in it, the rest up to n are inserted after mapping, of data.
+ */
+static void
+check_mapped(struct h64 *h64, const int *data, int saved, int n)
+{
+	size_t arena_size;
+	int *arena = h64_mmap_arena(h64, &arena_size);
+	assert(arena_size == 2 * N * sizeof(int));
+	assert(arena != data);
+	assert(h64_count(h64) == (size_t)n);
+	for (int i = 0; i < 2 * N; ++i) {
+		int *found = h64_find(h64, &data[i]);
+		if (i < saved)
+			assert(found == &arena[i]);
+		else
+			assert(found == (i < n ? &data[i] : NULL));
+	}
+}
+
+static void
+save_test()
+{
+	static int data[2 * N];
+	for (int i = 0; i < 2 * N; ++i)
+		data[i] = i;
+	struct h64_snapshot snapshot = {
+		.arena = data,
+		.arena_size = sizeof(data),
+	};
+
+	unsigned flags[] = {
+		0,
+		H64_STORE_HASHES | H64_MISS_FILTER,
+		H64_WIDE_PROBING | H64_STATISTICS,
+		/* Saved in the middle of a migration. */
+		H64_INCREMENTAL_RESIZE | H64_STORE_HASHES | H64_MISS_FILTER,
+	};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		int saved = 0;
+		while (saved < N)
+			h64_insert(h64, &data[saved++]);
+		if (flags[f] & H64_INCREMENTAL_RESIZE) {
+			while (h64->old_groups == NULL)
+				h64_insert(h64, &data[saved++]);
+		}
+		int rc = h64_save(h64, path, &snapshot);
+		assert(rc == 0);
+		h64_destroy(h64);
+
+		/* The first mapping is zero-copy, the second is relocated. */
+		struct h64 *first = h64_open_mmap(path, &options);
+		struct h64 *second = h64_open_mmap(path, &options);
+		assert(first != NULL && second != NULL);
+		assert(first->seed == second->seed);
+		check_mapped(first, data, saved, saved);
+		check_mapped(second, data, saved, saved);
+
+		/* Mapped tables are private and keep working as usual. */
+		for (int i = saved; i < 2 * N; ++i)
+			h64_insert(second, &data[i]);
+		check_mapped(second, data, saved, 2 * N);
+		check_mapped(first, data, saved, saved);
+		h64_close_mmap(first);
+		h64_close_mmap(second);
+	}
+
+	/* Entries out of the arena can't be saved. */
+	int outside = 0;
+	struct h64 *h64 = h64_create(int_hash, int_equals);
+	h64_insert(h64, &outside);
+	int rc = h64_save(h64, path, &snapshot);
+	assert(rc == -1 && errno == EINVAL);
+	h64_destroy(h64);
+}
+
+static void
+values_test()
+{
+	struct h64_options options = {
+		.hasher = value_hash,
+		.equals = value_equals,
+	};
+	struct h64 *h64 = h64_create_ex(&options);
+	for (uintptr_t i = 1; i <= N; ++i)
+		h64_insert(h64, (void *)i);
+	struct h64_snapshot snapshot = {0};
+	int rc = h64_save(h64, path, &snapshot);
+	assert(rc == 0);
+	h64_destroy(h64);
+
+	h64 = h64_open_mmap(path, &options);
+	assert(h64 != NULL && h64_count(h64) == N);
+	for (uintptr_t i = 1; i <= 2 * N; ++i)
+		assert(h64_find(h64, (void *)i) == (i <= N ? (void *)i : NULL));
+	h64_close_mmap(h64);
+}
+
+static void
+invalid_test()
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64 *h64 = h64_open_mmap("no/such/snapshot", &options);
+	assert(h64 == NULL && errno == ENOENT);
+
+	FILE *f = fopen(path, "wb");
+	fputs("not a snapshot", f);
+	fclose(f);
+	h64 = h64_open_mmap(path, &options);
+	assert(h64 == NULL && errno == EINVAL);
+}
+
+int main()
+{
+	save_test();
+	values_test();
+	invalid_test();
+	remove(path);
+	return 0;
+}
@@ -22,9 +22,11 @@
  * SOFTWARE.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 #include "h64/h64.h"
 
@@ -139,9 +141,1277 @@ resize_test()
 	h64_destroy(h64);
 }
 
+static void
+batch_test()
+{
+	struct h64 *h64 = h64_create(int_hash, int_equals);
+
+	enum { N = 1000 };
+	int data[N];
+	void *entries[N];
+	void *out[N];
+	for (int i = 0; i < N; ++i) {
+		data[i] = i;
+		entries[i] = &data[i];
+	}
+
+	h64_insert_batch(h64, entries, N);
+	assert(h64_count(h64) == N);
+	h64_insert_batch(h64, entries, N / 2);
+	assert(h64_count(h64) == N);
+
+	h64_find_batch(h64, (const void **)entries, N, out);
+	for (int i = 0; i < N; ++i)
+		assert(out[i] == &data[i]);
+
+	h64_erase_batch(h64, (const void **)entries, N / 2, out);
+	assert(h64_count(h64) == N / 2);
+	for (int i = 0; i < N / 2; ++i)
+		assert(out[i] == &data[i]);
+
+	h64_find_batch(h64, (const void **)entries, N, out);
+	for (int i = 0; i < N; ++i)
+		assert(out[i] == (i < N / 2 ? NULL : &data[i]));
+
+	h64_erase_batch(h64, (const void **)entries, N, NULL);
+	assert(h64_count(h64) == 0);
+	h64_find_batch(h64, (const void **)entries, N, out);
+	for (int i = 0; i < N; ++i)
+		assert(out[i] == NULL);
+
+	h64_destroy(h64);
+}
+
+/* Run FLIGHT lookups at a time a step each in turn, as a scheduler would. */
+static void
+lookup_all(const struct h64 *h64, const int *data, int n)
+{
+	enum { FLIGHT = 16 };
+	struct h64_lookup_state states[FLIGHT];
+	int keys[FLIGHT];
+	for (int i = 0; i < FLIGHT; ++i)
+		keys[i] = -1;
+	int next = 0;
+	for (int done = 0; done < n;) {
+		for (int i = 0; i < FLIGHT; ++i) {
+			if (keys[i] >= 0 && states[i].pending != NULL) {
+				h64_lookup_step(&states[i]);
+				continue;
+			}
+			if (keys[i] >= 0) {
+				assert(states[i].found ==
+				       h64_find(h64, &data[keys[i]]));
+				keys[i] = -1;
+				done += 1;
+			}
+			if (next < n) {
+				keys[i] = next++;
+				h64_lookup_start(&states[i], h64,
+						 &data[keys[i]]);
+			}
+		}
+	}
+}
+
+static void
+lookup_test()
+{
+	enum { N = 10000 };
+	static int data[2 * N];
+	for (int i = 0; i < 2 * N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {
+		0,
+		H64_WIDE_PROBING,
+		H64_MISS_FILTER | H64_STATISTICS,
+		H64_INCREMENTAL_RESIZE,
+	};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		/* Lookups must probe both arrays during a migration. */
+		bool migrating = false;
+		for (int i = 0; i < N; ++i) {
+			h64_insert(h64, &data[i]);
+			if (!migrating && h64->old_groups != NULL) {
+				lookup_all(h64, data, 2 * N);
+				migrating = true;
+			}
+		}
+		assert(migrating == !!(flags[f] & H64_INCREMENTAL_RESIZE));
+		lookup_all(h64, data, 2 * N);
+
+		uint64_t hash = int_hash(&data[0], h64_seed(h64));
+		struct h64_lookup_state state;
+		const struct h64_group *group =
+			h64_lookup_start_hashed(&state, h64, &data[0], hash);
+		while (group != NULL)
+			group = h64_lookup_step(&state);
+		assert(state.found == &data[0]);
+		h64_destroy(h64);
+	}
+}
+
+static void
+hashed_test()
+{
+	struct h64 *h64 = h64_create(int_hash, int_equals);
+
+	enum { N = 1000 };
+	int data[N];
+	uint64_t hashes[N];
+	uint64_t seed = h64_seed(h64);
+	for (int i = 0; i < N; ++i) {
+		data[i] = i;
+		hashes[i] = int_hash(&data[i], seed);
+	}
+
+	/* The seed must survive resizing. */
+	for (int i = 0; i < N; ++i)
+		h64_insert_hashed(h64, &data[i], hashes[i]);
+	assert(h64_count(h64) == N);
+	assert(h64_seed(h64) == seed);
+
+	for (int i = 0; i < N; ++i)
+		assert(h64_find_hashed(h64, &data[i], hashes[i]) == &data[i]);
+	for (int i = 0; i < N; ++i) {
+		int *erased = h64_erase_hashed(h64, &data[i], hashes[i]);
+		assert(erased == &data[i]);
+	}
+	assert(h64_count(h64) == 0);
+	assert(h64_seed(h64) == seed);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find_hashed(h64, &data[i], hashes[i]) == NULL);
+
+	h64_destroy(h64);
+}
+
+/* Key and value of an aggregation, int_hash and int_equals see the key. */
+struct counter {
+	int key;
+	int count;
+};
+
+static void
+find_or_insert_test()
+{
+	enum { K = 5000, ROUNDS = 4 };
+	static struct counter counters[K];
+
+	unsigned flags[] = {0, H64_INCREMENTAL_RESIZE,
+			    H64_MISS_FILTER | H64_STORE_HASHES,
+			    H64_WIDE_PROBING | H64_INCREMENTAL_RESIZE};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int r = 0; r < ROUNDS; ++r) {
+			for (int i = 0; i < K; ++i) {
+				struct counter key = { i, 0 };
+				bool inserted;
+				void **slot = h64_find_or_insert(h64, &key,
+								 &inserted);
+				assert(inserted == (r == 0));
+				if (inserted) {
+					counters[i] = key;
+					*slot = &counters[i];
+				}
+				((struct counter *)*slot)->count += 1;
+				assert(h64_find(h64, &key) == &counters[i]);
+			}
+			assert(h64_count(h64) == K);
+		}
+		for (int i = 0; i < K; ++i)
+			assert(counters[i].count == ROUNDS);
+
+		int key = K;
+		bool inserted;
+		void **slot = h64_find_or_insert_hashed(
+			h64, &key, int_hash(&key, h64_seed(h64)), &inserted);
+		assert(inserted && *slot == &key);
+		int *erased = h64_erase(h64, &key);
+		assert(erased == &key);
+		h64_destroy(h64);
+	}
+}
+
+/* A record is looked up by a slice of a string, not its name. */
+struct record {
+	const char *name;
+	int value;
+};
+
+struct slice {
+	const char *data;
+	int len;
+};
+
+static uint64_t
+record_hash(const void *entry, uint64_t seed)
+{
+	const struct record *record = entry;
+	return h64_byte_hash(record->name, strlen(record->name), seed);
+}
+
+static int
+record_equals(const void *lhs, const void *rhs)
+{
+	const struct record *l = lhs, *r = rhs;
+	return strcmp(l->name, r->name) == 0;
+}
+
+static uint64_t
+slice_hash(const void *key, uint64_t seed)
+{
+	const struct slice *slice = key;
+	return h64_byte_hash(slice->data, slice->len, seed);
+}
+
+static int
+slice_equals(const void *key, const void *entry)
+{
+	const struct slice *slice = key;
+	const struct record *record = entry;
+	return strncmp(record->name, slice->data, slice->len) == 0 &&
+	       record->name[slice->len] == '\0';
+}
+
+static void
+find_key_test()
+{
+	static struct record records[] = {
+		{ "get", 1 }, { "set", 2 }, { "del", 3 }, { "getset", 4 },
+	};
+	enum { N = sizeof(records) / sizeof(records[0]) };
+	struct h64 *h64 = h64_create(record_hash, record_equals);
+	for (int i = 0; i < N; ++i)
+		h64_insert(h64, &records[i]);
+
+	const char *request = "getset key value";
+	struct slice get = { request, 3 };
+	struct slice getset = { request, 6 };
+	struct slice ge = { request, 2 };
+	assert(h64_find_key(h64, &get, slice_hash, slice_equals) ==
+	       &records[0]);
+	assert(h64_find_key(h64, &getset, slice_hash, slice_equals) ==
+	       &records[3]);
+	assert(h64_find_key(h64, &ge, slice_hash, slice_equals) == NULL);
+
+	uint64_t hash = slice_hash(&get, h64_seed(h64));
+	assert(hash == record_hash(&records[0], h64_seed(h64)));
+	assert(h64_find_key_hashed(h64, &get, hash, slice_equals) ==
+	       &records[0]);
+	h64_destroy(h64);
+}
+
+static int int_hash_calls;
+
+static uint64_t
+counting_int_hash(const void *ptr, uint64_t seed)
+{
+	int_hash_calls += 1;
+	return int_hash(ptr, seed);
+}
+
+static void
+stored_hashes_test()
+{
+	struct h64_options options = {
+		.hasher = counting_int_hash,
+		.equals = int_equals,
+		.flags = H64_STORE_HASHES,
+	};
+	struct h64 *h64 = h64_create_ex(&options);
+
+	enum { N = 10000 };
+	static int data[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	/* Growing must not rehash already inserted entries. */
+	int_hash_calls = 0;
+	for (int i = 0; i < N; ++i)
+		h64_insert_new(h64, &data[i]);
+	assert(int_hash_calls == N);
+	h64_reserve(h64, 4 * N);
+	assert(int_hash_calls == N);
+
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == &data[i]);
+
+	/* Neither does shrinking. */
+	int_hash_calls = 0;
+	for (int i = 0; i < N - 10; ++i) {
+		int *erased = h64_erase(h64, &data[i]);
+		assert(erased == &data[i]);
+	}
+	assert(int_hash_calls == N - 10);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == (i < N - 10 ? NULL : &data[i]));
+
+	h64_destroy(h64);
+}
+
+static void
+incremental_resize_test()
+{
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.flags = H64_INCREMENTAL_RESIZE,
+	};
+	struct h64 *h64 = h64_create_ex(&options);
+
+	enum { N = 10000 };
+	static int data[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	/* Everything must be reachable at every step of migrations. */
+	bool migrated = false;
+	for (int i = 0; i < N; ++i) {
+		h64_insert(h64, &data[i]);
+		assert(h64_find(h64, &data[i / 2]) == &data[i / 2]);
+		assert(h64_find(h64, &data[i]) == &data[i]);
+		migrated |= h64->old_groups != NULL;
+	}
+	assert(h64_count(h64) == N);
+	assert(migrated);
+
+	size_t seen = 0;
+	h64_for_each(h64, entry) {
+		assert(h64_find(h64, entry) == entry);
+		seen += 1;
+	}
+	assert(seen == N);
+
+	for (int i = 0; i < N; ++i) {
+		int *erased = h64_erase(h64, &data[i]);
+		assert(erased == &data[i]);
+		assert(h64_find(h64, &data[i]) == NULL);
+		if (i + 1 < N)
+			assert(h64_find(h64, &data[N - 1]) == &data[N - 1]);
+	}
+	assert(h64_count(h64) == 0);
+
+	h64_destroy(h64);
+}
+
+static void
+resize_policy_test()
+{
+	enum { N = 10000 };
+	static int data[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.flags = H64_NO_SHRINK,
+		.max_load_factor = 0.8,
+		.min_capacity = 1000,
+	};
+	struct h64 *h64 = h64_create_ex(&options);
+	size_t min_size = h64->size_in_groups;
+	assert(min_size * H64_INTERNAL_GROUP_ENTRIES * 0.8 >= 1000);
+
+	/* No allocations up to min_capacity. */
+	for (int i = 0; i < 1000; ++i)
+		h64_insert(h64, &data[i]);
+	assert(h64->size_in_groups == min_size);
+
+	for (int i = 1000; i < N; ++i)
+		h64_insert(h64, &data[i]);
+	assert(h64_count(h64) <= 0.8 * h64->size_in_groups *
+				 H64_INTERNAL_GROUP_ENTRIES);
+	size_t max_size = h64->size_in_groups;
+
+	for (int i = 0; i < N - 1; ++i)
+		h64_erase(h64, &data[i]);
+	assert(h64->size_in_groups == max_size);
+
+	/* Shrinking stops at the size for min_capacity. */
+	h64_shrink_to_fit(h64);
+	assert(h64->size_in_groups == min_size);
+	assert(h64_find(h64, &data[N - 1]) == &data[N - 1]);
+	h64_destroy(h64);
+
+	/* Without H64_NO_SHRINK the floor holds for erases too. */
+	options.flags = 0;
+	h64 = h64_create_ex(&options);
+	for (int i = 0; i < N; ++i)
+		h64_insert(h64, &data[i]);
+	for (int i = 0; i < N; ++i)
+		h64_erase(h64, &data[i]);
+	assert(h64->size_in_groups == min_size);
+	h64_destroy(h64);
+}
+
+struct counting_allocator {
+	size_t allocated;
+	size_t allocations;
+};
+
+static void *
+counting_alloc(void *ctx, size_t size, size_t alignment)
+{
+	struct counting_allocator *a = ctx;
+	a->allocated += size;
+	a->allocations += 1;
+	size_t aligned_size = (size + alignment - 1) / alignment * alignment;
+	void *ptr = aligned_alloc(alignment, aligned_size);
+	memset(ptr, 0, aligned_size);
+	return ptr;
+}
+
+static void
+counting_free(void *ctx, void *ptr, size_t size)
+{
+	struct counting_allocator *a = ctx;
+	a->allocated -= size;
+	a->allocations -= 1;
+	free(ptr);
+}
+
+static void
+fill_and_drain(const struct h64_options *options)
+{
+	enum { N = 10000 };
+	static int data[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	struct h64 *h64 = h64_create_ex(options);
+	for (int i = 0; i < N; ++i)
+		h64_insert(h64, &data[i]);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == &data[i]);
+	for (int i = 0; i < N / 2; ++i) {
+		int *erased = h64_erase(h64, &data[i]);
+		assert(erased == &data[i]);
+	}
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == (i < N / 2 ? NULL : &data[i]));
+	h64_destroy(h64);
+}
+
+static void
+allocator_test()
+{
+	struct counting_allocator counter = {0};
+	struct h64_allocator allocator = {
+		.alloc = counting_alloc,
+		.free = counting_free,
+		.ctx = &counter,
+	};
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.allocator = &allocator,
+	};
+	fill_and_drain(&options);
+	assert(counter.allocated == 0 && counter.allocations == 0);
+
+	options.flags = H64_STORE_HASHES | H64_INCREMENTAL_RESIZE;
+	fill_and_drain(&options);
+	assert(counter.allocated == 0 && counter.allocations == 0);
+
+	struct h64_allocator mmap_allocator = h64_mmap_allocator(
+		H64_MMAP_THP | H64_MMAP_HUGETLB_2MB);
+	options.allocator = &mmap_allocator;
+	fill_and_drain(&options);
+
+	/* Without libnuma or NUMA support it's the mmap allocator. */
+	struct h64_allocator numa_allocator = h64_numa_allocator(0);
+	options.allocator = &numa_allocator;
+	fill_and_drain(&options);
+}
+
+struct counting_executor {
+	size_t runs;
+};
+
+static void
+counting_run(void *ctx, void (*task)(void *arg, size_t i), void *arg,
+	     size_t ntasks)
+{
+	struct counting_executor *e = ctx;
+	e->runs += 1;
+	/* In reverse, tasks must not depend on the order. */
+	for (size_t i = ntasks; i > 0; --i)
+		task(arg, i - 1);
+}
+
+static void
+parallel_test()
+{
+	enum { N = 300000, BASE = 1000 };
+	static int data[N];
+	static void *entries[N];
+	for (int i = 0; i < N; ++i) {
+		data[i] = i;
+		entries[i] = &data[i];
+	}
+
+	/* On threads, to an empty table and to a table with entries. */
+	unsigned flags[] = {0, H64_STORE_HASHES, H64_WIDE_PROBING,
+			    H64_MISS_FILTER};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		h64_build_parallel(h64, entries, N, 4);
+		assert(h64_count(h64) == N);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(h64, &data[i]) == &data[i]);
+		h64_destroy(h64);
+
+		h64 = h64_create_ex(&options);
+		for (int i = 0; i < BASE; ++i)
+			h64_insert(h64, &data[i]);
+		h64_build_parallel(h64, entries + BASE, N - BASE, 3);
+		assert(h64_count(h64) == N);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(h64, &data[i]) == &data[i]);
+		h64_destroy(h64);
+	}
+
+	/* Resizes of big tables go to the executor. */
+	struct counting_executor counter = {0};
+	struct h64_executor executor = {
+		.run = counting_run,
+		.ctx = &counter,
+		.threads = 8,
+	};
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.executor = &executor,
+	};
+	struct h64 *h64 = h64_create_ex(&options);
+	for (int i = 0; i < N; ++i)
+		h64_insert(h64, &data[i]);
+	assert(counter.runs > 0);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == &data[i]);
+	size_t runs = counter.runs;
+	h64_reserve(h64, 4 * N);
+	assert(counter.runs > runs);
+	for (int i = 0; i < N; ++i)
+		assert(h64_find(h64, &data[i]) == &data[i]);
+	h64_destroy(h64);
+}
+
+/* Source over an array, hashing the entries itself if it has a table. */
+struct array_source {
+	void **entries;
+	size_t n;
+	size_t position;
+	const struct h64 *h64;
+};
+
+static size_t
+array_read(void *ctx, void **entries, uint64_t *hashes, size_t max)
+{
+	struct array_source *src = ctx;
+	size_t n = src->n - src->position < max ? src->n - src->position : max;
+	for (size_t i = 0; i < n; ++i) {
+		entries[i] = src->entries[src->position + i];
+		if (hashes != NULL)
+			hashes[i] = int_hash(entries[i], h64_seed(src->h64));
+	}
+	src->position += n;
+	return n;
+}
+
+static void
+build_from_test()
+{
+	enum { N = 100000, BASE = 1000 };
+	static int data[N];
+	static void *entries[N];
+	for (int i = 0; i < N; ++i) {
+		data[i] = i;
+		entries[i] = &data[i];
+	}
+
+	unsigned flags[] = {0, H64_STORE_HASHES | H64_MISS_FILTER,
+			    H64_WIDE_PROBING | H64_INCREMENTAL_RESIZE};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		/* Sized as h64_reserve does. */
+		struct h64 *reserved = h64_create_ex(&options);
+		h64_reserve(reserved, N);
+
+		struct h64 *h64 = h64_create_ex(&options);
+		struct array_source src = { entries, N, 0, NULL };
+		struct h64_source source = { array_read, &src, 0 };
+		h64_build_from(h64, &source, N);
+		assert(h64_count(h64) == N);
+		assert(h64->size_in_groups == reserved->size_in_groups);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(h64, &data[i]) == &data[i]);
+		h64_destroy(h64);
+		h64_destroy(reserved);
+
+		/* Hashed, to a table with entries, ending early. */
+		h64 = h64_create_ex(&options);
+		for (int i = 0; i < BASE; ++i)
+			h64_insert(h64, &data[i]);
+		src = (struct array_source){ entries + BASE, N / 2, 0, h64 };
+		source = (struct h64_source){ array_read, &src, 1 };
+		h64_build_from(h64, &source, N - BASE);
+		assert(h64_count(h64) == BASE + N / 2);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(h64, &data[i]) ==
+			       (i < BASE + N / 2 ? &data[i] : NULL));
+		h64_destroy(h64);
+	}
+}
+
+static void
+iterate_test()
+{
+	enum { N = 10000, MAX_PARTS = 7 };
+	static int data[N];
+	static uint8_t seen[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {0, H64_INCREMENTAL_RESIZE};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		/* Stop in the middle of a migration if there is one. */
+		int n = 0;
+		while (n < N && (n < N / 2 || (flags[f] && !h64->old_groups)))
+			h64_insert(h64, &data[n++]);
+		assert(!flags[f] || h64->old_groups != NULL);
+
+		for (size_t parts = 1; parts <= MAX_PARTS; parts += 3) {
+			memset(seen, 0, sizeof(seen));
+			for (size_t part = 0; part < parts; ++part) {
+				struct h64_iterator it =
+					h64_iterate_part(h64, part, parts);
+				int *entry;
+				while ((entry = h64_next(&it)) != NULL)
+					seen[entry - data] += 1;
+				entry = h64_next(&it);
+				assert(entry == NULL);
+			}
+			for (int i = 0; i < N; ++i)
+				assert(seen[i] == (i < n));
+		}
+
+		size_t visited = 0;
+		h64_for_each(h64, entry) {
+			if (++visited == 3)
+				break;
+		}
+		assert(visited == 3);
+		h64_destroy(h64);
+	}
+}
+
+static void
+scan_mark(void *entry, void *ctx)
+{
+	const int *value = entry;
+	((uint8_t *)ctx)[*value] += 1;
+}
+
+static void
+scan_test()
+{
+	enum { STABLE = 1000, N = 30000, STEP = 256 };
+	static int data[N];
+	static uint8_t seen[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {0, H64_INCREMENTAL_RESIZE,
+			    H64_STORE_HASHES | H64_WIDE_PROBING,
+			    H64_INCREMENTAL_RESIZE | H64_STORE_HASHES};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int i = 0; i < STABLE; ++i)
+			h64_insert(h64, &data[i]);
+
+		/* Without modifications every entry is visited once. */
+		memset(seen, 0, sizeof(seen));
+		uint64_t cursor = 0;
+		do {
+			cursor = h64_scan(h64, cursor, scan_mark, seen);
+		} while (cursor != 0);
+		for (int i = 0; i < STABLE; ++i)
+			assert(seen[i] == 1);
+
+		/*
+		 * Grow the table many times over and shrink it back while
+		 * scanning: stable entries must still be visited.
+		 */
+		memset(seen, 0, sizeof(seen));
+		size_t min_size = h64->size_in_groups;
+		size_t max_size = min_size;
+		int inserted = STABLE, erased = STABLE;
+		cursor = 0;
+		do {
+			cursor = h64_scan(h64, cursor, scan_mark, seen);
+			for (int i = 0; i < STEP && inserted < N; ++i)
+				h64_insert(h64, &data[inserted++]);
+			for (int i = 0; i < 2 * STEP && inserted == N &&
+					erased < N; ++i)
+				h64_erase(h64, &data[erased++]);
+			if (h64->size_in_groups > max_size)
+				max_size = h64->size_in_groups;
+		} while (cursor != 0);
+		assert(erased == N);
+		assert(max_size >= 16 * min_size);
+		assert(h64->size_in_groups < max_size);
+		for (int i = 0; i < STABLE; ++i)
+			assert(seen[i] >= 1);
+		h64_destroy(h64);
+	}
+}
+
+struct diff_counts {
+	size_t removed;
+	size_t added;
+	size_t replaced;
+};
+
+static void
+diff_count(void *from_entry, void *to_entry, void *ctx)
+{
+	struct diff_counts *counts = ctx;
+	assert(from_entry != NULL || to_entry != NULL);
+	if (to_entry == NULL)
+		counts->removed += 1;
+	else if (from_entry == NULL)
+		counts->added += 1;
+	else
+		counts->replaced += *(int *)from_entry == *(int *)to_entry;
+}
+
+static void
+clone_test()
+{
+	enum { N = 20000, REMOVED = 500, ADDED = 700, REPLACED = 300 };
+	static int data[N + ADDED];
+	static int copies[REPLACED];
+	for (int i = 0; i < N + ADDED; ++i)
+		data[i] = i;
+	for (int i = 0; i < REPLACED; ++i)
+		copies[i] = REMOVED + i;
+
+	unsigned flags[] = {0, H64_STORE_HASHES | H64_MISS_FILTER,
+			    H64_INCREMENTAL_RESIZE | H64_WIDE_PROBING};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int i = 0; i < N; ++i)
+			h64_insert(h64, &data[i]);
+
+		struct h64 *clone = h64_clone(h64);
+		assert(h64_count(clone) == N);
+		assert(h64_seed(clone) == h64_seed(h64));
+		assert(h64_diff(h64, clone, NULL, NULL) == 0);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(clone, &data[i]) == &data[i]);
+
+		/* The clone is modified apart from the table. */
+		for (int i = 0; i < REMOVED; ++i) {
+			int *erased = h64_erase(clone, &data[i]);
+			assert(erased == &data[i]);
+		}
+		for (int i = 0; i < REPLACED; ++i)
+			h64_insert(clone, &copies[i]);
+		for (int i = N; i < N + ADDED; ++i)
+			h64_insert(clone, &data[i]);
+		assert(h64_count(h64) == N);
+		for (int i = 0; i < N; ++i)
+			assert(h64_find(h64, &data[i]) == &data[i]);
+
+		struct diff_counts counts = {0, 0, 0};
+		size_t diffs = h64_diff(h64, clone, diff_count, &counts);
+		assert(diffs == REMOVED + ADDED + REPLACED);
+		assert(counts.removed == REMOVED && counts.added == ADDED &&
+		       counts.replaced == REPLACED);
+
+		/* Merge keeps entries missing in the source. */
+		h64_merge(h64, clone);
+		assert(h64_count(h64) == N + ADDED);
+		for (int i = 0; i < N + ADDED; ++i) {
+			int *found = h64_find(h64, &data[i]);
+			bool copied = i >= REMOVED && i < REMOVED + REPLACED;
+			assert(found == (copied ? &copies[i - REMOVED]
+						: &data[i]));
+		}
+		counts = (struct diff_counts){0, 0, 0};
+		diffs = h64_diff(h64, clone, diff_count, &counts);
+		assert(diffs == REMOVED);
+		assert(counts.removed == REMOVED);
+
+		/* Tables of other seeds are hashed anew. */
+		options.seed = h64_seed(h64) + 1;
+		struct h64 *other = h64_create_ex(&options);
+		h64_merge(other, h64);
+		assert(h64_count(other) == N + ADDED);
+		assert(h64_diff(h64, other, NULL, NULL) == 0);
+		assert(h64_diff(other, clone, NULL, NULL) == REMOVED);
+
+		h64_destroy(other);
+		h64_destroy(clone);
+		h64_destroy(h64);
+	}
+}
+
+static void
+evict_mark(void *entry, void *ctx)
+{
+	uint8_t *evicted = ctx;
+	int i = *(int *)entry;
+	assert(!evicted[i]);
+	evicted[i] = 1;
+}
+
+static void
+evict_test()
+{
+	enum { CAPACITY = 1000, N = 20000, HOT = 16 };
+	static int data[N];
+	static uint8_t evicted[N];
+	for (int i = 0; i < N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {H64_EVICT, H64_EVICT | H64_STORE_HASHES |
+				       H64_MISS_FILTER | H64_WIDE_PROBING};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		memset(evicted, 0, sizeof(evicted));
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f],
+			.min_capacity = CAPACITY,
+			.evict = evict_mark,
+			.evict_ctx = evicted,
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		size_t size = h64->size_in_groups;
+		assert(size * 7 >= CAPACITY);
+
+		/* The CLOCK state is a part of the footprint. */
+		struct h64_options unbounded_options = options;
+		unbounded_options.flags &= ~(unsigned)H64_EVICT;
+		struct h64 *unbounded = h64_create_ex(&unbounded_options);
+		struct h64_stats stats, unbounded_stats;
+		h64_stats(h64, &stats);
+		h64_stats(unbounded, &unbounded_stats);
+		assert(unbounded->size_in_groups == size);
+		assert(stats.memory_bytes > unbounded_stats.memory_bytes);
+		h64_destroy(unbounded);
+
+		/* Hot entries are looked up all the time, so they stay. */
+		for (int i = 0; i < N; ++i) {
+			h64_insert(h64, &data[i]);
+			/* Found apart from assert, the lookup is the touch. */
+			for (int j = 0; j < HOT && j <= i; ++j) {
+				int *found = h64_find(h64, &data[j]);
+				assert(found == &data[j]);
+			}
+		}
+		assert(h64->size_in_groups == size);
+		assert(h64_count(h64) <= size * 7);
+		size_t present = 0;
+		for (int i = 0; i < N; ++i) {
+			bool found = h64_find(h64, &data[i]) == &data[i];
+			assert(found != evicted[i]);
+			present += found;
+		}
+		assert(present == h64_count(h64));
+		assert(present > CAPACITY);
+
+		/* Groups are never marked full, misses probe one group. */
+		h64_clear_was_full(h64);
+		assert(h64->was_full_groups == 0);
+		for (size_t i = 0; i < h64->size_in_groups; ++i)
+			assert(!(h64->groups[i].status & 0x80));
+
+		/* Nothing resizes a bounded table. */
+		h64_reserve(h64, N);
+		for (int i = HOT; i < N; ++i)
+			h64_erase(h64, &data[i]);
+		assert(h64->size_in_groups == size);
+		assert(h64_count(h64) == HOT);
+		h64_destroy(h64);
+	}
+}
+
+static uint64_t
+histogram_sum(const uint64_t *histogram)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < H64_STATS_PROBE_BUCKETS; ++i)
+		sum += histogram[i];
+	return sum;
+}
+
+enum { STATS_N = 10000 };
+
+/* Table after an insert and two finds, a hit and a miss, per entry. */
+static struct h64 *
+stats_table(const struct h64_options *options)
+{
+	static int data[2 * STATS_N];
+	for (int i = 0; i < 2 * STATS_N; ++i)
+		data[i] = i;
+
+	struct h64 *h64 = h64_create_ex(options);
+	for (int i = 0; i < STATS_N; ++i)
+		h64_insert(h64, &data[i]);
+	for (int i = 0; i < 2 * STATS_N; ++i)
+		h64_find(h64, &data[i]);
+	return h64;
+}
+
+struct probe_calls {
+	uint64_t calls[2];
+	uint64_t probes;
+};
+
+static void
+probe_hook(const struct h64 *h, enum h64_probe_kind kind, uint64_t hash,
+	   size_t probes, void *ctx)
+{
+	(void)h;
+	(void)hash;
+	struct probe_calls *calls = ctx;
+	assert(probes > 0);
+	calls->calls[kind] += 1;
+	calls->probes += probes;
+}
+
+/* The hook sees the same sampled operations as the counters. */
+static void
+probe_hook_test()
+{
+	struct probe_calls calls = { { 0, 0 }, 0 };
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+		.flags = H64_STATISTICS,
+		.stats_sample_shift = 2,
+		.probe_hook = probe_hook,
+		.probe_hook_ctx = &calls,
+		.probe_hook_sample_shift = 2,
+	};
+	struct h64 *h64 = stats_table(&options);
+	struct h64_stats stats;
+	h64_stats(h64, &stats);
+#ifdef H64_TRACING
+	assert(calls.calls[H64_PROBE_LOOKUP] ==
+	       histogram_sum(stats.lookup_probes));
+	assert(calls.calls[H64_PROBE_PLACE] ==
+	       histogram_sum(stats.place_probes));
+	assert(calls.calls[H64_PROBE_LOOKUP] > 0 &&
+	       calls.calls[H64_PROBE_LOOKUP] < 3 * STATS_N);
+	assert(calls.probes >= calls.calls[0] + calls.calls[1]);
+#else
+	/* Builds without tracing never call it. */
+	assert(calls.calls[0] == 0 && calls.calls[1] == 0);
+#endif
+	h64_destroy(h64);
+}
+
+static void
+stats_test()
+{
+	const uint64_t N = STATS_N;
+	struct h64_options options = {
+		.hasher = int_hash,
+		.equals = int_equals,
+	};
+	struct h64_stats stats;
+
+	/* Without the flag only the sizes are there. */
+	struct h64 *h64 = stats_table(&options);
+	h64_stats(h64, &stats);
+	assert(stats.count == N);
+	assert(stats.capacity ==
+	       h64->size_in_groups * H64_INTERNAL_GROUP_ENTRIES);
+	assert(stats.memory_bytes >= h64->size_in_groups * 64);
+	assert(histogram_sum(stats.lookup_probes) == 0);
+	assert(stats.hint_matches == 0 && stats.resizes == 0);
+	h64_destroy(h64);
+
+	options.flags = H64_STATISTICS;
+	h64 = stats_table(&options);
+	h64_stats(h64, &stats);
+	assert(histogram_sum(stats.lookup_probes) == 3 * N);
+	assert(histogram_sum(stats.place_probes) >= N);
+	/* Only the hits are equal. */
+	assert(stats.hint_matches - stats.hint_false_positives == N);
+	assert(stats.resizes > 0);
+	h64_stats_reset(h64);
+	h64_stats(h64, &stats);
+	assert(histogram_sum(stats.lookup_probes) == 0);
+	assert(stats.resizes == 0 && stats.count == N);
+	h64_destroy(h64);
+
+	/* Sampling counts only a part of lookups, but every resize. */
+	options.stats_sample_shift = 3;
+	h64 = stats_table(&options);
+	h64_stats(h64, &stats);
+	assert(stats.sample_shift == 3);
+	uint64_t lookups = histogram_sum(stats.lookup_probes);
+	assert(lookups > 0 && lookups < 3 * N);
+	assert(stats.resizes > 0);
+	h64_destroy(h64);
+}
+
+static void
+miss_filter_test()
+{
+	enum { N = 20000 };
+	static int data[2 * N];
+	for (int i = 0; i < 2 * N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {
+		0,
+		H64_STORE_HASHES,
+		H64_INCREMENTAL_RESIZE,
+		H64_NO_SHRINK | H64_WIDE_PROBING,
+	};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.flags = flags[f] | H64_MISS_FILTER | H64_STATISTICS,
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int i = 0; i < N; ++i)
+			h64_insert(h64, &data[i]);
+		struct h64_stats stats;
+		h64_stats_reset(h64);
+		for (int i = 0; i < 2 * N; ++i)
+			assert(h64_find(h64, &data[i]) ==
+			       (i < N ? &data[i] : NULL));
+		h64_stats(h64, &stats);
+		/* Most misses never reach the groups. */
+		assert(stats.filter_rejects > N * 9 / 10);
+		assert(stats.filter_rejects <= N);
+
+		/* Enough erases to rebuild the filter a few times. */
+		for (int round = 0; round < 4; ++round) {
+			for (int i = 0; i < N; i += 2) {
+				int *erased = h64_erase(h64, &data[i]);
+				assert(erased == &data[i]);
+			}
+			for (int i = 0; i < N; i += 2)
+				h64_insert_new(h64, &data[i]);
+		}
+		for (int i = 1; i < N; i += 2) {
+			int *erased = h64_erase(h64, &data[i]);
+			assert(erased == &data[i]);
+		}
+		for (int i = 0; i < 2 * N; ++i) {
+			bool present = i < N && i % 2 == 0;
+			assert(h64_find(h64, &data[i]) ==
+			       (present ? &data[i] : NULL));
+		}
+		h64_destroy(h64);
+	}
+}
+
+static size_t
+count_was_full(const struct h64 *h64)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < h64->size_in_groups; ++i)
+		count += h64->groups[i].status >> 7;
+	return count;
+}
+
+/* Replace every entry of a table of N entries of data one by one. */
+static void
+churn(struct h64 *h64, int *data, int N, int round)
+{
+	for (int i = 0; i < N; ++i) {
+		int old = (round % 2) * N + i;
+		int new = ((round + 1) % 2) * N + i;
+		int *erased = h64_erase(h64, &data[old]);
+		assert(erased == &data[old]);
+		h64_insert_new(h64, &data[new]);
+	}
+}
+
+static void
+was_full_test()
+{
+	enum { N = 5000, ROUNDS = 8 };
+	static int data[2 * N];
+	for (int i = 0; i < 2 * N; ++i)
+		data[i] = i;
+
+	unsigned flags[] = {0, H64_STORE_HASHES, H64_WIDE_PROBING};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = int_hash,
+			.equals = int_equals,
+			.max_load_factor = 0.9,
+			.flags = flags[f] | H64_NO_SHRINK,
+		};
+		struct h64_stats stats;
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int i = 0; i < N; ++i)
+			h64_insert(h64, &data[i]);
+		for (int round = 0; round < ROUNDS; ++round)
+			churn(h64, data, N, round);
+		h64_stats(h64, &stats);
+		assert(stats.was_full_groups == count_was_full(h64));
+		size_t stale = stats.was_full_groups;
+		double expected = stats.expected_miss_probes;
+
+		h64_clear_was_full(h64);
+		h64_stats(h64, &stats);
+		assert(stats.was_full_groups == count_was_full(h64));
+		assert(stats.was_full_groups < stale);
+		assert(stats.expected_miss_probes < expected);
+		for (int i = 0; i < 2 * N; ++i)
+			assert(h64_find(h64, &data[i]) ==
+			       (i < N ? &data[i] : NULL));
+		h64_destroy(h64);
+
+		/* The flag keeps clearing the bits as the table churns. */
+		options.flags |= H64_CLEAR_WAS_FULL;
+		h64 = h64_create_ex(&options);
+		for (int i = 0; i < N; ++i)
+			h64_insert(h64, &data[i]);
+		for (int round = 0; round < ROUNDS; ++round) {
+			churn(h64, data, N, round);
+			int base = ((round + 1) % 2) * N;
+			for (int i = 0; i < 2 * N; ++i) {
+				bool present = i >= base && i < base + N;
+				assert(h64_find(h64, &data[i]) ==
+				       (present ? &data[i] : NULL));
+			}
+		}
+		h64_stats(h64, &stats);
+		assert(stats.was_full_groups == count_was_full(h64));
+		assert(stats.was_full_groups < stale);
+		h64_destroy(h64);
+	}
+}
+
+/* Only 16 home groups, so probe sequences are long. */
+static uint64_t
+clustered_int_hash(const void *ptr, uint64_t seed)
+{
+	return int_hash(ptr, seed) & ~(uint64_t)0xFFF0;
+}
+
+static void
+kernel_test()
+{
+	const char *name = h64_kernel_name();
+	assert(strcmp(name, "avx512") == 0 || strcmp(name, "avx2") == 0 ||
+	       strcmp(name, "sse2") == 0 || strcmp(name, "neon") == 0 ||
+	       strcmp(name, "swar") == 0);
+	/* The portable kernel is never replaced by a wider one. */
+	const char *asked = getenv("H64_KERNEL");
+	if (asked != NULL && strcmp(asked, "swar") == 0)
+		assert(strcmp(name, "swar") == 0);
+
+	enum { N = 3000 };
+	static int data[2 * N];
+	for (int i = 0; i < 2 * N; ++i)
+		data[i] = i;
+	unsigned flags[] = {
+		H64_NO_SHRINK,
+		H64_NO_SHRINK | H64_WIDE_PROBING,
+		H64_WIDE_PROBING | H64_INCREMENTAL_RESIZE | H64_STORE_HASHES,
+	};
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f) {
+		struct h64_options options = {
+			.hasher = clustered_int_hash,
+			.equals = int_equals,
+			.max_load_factor = 0.9,
+			.flags = flags[f],
+		};
+		struct h64 *h64 = h64_create_ex(&options);
+		for (int i = 0; i < N; ++i)
+			h64_insert(h64, &data[i]);
+		for (int i = 0; i < 2 * N; ++i)
+			assert(h64_find(h64, &data[i]) ==
+			       (i < N ? &data[i] : NULL));
+		for (int i = 0; i < N; i += 2) {
+			int *erased = h64_erase(h64, &data[i]);
+			assert(erased == &data[i]);
+		}
+		for (int i = N; i < 2 * N; i += 2)
+			h64_insert_new(h64, &data[i]);
+		for (int i = 0; i < 2 * N; ++i) {
+			bool present = i % 2 ? i < N : i >= N;
+			assert(h64_find(h64, &data[i]) ==
+			       (present ? &data[i] : NULL));
+		}
+		h64_destroy(h64);
+	}
+}
+
 int main()
 {
 	general_test();
 	resize_test();
+	batch_test();
+	lookup_test();
+	hashed_test();
+	find_or_insert_test();
+	find_key_test();
+	stored_hashes_test();
+	incremental_resize_test();
+	resize_policy_test();
+	allocator_test();
+	parallel_test();
+	stats_test();
+	probe_hook_test();
+	kernel_test();
+	miss_filter_test();
+	was_full_test();
+	build_from_test();
+	iterate_test();
+	scan_test();
+	clone_test();
+	evict_test();
 	return 0;
 }